@@ -0,0 +1,1369 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "edd.h"
+
+#define ARCHIVE_MAGIC "EDDARC01"
+#define INDEX_MAGIC "EDDIDX01"
+#define MAGIC_SIZE 8
+#define MEMBER_MAGIC 0x4d444445u /* "EDDM" */
+#define END_MAGIC 0x45444445u    /* "EDDE" */
+#define HEADER_SIZE 40
+#define ENTRY_SIZE 48
+#define TRAILER_SIZE 48
+
+#define METHOD_STORED 0
+#define METHOD_LZ 1
+
+#define BLOCK_SIZE (256 * 1024)
+#define BLOCK_HEADER_SIZE 8
+#define HASH_BITS 14
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+/* The most a block can take compressed: literals cost a length byte per 255 */
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+struct Member {
+    char* name;
+    char* path; /* where the file is read from, when creating */
+    uint64_t offset; /* of its local header */
+    uint64_t csize;
+    uint64_t size;
+    uint64_t mtime;
+    uint32_t crc;
+    uint32_t mode;
+    uint8_t method;
+    int ok;
+};
+
+/* An archive opened for reading, mapped whole */
+struct Archive {
+    int fd;
+    const uint8_t* map;
+    uint64_t size;
+    uint64_t count;
+    uint64_t index_off;
+    const uint8_t* names;
+    uint64_t names_size;
+    const uint8_t* table;
+    uint32_t slots;
+    uint32_t index_crc;
+};
+
+static void put_u16(uint8_t* p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+    for(int i = 0; i < 4; i++) {
+        p[i] = v >> (8 * i);
+    }
+}
+
+static void put_u64(uint8_t* p, uint64_t v) {
+    for(int i = 0; i < 8; i++) {
+        p[i] = v >> (8 * i);
+    }
+}
+
+static uint16_t get_u16(const uint8_t* p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_u64(const uint8_t* p) {
+    return get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+/*************
+ * Checksums *
+ *************/
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+    for(uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for(int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+/* The CRC-32 of p[0..n) following on from `crc`, which is 0 to start */
+static uint32_t crc32_update(uint32_t crc, const uint8_t* p, size_t n) {
+    pthread_once(&crc_once, crc_init);
+    crc = ~crc;
+    for(size_t i = 0; i < n; i++) {
+        crc = crc_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint64_t fnv1a(const char* s, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for(size_t i = 0; i < n; i++) {
+        h = (h ^ (uint8_t)s[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+/***************
+ * Compression *
+ ***************/
+
+/* An LZ77 variant in the style of LZ4. A block is a series of sequences: a
+   token whose high nibble is the number of literals and low nibble the match
+   length minus MIN_MATCH (15 meaning more length bytes follow, each adding up
+   to 255), the literals, then a 16-bit offset back into the output and the
+   rest of the match length. The last sequence is literals only. */
+
+static int put_sequence(uint8_t* dst, size_t cap, size_t* op,
+                        const uint8_t* lit, size_t nlit, size_t offset,
+                        size_t match) {
+    size_t need = 1 + nlit / 255 + 1 + nlit + (match ? 2 + match / 255 + 1 : 0);
+    if(need > cap - *op) {
+        return 0;
+    }
+    uint8_t* p = dst + *op;
+    size_t mcode = match ? match - MIN_MATCH : 0;
+    *p++ = (nlit < 15 ? nlit : 15) << 4 | (mcode < 15 ? mcode : 15);
+    if(nlit >= 15) {
+        size_t rest = nlit - 15;
+        for(; rest >= 255; rest -= 255) {
+            *p++ = 255;
+        }
+        *p++ = rest;
+    }
+    memcpy(p, lit, nlit);
+    p += nlit;
+    if(match) {
+        put_u16(p, offset);
+        p += 2;
+        if(mcode >= 15) {
+            size_t rest = mcode - 15;
+            for(; rest >= 255; rest -= 255) {
+                *p++ = 255;
+            }
+            *p++ = rest;
+        }
+    }
+    *op = p - dst;
+    return 1;
+}
+
+/* Compress src[0..n) into at most cap bytes of dst. Returns the compressed
+   size, or 0 if it does not fit. */
+static size_t lz_compress(const uint8_t* src, size_t n, uint8_t* dst,
+                          size_t cap) {
+    uint32_t table[1 << HASH_BITS] = {0}; /* 1 + where each hash was seen */
+    size_t ip = 0, anchor = 0, op = 0;
+    while(ip + MIN_MATCH <= n) {
+        uint32_t seq;
+        memcpy(&seq, src + ip, 4);
+        uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+        size_t cand = table[h];
+        table[h] = ip + 1;
+        if(cand == 0 || ip - (cand - 1) > MAX_OFFSET ||
+           memcmp(src + cand - 1, src + ip, MIN_MATCH) != 0) {
+            ip++;
+            continue;
+        }
+        cand--;
+        size_t len = MIN_MATCH;
+        while(ip + len < n && src[cand + len] == src[ip + len]) {
+            len++;
+        }
+        if(!put_sequence(dst, cap, &op, src + anchor, ip - anchor, ip - cand,
+                         len)) {
+            return 0;
+        }
+        ip += len;
+        anchor = ip;
+    }
+    if(!put_sequence(dst, cap, &op, src + anchor, n - anchor, 0, 0)) {
+        return 0;
+    }
+    return op;
+}
+
+static int read_length(const uint8_t* src, size_t n, size_t* ip,
+                       size_t* len) {
+    uint8_t b;
+    do {
+        if(*ip >= n) {
+            return -1;
+        }
+        b = src[(*ip)++];
+        *len += b;
+    } while(b == 255);
+    return 0;
+}
+
+/* Decompress src[0..n) into exactly size bytes of dst. Returns -1 if the
+   data is corrupt. */
+static int lz_decompress(const uint8_t* src, size_t n, uint8_t* dst,
+                         size_t size) {
+    size_t ip = 0, op = 0;
+    while(ip < n) {
+        uint8_t token = src[ip++];
+        size_t nlit = token >> 4;
+        if(nlit == 15 && read_length(src, n, &ip, &nlit) < 0) {
+            return -1;
+        }
+        if(nlit > n - ip || nlit > size - op) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, nlit);
+        ip += nlit;
+        op += nlit;
+        if(ip == n) {
+            break;
+        }
+        if(n - ip < 2) {
+            return -1;
+        }
+        size_t offset = get_u16(src + ip);
+        ip += 2;
+        size_t match = token & 15;
+        if(match == 15 && read_length(src, n, &ip, &match) < 0) {
+            return -1;
+        }
+        match += MIN_MATCH;
+        if(offset == 0 || offset > op || match > size - op) {
+            return -1;
+        }
+        /* Byte by byte: the match may overlap what it is copying */
+        for(size_t i = 0; i < match; i++) {
+            dst[op + i] = dst[op - offset + i];
+        }
+        op += match;
+    }
+    return op == size ? 0 : -1;
+}
+
+/* Compress a member's contents into blocks. Returns them in a malloc'd
+   *out, or NULL if they would not be smaller than the contents. */
+static uint8_t* compress_member(const uint8_t* data, size_t size,
+                                size_t* outlen) {
+    uint8_t* out = malloc(size);
+    if(out == NULL) {
+        return NULL;
+    }
+    size_t used = 0;
+    for(size_t pos = 0; pos < size;) {
+        size_t raw = size - pos < BLOCK_SIZE ? size - pos : BLOCK_SIZE;
+        if(size - used < BLOCK_HEADER_SIZE + 1) {
+            free(out);
+            return NULL;
+        }
+        size_t room = size - used - BLOCK_HEADER_SIZE;
+        uint8_t* block = out + used + BLOCK_HEADER_SIZE;
+        size_t comp = lz_compress(data + pos, raw, block,
+                                  room < raw - 1 ? room : raw - 1);
+        if(comp == 0) {
+            /* Incompressible: store the block */
+            if(raw > room) {
+                free(out);
+                return NULL;
+            }
+            memcpy(block, data + pos, raw);
+        }
+        put_u32(out + used, raw);
+        put_u32(out + used + 4, comp);
+        used += BLOCK_HEADER_SIZE + (comp ? comp : raw);
+        pos += raw;
+    }
+    if(used >= size) {
+        free(out);
+        return NULL;
+    }
+    *outlen = used;
+    return out;
+}
+
+/*************
+ * Utilities *
+ *************/
+
+static int write_all(int fd, const uint8_t* p, size_t n) {
+    while(n > 0) {
+        ssize_t k = write(fd, p, n);
+        if(k < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += k;
+        n -= k;
+    }
+    return 0;
+}
+
+static int pwrite_all(int fd, const uint8_t* p, size_t n, uint64_t off) {
+    while(n > 0) {
+        ssize_t k = pwrite(fd, p, n, off);
+        if(k < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += k;
+        n -= k;
+        off += k;
+    }
+    return 0;
+}
+
+/* Read exactly n bytes. Returns -1 on errors and at the end of the file. */
+static int read_exact(int fd, uint8_t* p, size_t n) {
+    while(n > 0) {
+        ssize_t k = read(fd, p, n);
+        if(k < 0 && errno == EINTR) {
+            continue;
+        }
+        if(k <= 0) {
+            if(k == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        p += k;
+        n -= k;
+    }
+    return 0;
+}
+
+/* Read up to n bytes from off. Returns how many were read, which is fewer
+   than n only at the end of the file, or -1. */
+static ssize_t pread_all(int fd, uint8_t* p, size_t n, uint64_t off) {
+    size_t got = 0;
+    while(got < n) {
+        ssize_t k = pread(fd, p + got, n - got, off + got);
+        if(k < 0 && errno == EINTR) {
+            continue;
+        }
+        if(k < 0) {
+            return -1;
+        }
+        if(k == 0) {
+            break;
+        }
+        got += k;
+    }
+    return got;
+}
+
+/* How many threads to run for `work` items */
+static int pool_size(int jobs, size_t work) {
+    if(work == 0) {
+        return 1;
+    }
+    return (size_t)jobs < work ? jobs : (int)work;
+}
+
+/* Run worker(arg) on `jobs` threads, counting this one */
+static void run_workers(void* (*worker)(void*), void* arg, int jobs) {
+    pthread_t* threads = calloc(jobs, sizeof(pthread_t));
+    int started = 0;
+    for(int i = 1; threads != NULL && i < jobs; i++) {
+        if(pthread_create(&threads[started], NULL, worker, arg) == 0) {
+            started++;
+        }
+    }
+    worker(arg);
+    for(int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+/************
+ * Creating *
+ ************/
+
+struct MemberList {
+    struct Member* v;
+    size_t n, cap;
+    int has_self; /* the archive already exists, as self_dev/self_ino */
+    dev_t self_dev;
+    ino_t self_ino;
+};
+
+static int cmp_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/* By name, and by position among equal names */
+static int cmp_members(const void* a, const void* b) {
+    const struct Member* x = *(const struct Member* const*)a;
+    const struct Member* y = *(const struct Member* const*)b;
+    int c = strcmp(x->name, y->name);
+    return c != 0 ? c : (x > y) - (x < y);
+}
+
+/* The name a path is stored under: without leading "/" and "./" */
+static const char* member_name(const char* path) {
+    for(;;) {
+        if(path[0] == '/') {
+            path++;
+        } else if(path[0] == '.' && path[1] == '/') {
+            path += 2;
+        } else {
+            return path;
+        }
+    }
+}
+
+/* Add the regular files at or under path. Returns -1 if any are missed. */
+static int add_path(struct MemberList* list, const char* path) {
+    struct stat st;
+    if(lstat(path, &st) < 0) {
+        fprintf(stderr, "edd: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if(S_ISDIR(st.st_mode)) {
+        DIR* dir = opendir(path);
+        if(dir == NULL) {
+            fprintf(stderr, "edd: %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        char** names = NULL;
+        size_t n = 0, cap = 0;
+        struct dirent* d;
+        while((d = readdir(dir)) != NULL) {
+            if(strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+                continue;
+            }
+            if(n == cap) {
+                cap = cap ? 2 * cap : 16;
+                char** bigger = realloc(names, cap * sizeof(char*));
+                if(bigger == NULL) {
+                    break;
+                }
+                names = bigger;
+            }
+            names[n++] = strdup(d->d_name);
+        }
+        closedir(dir);
+        qsort(names, n, sizeof(char*), cmp_names);
+        int status = 0;
+        size_t plen = strlen(path);
+        for(size_t i = 0; i < n; i++) {
+            char* child = malloc(plen + strlen(names[i]) + 2);
+            if(child != NULL) {
+                sprintf(child, "%s%s%s", path,
+                        plen > 0 && path[plen - 1] == '/' ? "" : "/", names[i]);
+                status |= add_path(list, child);
+            }
+            free(child);
+            free(names[i]);
+        }
+        free(names);
+        return status;
+    }
+    if(!S_ISREG(st.st_mode)) {
+        fprintf(stderr, "edd: %s: not a regular file, skipped\n", path);
+        return 0;
+    }
+    if(list->has_self && st.st_dev == list->self_dev &&
+       st.st_ino == list->self_ino) {
+        fprintf(stderr, "edd: %s: is the archive, skipped\n", path);
+        return 0;
+    }
+    const char* name = member_name(path);
+    if(name[0] == '\0' || strlen(name) > UINT16_MAX) {
+        fprintf(stderr, "edd: %s: bad member name\n", path);
+        return -1;
+    }
+    if(list->n == list->cap) {
+        size_t cap = list->cap ? 2 * list->cap : 64;
+        struct Member* bigger = realloc(list->v, cap * sizeof(struct Member));
+        if(bigger == NULL) {
+            return -1;
+        }
+        list->v = bigger;
+        list->cap = cap;
+    }
+    struct Member* m = &list->v[list->n++];
+    memset(m, 0, sizeof(*m));
+    m->path = strdup(path);
+    m->name = strdup(name);
+    return 0;
+}
+
+/* Drop every member whose name an earlier one already has, since only one
+   of them could be found by name */
+static void drop_duplicates(struct MemberList* list) {
+    if(list->n < 2) {
+        return;
+    }
+    struct Member** sorted = malloc(list->n * sizeof(struct Member*));
+    if(sorted == NULL) {
+        return;
+    }
+    for(size_t i = 0; i < list->n; i++) {
+        sorted[i] = &list->v[i];
+    }
+    qsort(sorted, list->n, sizeof(struct Member*), cmp_members);
+    for(size_t i = 1; i < list->n; i++) {
+        if(strcmp(sorted[i]->name, sorted[i - 1]->name) == 0) {
+            fprintf(stderr, "edd: %s: duplicate member name %s, skipped\n",
+                    sorted[i]->path, sorted[i]->name);
+            free(sorted[i]->path);
+            sorted[i]->path = NULL;
+        }
+    }
+    free(sorted);
+    size_t kept = 0;
+    for(size_t i = 0; i < list->n; i++) {
+        if(list->v[i].path != NULL) {
+            list->v[kept++] = list->v[i];
+        } else {
+            free(list->v[i].name);
+        }
+    }
+    list->n = kept;
+}
+
+struct Create {
+    struct Member* members;
+    size_t count;
+    int fd;
+    int compress;
+    atomic_size_t next;
+    pthread_mutex_t lock;
+    uint64_t end; /* where the next member goes */
+};
+
+/* Read, compress and write one member. Its space in the archive is claimed
+   only once it is ready, so members land in the order they finish. */
+static int add_member(struct Create* c, struct Member* m) {
+    int fd = open(m->path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        if(fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    m->mtime = st.st_mtime;
+    m->mode = st.st_mode & 07777;
+    /* Read rather than map it: a file truncated while mapped would raise
+       SIGBUS. One that shrinks meanwhile is stored as far as it goes. */
+    uint8_t* data = malloc(st.st_size > 0 ? st.st_size : 1);
+    ssize_t got = data != NULL ? pread_all(fd, data, st.st_size, 0) : -1;
+    close(fd);
+    if(got < 0) {
+        free(data);
+        return -1;
+    }
+    m->size = got;
+
+    m->crc = crc32_update(0, data, m->size);
+    const uint8_t* out = data;
+    uint8_t* compressed = NULL;
+    size_t clen;
+    m->method = METHOD_STORED;
+    m->csize = m->size;
+    if(c->compress && m->size > 0 &&
+       (compressed = compress_member(data, m->size, &clen)) != NULL) {
+        m->method = METHOD_LZ;
+        m->csize = clen;
+        out = compressed;
+    }
+
+    uint8_t header[HEADER_SIZE] = {0};
+    size_t name_len = strlen(m->name);
+    put_u32(header, MEMBER_MAGIC);
+    put_u16(header + 4, name_len);
+    header[6] = m->method;
+    put_u64(header + 8, m->csize);
+    put_u64(header + 16, m->size);
+    put_u64(header + 24, m->mtime);
+    put_u32(header + 32, m->crc);
+    put_u32(header + 36, m->mode);
+
+    pthread_mutex_lock(&c->lock);
+    m->offset = c->end;
+    c->end += HEADER_SIZE + name_len + m->csize;
+    pthread_mutex_unlock(&c->lock);
+
+    int status = 0;
+    uint64_t off = m->offset;
+    if(pwrite_all(c->fd, header, HEADER_SIZE, off) < 0 ||
+       pwrite_all(c->fd, (uint8_t*)m->name, name_len, off + HEADER_SIZE) < 0 ||
+       pwrite_all(c->fd, out, m->csize, off + HEADER_SIZE + name_len) < 0) {
+        status = -1;
+    }
+    free(compressed);
+    free(data);
+    return status;
+}
+
+static void* create_worker(void* arg) {
+    struct Create* c = arg;
+    size_t i;
+    while((i = atomic_fetch_add(&c->next, 1)) < c->count) {
+        struct Member* m = &c->members[i];
+        m->ok = add_member(c, m) == 0;
+        if(!m->ok) {
+            fprintf(stderr, "edd: %s: %s\n", m->path, strerror(errno));
+        }
+    }
+    return NULL;
+}
+
+/* Write the end marker, the index and the trailer after the members */
+static int write_index(int fd, struct Member* members, size_t count,
+                       uint64_t off) {
+    size_t n = 0, names_size = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(members[i].ok) {
+            n++;
+            names_size += strlen(members[i].name);
+        }
+    }
+    uint32_t slots = 1;
+    while(slots < 2 * n) {
+        slots *= 2;
+    }
+    size_t index_size = 4 + n * ENTRY_SIZE + names_size + (size_t)slots * 4;
+    uint8_t* buf = calloc(index_size + TRAILER_SIZE, 1);
+    if(buf == NULL) {
+        return -1;
+    }
+    put_u32(buf, END_MAGIC);
+    uint8_t* entries = buf + 4;
+    uint8_t* names = entries + n * ENTRY_SIZE;
+    uint8_t* table = names + names_size;
+    size_t e = 0, name_off = 0;
+    for(size_t i = 0; i < count; i++) {
+        struct Member* m = &members[i];
+        if(!m->ok) {
+            continue;
+        }
+        size_t len = strlen(m->name);
+        uint8_t* p = entries + e * ENTRY_SIZE;
+        put_u64(p, m->offset);
+        put_u64(p + 8, m->csize);
+        put_u64(p + 16, m->size);
+        put_u64(p + 24, m->mtime);
+        put_u32(p + 32, name_off);
+        put_u16(p + 36, len);
+        p[38] = m->method;
+        put_u32(p + 40, m->crc);
+        put_u32(p + 44, m->mode);
+        memcpy(names + name_off, m->name, len);
+        name_off += len;
+        uint64_t h = fnv1a(m->name, len);
+        for(uint32_t probe = 0;; probe++) {
+            uint8_t* slot = table + 4 * ((h + probe) & (slots - 1));
+            if(get_u32(slot) == 0) {
+                put_u32(slot, e + 1);
+                break;
+            }
+        }
+        e++;
+    }
+
+    uint8_t* trailer = buf + index_size;
+    memcpy(trailer, INDEX_MAGIC, MAGIC_SIZE);
+    put_u64(trailer + 8, n);
+    put_u64(trailer + 16, off + 4);
+    put_u64(trailer + 24, names_size);
+    put_u64(trailer + 32, off + (table - buf));
+    put_u32(trailer + 40, slots);
+    put_u32(trailer + 44, crc32_update(0, entries, index_size - 4));
+    int status = pwrite_all(fd, buf, index_size + TRAILER_SIZE, off);
+    free(buf);
+    return status;
+}
+
+static int create(const char* archive, char** paths, int npaths, int jobs,
+                  int compress, const char* dir) {
+    /* The archive is not touched until every path has been found, and it is
+       opened from where we started, whatever -C says */
+    struct MemberList list = {0};
+    struct stat st;
+    if(stat(archive, &st) == 0) {
+        list.has_self = 1;
+        list.self_dev = st.st_dev;
+        list.self_ino = st.st_ino;
+    }
+    int cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if(cwd < 0 || (dir != NULL && chdir(dir) < 0)) {
+        fprintf(stderr, "edd: %s: %s\n", cwd < 0 ? "." : dir, strerror(errno));
+        if(cwd >= 0) {
+            close(cwd);
+        }
+        return 1;
+    }
+    int status = 0;
+    for(int i = 0; i < npaths; i++) {
+        if(add_path(&list, paths[i]) < 0) {
+            status = 1;
+        }
+    }
+    drop_duplicates(&list);
+    int fd = -1;
+    if(status == 0) {
+        fd = openat(cwd, archive, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+        if(fd < 0) {
+            fprintf(stderr, "edd: %s: %s\n", archive, strerror(errno));
+        }
+    } else {
+        fprintf(stderr, "edd: %s: not written\n", archive);
+    }
+    close(cwd);
+    if(fd < 0) {
+        for(size_t i = 0; i < list.n; i++) {
+            free(list.v[i].name);
+            free(list.v[i].path);
+        }
+        free(list.v);
+        return 1;
+    }
+
+    struct Create c = {.members = list.v, .count = list.n, .fd = fd,
+                       .compress = compress, .end = MAGIC_SIZE};
+    atomic_init(&c.next, 0);
+    pthread_mutex_init(&c.lock, NULL);
+    if(pwrite_all(fd, (const uint8_t*)ARCHIVE_MAGIC, MAGIC_SIZE, 0) < 0) {
+        fprintf(stderr, "edd: %s: %s\n", archive, strerror(errno));
+        status = 1;
+    } else {
+        run_workers(create_worker, &c, pool_size(jobs, list.n));
+        if(write_index(fd, list.v, list.n, c.end) < 0) {
+            fprintf(stderr, "edd: %s: %s\n", archive, strerror(errno));
+            status = 1;
+        }
+    }
+    for(size_t i = 0; i < list.n; i++) {
+        status |= !list.v[i].ok;
+        free(list.v[i].name);
+        free(list.v[i].path);
+    }
+    pthread_mutex_destroy(&c.lock);
+    free(list.v);
+    if(close(fd) < 0) {
+        fprintf(stderr, "edd: %s: %s\n", archive, strerror(errno));
+        status = 1;
+    }
+    return status;
+}
+
+/**************
+ * Extracting *
+ **************/
+
+static int open_archive(const char* path, struct Archive* a) {
+    memset(a, 0, sizeof(*a));
+    a->fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(a->fd < 0 || fstat(a->fd, &st) < 0) {
+        fprintf(stderr, "edd: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    a->size = st.st_size;
+    if(!S_ISREG(st.st_mode) || a->size < MAGIC_SIZE + 4 + TRAILER_SIZE) {
+        fprintf(stderr, "edd: %s: not an edd archive\n", path);
+        return -1;
+    }
+    a->map = mmap(NULL, a->size, PROT_READ, MAP_SHARED, a->fd, 0);
+    if(a->map == MAP_FAILED) {
+        a->map = NULL;
+        fprintf(stderr, "edd: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    const uint8_t* t = a->map + a->size - TRAILER_SIZE;
+    a->count = get_u64(t + 8);
+    a->index_off = get_u64(t + 16);
+    a->names_size = get_u64(t + 24);
+    uint64_t table_off = get_u64(t + 32);
+    a->slots = get_u32(t + 40);
+    a->index_crc = get_u32(t + 44);
+    uint64_t end = a->size - TRAILER_SIZE;
+    /* Each check keeps the next from overflowing */
+    if(memcmp(a->map, ARCHIVE_MAGIC, MAGIC_SIZE) != 0 ||
+       memcmp(t, INDEX_MAGIC, MAGIC_SIZE) != 0 ||
+       a->index_off < MAGIC_SIZE + 4 || a->index_off > end ||
+       a->count > (end - a->index_off) / ENTRY_SIZE ||
+       a->names_size > end - a->index_off - a->count * ENTRY_SIZE ||
+       table_off != a->index_off + a->count * ENTRY_SIZE + a->names_size ||
+       a->slots == 0 || (a->slots & (a->slots - 1)) != 0 ||
+       a->slots <= a->count || (end - table_off) / 4 != a->slots ||
+       (end - table_off) % 4 != 0 ||
+       get_u32(a->map + a->index_off - 4) != END_MAGIC) {
+        fprintf(stderr, "edd: %s: not an edd archive\n", path);
+        return -1;
+    }
+    a->names = a->map + a->index_off + a->count * ENTRY_SIZE;
+    a->table = a->map + table_off;
+    return 0;
+}
+
+static void close_archive(struct Archive* a) {
+    if(a->map != NULL) {
+        munmap((void*)a->map, a->size);
+    }
+    if(a->fd >= 0) {
+        close(a->fd);
+    }
+}
+
+static int check_index(const struct Archive* a, const char* path) {
+    const uint8_t* start = a->map + a->index_off;
+    size_t len = a->size - TRAILER_SIZE - a->index_off;
+    if(crc32_update(0, start, len) != a->index_crc) {
+        fprintf(stderr, "edd: %s: the index is corrupt\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Read entry i into m. Returns -1 if it points outside the members. */
+static int read_entry(const struct Archive* a, uint64_t i, struct Member* m) {
+    const uint8_t* e = a->map + a->index_off + i * ENTRY_SIZE;
+    memset(m, 0, sizeof(*m));
+    m->offset = get_u64(e);
+    m->csize = get_u64(e + 8);
+    m->size = get_u64(e + 16);
+    m->mtime = get_u64(e + 24);
+    uint32_t name_off = get_u32(e + 32);
+    uint16_t name_len = get_u16(e + 36);
+    m->method = e[38];
+    m->crc = get_u32(e + 40);
+    m->mode = get_u32(e + 44);
+    uint64_t members_end = a->index_off - 4;
+    if(name_off > a->names_size || name_len > a->names_size - name_off ||
+       m->offset < MAGIC_SIZE || m->offset > members_end ||
+       (uint64_t)HEADER_SIZE + name_len > members_end - m->offset ||
+       m->csize > members_end - m->offset - HEADER_SIZE - name_len ||
+       m->method > METHOD_LZ ||
+       (m->method == METHOD_STORED && m->csize != m->size)) {
+        return -1;
+    }
+    m->name = strndup((const char*)a->names + name_off, name_len);
+    return m->name == NULL ? -1 : 0;
+}
+
+/* The entry of the member called name, or -1 */
+static int64_t lookup(const struct Archive* a, const char* name) {
+    size_t len = strlen(name);
+    uint64_t h = fnv1a(name, len);
+    for(uint32_t probe = 0; probe < a->slots; probe++) {
+        uint32_t v = get_u32(a->table + 4 * ((h + probe) & (a->slots - 1)));
+        if(v == 0 || v > a->count) {
+            return -1;
+        }
+        const uint8_t* e = a->map + a->index_off + (uint64_t)(v - 1) * ENTRY_SIZE;
+        uint32_t name_off = get_u32(e + 32);
+        uint16_t name_len = get_u16(e + 36);
+        if(name_len == len && name_off <= a->names_size &&
+           len <= a->names_size - name_off &&
+           memcmp(a->names + name_off, name, len) == 0) {
+            return v - 1;
+        }
+    }
+    return -1;
+}
+
+/* Where a member's data comes from: a mapped archive, or a stream */
+struct Reader {
+    const uint8_t* mem; /* NULL when reading from fd */
+    int fd;
+    uint8_t* buf; /* holds what take() returns from fd */
+    uint64_t left; /* of the member's data */
+};
+
+/* The next n bytes of the member's data, or NULL */
+static const uint8_t* take(struct Reader* r, size_t n) {
+    if(n > r->left) {
+        errno = EINVAL;
+        return NULL;
+    }
+    r->left -= n;
+    if(r->mem != NULL) {
+        const uint8_t* p = r->mem;
+        r->mem += n;
+        return p;
+    }
+    return read_exact(r->fd, r->buf, n) == 0 ? r->buf : NULL;
+}
+
+/* Copy n bytes at off in the archive to out within the kernel, falling back
+   to writing them from p where that is not possible */
+static int copy_range(int afd, uint64_t off, int out, const uint8_t* p,
+                      uint64_t n) {
+    loff_t in_off = off;
+    while(n > 0) {
+        ssize_t k = copy_file_range(afd, &in_off, out, NULL, n, 0);
+        if(k < 0 && errno == EINTR) {
+            continue;
+        }
+        if(k <= 0) {
+            if(k == 0 || errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+               errno == EOPNOTSUPP || errno == EBADF) {
+                return write_all(out, p + (in_off - off), n);
+            }
+            return -1;
+        }
+        n -= k;
+    }
+    return 0;
+}
+
+/* Write a member's contents to out, checking them against its CRC. afd is
+   the archive, or -1 if it is not mapped. Returns an error message, or NULL.
+   `block` is BLOCK_SIZE bytes for decompressing into. */
+static const char* copy_member(struct Reader* r, const struct Member* m,
+                               int out, int afd, uint8_t* block) {
+    uint32_t crc = 0;
+    if(m->method == METHOD_STORED && afd >= 0) {
+        uint64_t off = m->offset + HEADER_SIZE + strlen(m->name);
+        const uint8_t* p = take(r, m->size);
+        if(p == NULL) {
+            return "corrupt data";
+        }
+        if(crc32_update(0, p, m->size) != m->crc) {
+            return "checksum mismatch";
+        }
+        return copy_range(afd, off, out, p, m->size) < 0 ? strerror(errno) : NULL;
+    }
+    for(uint64_t left = m->size; left > 0;) {
+        size_t raw = left < BLOCK_SIZE ? left : BLOCK_SIZE;
+        const uint8_t* p;
+        if(m->method == METHOD_STORED) {
+            p = take(r, raw);
+        } else {
+            const uint8_t* header = take(r, BLOCK_HEADER_SIZE);
+            if(header == NULL) {
+                return "corrupt data";
+            }
+            raw = get_u32(header);
+            size_t comp = get_u32(header + 4);
+            if(raw == 0 || raw > BLOCK_SIZE || raw > left ||
+               comp > LZ_BOUND(BLOCK_SIZE)) {
+                return "corrupt data";
+            }
+            p = take(r, comp ? comp : raw);
+            if(p != NULL && comp != 0) {
+                p = lz_decompress(p, comp, block, raw) == 0 ? block : NULL;
+            }
+        }
+        if(p == NULL) {
+            return "corrupt data";
+        }
+        crc = crc32_update(crc, p, raw);
+        if(write_all(out, p, raw) < 0) {
+            return strerror(errno);
+        }
+        left -= raw;
+    }
+    if(r->left != 0) {
+        return "corrupt data";
+    }
+    return crc == m->crc ? NULL : "checksum mismatch";
+}
+
+/* A name that cannot land outside the directory being extracted into */
+static int safe_name(const char* name) {
+    if(name[0] == '\0' || name[0] == '/') {
+        return 0;
+    }
+    const char* p = name;
+    for(;;) {
+        if(p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0')) {
+            return 0;
+        }
+        p = strchr(p, '/');
+        if(p == NULL) {
+            return 1;
+        }
+        p++;
+    }
+}
+
+static int make_parents(const char* name) {
+    char* copy = strdup(name);
+    if(copy == NULL) {
+        return -1;
+    }
+    for(char* p = strchr(copy, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        /* Other workers may be making the same directory */
+        if(mkdir(copy, 0755) < 0 && errno != EEXIST) {
+            free(copy);
+            return -1;
+        }
+        *p = '/';
+    }
+    free(copy);
+    return 0;
+}
+
+/* Extract one member from r, to stdout if to_stdout. Returns 0 on success. */
+static int extract_member(struct Reader* r, const struct Member* m, int afd,
+                          uint8_t* block, int to_stdout) {
+    int out = STDOUT_FILENO;
+    char* tmp = NULL;
+    if(!to_stdout) {
+        if(!safe_name(m->name)) {
+            fprintf(stderr, "edd: %s: unsafe member name, skipped\n", m->name);
+            return -1;
+        }
+        /* Write to a new file beside it and rename that into place once the
+           member checks out, so a corrupt member never clobbers what was
+           there before */
+        tmp = malloc(strlen(m->name) + sizeof(".edd.XXXXXX"));
+        if(tmp != NULL) {
+            sprintf(tmp, "%s.edd.XXXXXX", m->name);
+        }
+        if(tmp == NULL || make_parents(m->name) < 0 ||
+           (out = mkostemp(tmp, O_CLOEXEC)) < 0) {
+            fprintf(stderr, "edd: %s: %s\n", m->name, strerror(errno));
+            free(tmp);
+            return -1;
+        }
+    }
+    const char* err = copy_member(r, m, out, afd, block);
+    if(!to_stdout) {
+        if(err == NULL) {
+            struct timespec times[2] = {{(time_t)m->mtime, 0},
+                                        {(time_t)m->mtime, 0}};
+            fchmod(out, m->mode & 07777);
+            futimens(out, times);
+        }
+        if(close(out) < 0 && err == NULL) {
+            err = strerror(errno);
+        }
+        if(err == NULL && rename(tmp, m->name) < 0) {
+            err = strerror(errno);
+        }
+        if(err != NULL) {
+            unlink(tmp);
+        }
+        free(tmp);
+    }
+    if(err != NULL) {
+        fprintf(stderr, "edd: %s: %s\n", m->name, err);
+        return -1;
+    }
+    return 0;
+}
+
+/* Check a member's local header against its index entry, and start a
+   reader on its data */
+static int member_reader(const struct Archive* a, const struct Member* m,
+                         struct Reader* r) {
+    const uint8_t* h = a->map + m->offset;
+    size_t name_len = strlen(m->name);
+    if(get_u32(h) != MEMBER_MAGIC || get_u16(h + 4) != name_len ||
+       get_u64(h + 8) != m->csize || get_u64(h + 16) != m->size ||
+       memcmp(h + HEADER_SIZE, m->name, name_len) != 0) {
+        return -1;
+    }
+    r->mem = h + HEADER_SIZE + name_len;
+    r->fd = -1;
+    r->buf = NULL;
+    r->left = m->csize;
+    return 0;
+}
+
+struct Extract {
+    const struct Archive* archive;
+    const int64_t* entries; /* to extract, -1 for missing names */
+    char** names;
+    size_t count;
+    atomic_size_t next;
+    atomic_int status;
+};
+
+static void* extract_worker(void* arg) {
+    struct Extract* x = arg;
+    uint8_t* block = malloc(BLOCK_SIZE);
+    if(block == NULL) {
+        atomic_store(&x->status, 1);
+        return NULL;
+    }
+    size_t i;
+    while((i = atomic_fetch_add(&x->next, 1)) < x->count) {
+        struct Member m;
+        struct Reader r;
+        if(x->entries[i] < 0) {
+            fprintf(stderr, "edd: %s: not in the archive\n", x->names[i]);
+            atomic_store(&x->status, 1);
+            continue;
+        }
+        if(read_entry(x->archive, x->entries[i], &m) < 0 ||
+           member_reader(x->archive, &m, &r) < 0) {
+            fprintf(stderr, "edd: entry %lld: corrupt\n",
+                    (long long)x->entries[i]);
+            atomic_store(&x->status, 1);
+        } else if(extract_member(&r, &m, x->archive->fd, block, 0) < 0) {
+            atomic_store(&x->status, 1);
+        }
+        free(m.name);
+    }
+    free(block);
+    return NULL;
+}
+
+static int extract(const char* archive, char** names, int nnames, int jobs,
+                   const char* dir) {
+    struct Archive a;
+    if(open_archive(archive, &a) < 0) {
+        close_archive(&a);
+        return 1;
+    }
+    if(dir != NULL && chdir(dir) < 0) {
+        fprintf(stderr, "edd: %s: %s\n", dir, strerror(errno));
+        close_archive(&a);
+        return 1;
+    }
+    /* Named members are looked up, not the whole index checked */
+    size_t count = nnames > 0 ? (size_t)nnames : a.count;
+    int64_t* entries = malloc((count + 1) * sizeof(int64_t));
+    if(entries == NULL || (nnames == 0 && check_index(&a, archive) < 0)) {
+        free(entries);
+        close_archive(&a);
+        return 1;
+    }
+    for(size_t i = 0; i < count; i++) {
+        entries[i] = nnames > 0 ? lookup(&a, names[i]) : (int64_t)i;
+    }
+    struct Extract x = {.archive = &a, .entries = entries, .names = names,
+                        .count = count};
+    atomic_init(&x.next, 0);
+    atomic_init(&x.status, 0);
+    run_workers(extract_worker, &x, pool_size(jobs, count));
+    free(entries);
+    close_archive(&a);
+    return atomic_load(&x.status);
+}
+
+/* Extract from a stream, such as a pipe, in one pass over the members */
+static int extract_stream(int fd, char** names, int nnames, const char* dir) {
+    uint8_t magic[MAGIC_SIZE];
+    if(read_exact(fd, magic, MAGIC_SIZE) < 0 ||
+       memcmp(magic, ARCHIVE_MAGIC, MAGIC_SIZE) != 0) {
+        fprintf(stderr, "edd: -: not an edd archive\n");
+        return 1;
+    }
+    if(dir != NULL && chdir(dir) < 0) {
+        fprintf(stderr, "edd: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    uint8_t* buf = malloc(LZ_BOUND(BLOCK_SIZE));
+    uint8_t* block = malloc(BLOCK_SIZE);
+    char* found = calloc(nnames + 1, 1);
+    int status = 0;
+    for(;;) {
+        uint8_t h[HEADER_SIZE];
+        if(buf == NULL || block == NULL || found == NULL ||
+           read_exact(fd, h, 4) < 0) {
+            fprintf(stderr, "edd: -: truncated archive\n");
+            status = 1;
+            break;
+        }
+        if(get_u32(h) == END_MAGIC) {
+            break;
+        }
+        struct Member m = {0};
+        if(get_u32(h) != MEMBER_MAGIC ||
+           read_exact(fd, h + 4, HEADER_SIZE - 4) < 0 ||
+           (m.name = calloc(get_u16(h + 4) + 1, 1)) == NULL ||
+           read_exact(fd, (uint8_t*)m.name, get_u16(h + 4)) < 0) {
+            fprintf(stderr, "edd: -: corrupt archive\n");
+            free(m.name);
+            status = 1;
+            break;
+        }
+        m.method = h[6];
+        m.csize = get_u64(h + 8);
+        m.size = get_u64(h + 16);
+        m.mtime = get_u64(h + 24);
+        m.crc = get_u32(h + 32);
+        m.mode = get_u32(h + 36);
+        struct Reader r = {.fd = fd, .buf = buf, .left = m.csize};
+
+        int wanted = nnames == 0;
+        for(int i = 0; i < nnames; i++) {
+            if(strcmp(names[i], m.name) == 0) {
+                wanted = found[i] = 1;
+            }
+        }
+        if(m.method > METHOD_LZ ||
+           (m.method == METHOD_STORED && m.csize != m.size)) {
+            fprintf(stderr, "edd: %s: corrupt\n", m.name);
+            free(m.name);
+            status = 1;
+            break;
+        }
+        if(wanted) {
+            status |= extract_member(&r, &m, -1, block, 0) < 0;
+        }
+        /* Skip whatever is left, to stay in step with the stream */
+        while(r.left > 0 && take(&r, r.left < BLOCK_SIZE ? r.left : BLOCK_SIZE)) {
+        }
+        free(m.name);
+        if(r.left > 0) {
+            fprintf(stderr, "edd: -: truncated archive\n");
+            status = 1;
+            break;
+        }
+    }
+    for(int i = 0; found != NULL && i < nnames; i++) {
+        if(!found[i]) {
+            fprintf(stderr, "edd: %s: not in the archive\n", names[i]);
+            status = 1;
+        }
+    }
+    free(found);
+    free(block);
+    free(buf);
+    return status;
+}
+
+/************
+ * Listing *
+ ************/
+
+static int list(const char* archive) {
+    struct Archive a;
+    if(open_archive(archive, &a) < 0 || check_index(&a, archive) < 0) {
+        close_archive(&a);
+        return 1;
+    }
+    int status = 0;
+    for(uint64_t i = 0; i < a.count; i++) {
+        struct Member m;
+        if(read_entry(&a, i, &m) < 0) {
+            fprintf(stderr, "edd: entry %llu: corrupt\n", (unsigned long long)i);
+            status = 1;
+            continue;
+        }
+        printf("%10llu %10llu %-6s %s\n", (unsigned long long)m.size,
+               (unsigned long long)m.csize,
+               m.method == METHOD_LZ ? "lz" : "stored", m.name);
+        free(m.name);
+    }
+    close_archive(&a);
+    return status;
+}
+
+static int print_member(const char* archive, const char* name) {
+    struct Archive a;
+    if(open_archive(archive, &a) < 0) {
+        close_archive(&a);
+        return 1;
+    }
+    int status = 1;
+    int64_t e = lookup(&a, name);
+    struct Member m = {0};
+    struct Reader r;
+    uint8_t* block = malloc(BLOCK_SIZE);
+    if(e < 0) {
+        fprintf(stderr, "edd: %s: not in the archive\n", name);
+    } else if(read_entry(&a, e, &m) < 0 || member_reader(&a, &m, &r) < 0) {
+        fprintf(stderr, "edd: %s: corrupt\n", name);
+    } else if(block != NULL) {
+        fflush(stdout);
+        status = extract_member(&r, &m, a.fd, block, 1) < 0;
+    }
+    free(m.name);
+    free(block);
+    close_archive(&a);
+    return status;
+}
+
+static int usage(void) {
+    fprintf(stderr,
+            "usage: edd -c [-0] [-j jobs] [-C dir] archive path ...\n"
+            "       edd -x [-j jobs] [-C dir] archive [member ...]\n"
+            "       edd -t archive\n"
+            "       edd -p archive member\n");
+    return 1;
+}
+
+int edd_main(int argc, char** argv) {
+    char mode = 0;
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int compress = 1;
+    const char* dir = NULL;
+    int i = 1;
+    for(; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        const char* arg = argv[i];
+        if(strcmp(arg, "--") == 0) {
+            i++;
+            break;
+        } else if(strchr("cxtp", arg[1]) != NULL && arg[2] == '\0') {
+            if(mode != 0 && mode != arg[1]) {
+                return usage();
+            }
+            mode = arg[1];
+        } else if(strcmp(arg, "-0") == 0) {
+            compress = 0;
+        } else if(strcmp(arg, "-j") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if(strncmp(arg, "-j", 2) == 0 && arg[2] != '\0') {
+            jobs = atoi(arg + 2);
+        } else if(strcmp(arg, "-C") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else {
+            return usage();
+        }
+    }
+    if(i >= argc || jobs < 1) {
+        return usage();
+    }
+    const char* archive = argv[i++];
+    char** rest = argv + i;
+    int nrest = argc - i;
+
+    switch(mode) {
+    case 'c':
+        return nrest > 0 ? create(archive, rest, nrest, jobs, compress, dir)
+                         : usage();
+    case 'x':
+        if(strcmp(archive, "-") == 0) {
+            return extract_stream(STDIN_FILENO, rest, nrest, dir);
+        }
+        return extract(archive, rest, nrest, jobs, dir);
+    case 't':
+        return nrest == 0 ? list(archive) : usage();
+    case 'p':
+        return nrest == 1 ? print_member(archive, rest[0]) : usage();
+    default:
+        return usage();
+    }
+}
+
+#ifndef EDD_NO_MAIN
+int main(int argc, char** argv) {
+    return edd_main(argc, argv);
+}
+#endif
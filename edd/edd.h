@@ -0,0 +1,53 @@
+#ifndef EDD_H
+#define EDD_H
+
+/* Run edd with the given arguments:
+
+       edd -c [-0] [-j JOBS] [-C DIR] ARCHIVE PATH...
+       edd -x [-j JOBS] [-C DIR] ARCHIVE [MEMBER...]
+       edd -t ARCHIVE
+       edd -p ARCHIVE MEMBER
+
+   -c bundles the regular files under each PATH (directories are walked in
+   name order) into ARCHIVE, compressing them on JOBS threads (one per CPU by
+   default). -0 stores everything uncompressed. -x extracts every member, or
+   just the named ones, on JOBS threads; an ARCHIVE of "-" is read from
+   standard input in one pass instead. -t lists the members and -p writes one
+   to standard output. -C changes to DIR for the PATHs and the extracted
+   files; ARCHIVE stays relative to where edd started. -c skips ARCHIVE itself
+   and any PATH whose member name an earlier one already has, and leaves
+   ARCHIVE alone unless every PATH is found. -x writes each member beside its
+   destination and renames it into place only once its CRC checks out, so a
+   corrupt member leaves an existing file as it was. Returns the exit status.
+   Build edd.c with -DEDD_NO_MAIN to link this into another program.
+
+   The archive format. All integers are little-endian.
+
+       "EDDARC01"
+       member...           each a local header, its name and its data
+       "EDDE"              end of the members
+       index entry...      one per member, 48 bytes each
+       names               the member names, back to back, not terminated
+       hash table          slots of 4 bytes: 1 + the entry of a name, or 0
+       trailer             48 bytes, at the very end
+
+   A local header is the magic "EDDM", the name length (16 bits), the method
+   (8 bits: 0 stored, 1 compressed), a pad byte, the data size, the original
+   size, the modification time (64 bits each), the CRC-32 of the original
+   contents and the mode (32 bits each). An index entry holds the offset of
+   the local header, the data size, the original size and the modification
+   time (64 bits each), the offset and length of the name in the names (32
+   and 16 bits), the method, a pad byte, the CRC-32 and the mode. The trailer
+   is "EDDIDX01" then the number of entries, the offset of the first entry,
+   the size of the names, the offset of the hash table (64 bits each), the
+   number of slots (32 bits, a power of two) and the CRC-32 of everything
+   from the first entry to the end of the hash table.
+
+   Names hash with 64-bit FNV-1a into the table, probing linearly, so finding
+   one member reads the trailer, a slot or two, an entry and its name however
+   big the archive is. Compressed data is a series of blocks of at most
+   256 KiB of original data, each a 32-bit original length and a 32-bit
+   compressed length (0 if the block is stored) followed by the block. */
+int edd_main(int argc, char** argv);
+
+#endif
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "paste.h"
+
+/* Turn the -d argument into the list of delimiter characters, handling the
+   escapes \n, \t, \\ and \0 (no delimiter). A '\0' in the result means "no
+   delimiter" at that position. Returns the number of delimiters. */
+static size_t parse_delims(const char* spec, char* out) {
+    size_t n = 0;
+    for(size_t i = 0; spec[i] != '\0'; i++) {
+        char c = spec[i];
+        if(c == '\\' && spec[i + 1] != '\0') {
+            i++;
+            switch(spec[i]) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case '0': c = '\0'; break;
+            default: c = spec[i]; break;
+            }
+        }
+        out[n++] = c;
+    }
+    return n;
+}
+
+static void put_delim(const char* delims, size_t ndelims, size_t idx) {
+    char d = delims[idx % ndelims];
+    if(d != '\0') {
+        putchar(d);
+    }
+}
+
+/* Read one line from f into *line without its newline. Returns 0 at EOF. */
+static int read_line(FILE* f, char** line, size_t* cap, ssize_t* len) {
+    *len = getline(line, cap, f);
+    if(*len < 0) {
+        return 0;
+    }
+    if(*len > 0 && (*line)[*len - 1] == '\n') {
+        (*line)[--*len] = '\0';
+    }
+    return 1;
+}
+
+static void paste_serial(FILE** files, int nfiles, const char* delims,
+                         size_t ndelims, char** line, size_t* cap) {
+    ssize_t len;
+    for(int i = 0; i < nfiles; i++) {
+        size_t col = 0;
+        if(files[i] != NULL) {
+            while(read_line(files[i], line, cap, &len)) {
+                if(col > 0) {
+                    put_delim(delims, ndelims, col - 1);
+                }
+                fwrite(*line, 1, len, stdout);
+                col++;
+            }
+        }
+        putchar('\n');
+    }
+}
+
+static void paste_parallel(FILE** files, int nfiles, const char* delims,
+                           size_t ndelims, char** line, size_t* cap) {
+    char* done = calloc(nfiles, 1);
+    if(done == NULL) {
+        return;
+    }
+    int open_files = 0;
+    for(int i = 0; i < nfiles; i++) {
+        if(files[i] == NULL) {
+            done[i] = 1;
+        } else {
+            open_files++;
+        }
+    }
+
+    ssize_t len;
+    while(open_files > 0) {
+        /* Build the row first so that a row where every file hits EOF
+           prints nothing */
+        int got_any = 0;
+        for(int i = 0; i < nfiles; i++) {
+            int have = !done[i] && read_line(files[i], line, cap, &len);
+            if(!have && !done[i]) {
+                done[i] = 1;
+                open_files--;
+            }
+            if(!have && !got_any) {
+                continue;
+            }
+            if(!got_any) {
+                /* First line in this row: pad the empty columns before it */
+                for(int j = 0; j < i; j++) {
+                    put_delim(delims, ndelims, j);
+                }
+                got_any = 1;
+            }
+            if(have) {
+                fwrite(*line, 1, len, stdout);
+            }
+            if(i < nfiles - 1) {
+                put_delim(delims, ndelims, i);
+            }
+        }
+        if(got_any) {
+            putchar('\n');
+        }
+    }
+    free(done);
+}
+
+int paste_main(int argc, char** argv, FILE* in) {
+    int serial = 0;
+    const char* delim_spec = "\t";
+    int i = 1;
+    for(; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if(strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else if(strcmp(argv[i], "-s") == 0) {
+            serial = 1;
+        } else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            delim_spec = argv[++i];
+        } else if(strncmp(argv[i], "-d", 2) == 0 && argv[i][2] != '\0') {
+            delim_spec = argv[i] + 2;
+        } else {
+            fprintf(stderr, "usage: paste [-s] [-d list] [file ...]\n");
+            return 1;
+        }
+    }
+
+    char* delims = malloc(strlen(delim_spec) + 1);
+    int nfiles = argc - i > 0 ? argc - i : 1;
+    FILE** files = calloc(nfiles, sizeof(FILE*));
+    if(delims == NULL || files == NULL) {
+        free(delims);
+        free(files);
+        return 1;
+    }
+    size_t ndelims = parse_delims(delim_spec, delims);
+    if(ndelims == 0) {
+        delims[ndelims++] = '\0';
+    }
+
+    int status = 0;
+    for(int f = 0; f < nfiles; f++) {
+        const char* name = i + f < argc ? argv[i + f] : "-";
+        if(strcmp(name, "-") == 0) {
+            files[f] = in;
+        } else {
+            files[f] = fopen(name, "r");
+            if(files[f] == NULL) {
+                fprintf(stderr, "paste: %s: cannot open\n", name);
+                status = 1;
+            }
+        }
+    }
+
+    char* line = NULL;
+    size_t cap = 0;
+    if(serial) {
+        paste_serial(files, nfiles, delims, ndelims, &line, &cap);
+    } else {
+        paste_parallel(files, nfiles, delims, ndelims, &line, &cap);
+    }
+    free(line);
+
+    for(int f = 0; f < nfiles; f++) {
+        if(files[f] != NULL && files[f] != in) {
+            fclose(files[f]);
+        }
+    }
+    free(files);
+    free(delims);
+    return status;
+}
+
+#ifndef PASTE_NO_MAIN
+int main(int argc, char** argv) {
+    return paste_main(argc, argv, stdin);
+}
+#endif
@@ -0,0 +1,18 @@
+#ifndef PASTE_H
+#define PASTE_H
+
+#include <stdio.h>
+
+/* Run paste with the given arguments:
+
+       paste [-s] [-d LIST] [FILE...]
+
+   Without -s, line i of every FILE is written on output line i, separated
+   by the characters of LIST in turn (tab by default). With -s, all lines of
+   one FILE are joined onto a single output line instead. A FILE of "-", or
+   no FILE at all, reads from `in`. Output goes to stdout. Returns the exit
+   status. Build paste.c with -DPASTE_NO_MAIN to link this into another
+   program (utcsh runs it as a builtin). */
+int paste_main(int argc, char** argv, FILE* in);
+
+#endif
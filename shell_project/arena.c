@@ -0,0 +1,99 @@
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+struct ArenaChunk {
+  struct ArenaChunk *next; /* Older chunk in the chain */
+  size_t size;             /* Usable bytes in data[] */
+  size_t used;             /* Bytes handed out so far */
+  alignas(max_align_t) char data[];
+};
+
+#define ARENA_ALIGN (alignof(max_align_t))
+
+static size_t align_up(size_t n) {
+  return (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static struct ArenaChunk *new_chunk(size_t size, struct ArenaChunk *next) {
+  struct ArenaChunk *chunk = malloc(sizeof(struct ArenaChunk) + size);
+  if (!chunk) {
+    return NULL;
+  }
+  chunk->next = next;
+  chunk->size = size;
+  chunk->used = 0;
+  return chunk;
+}
+
+void *arena_alloc(struct Arena *arena, size_t nbytes) {
+  if (nbytes > SIZE_MAX - ARENA_ALIGN) {
+    return NULL;
+  }
+  nbytes = align_up(nbytes ? nbytes : 1);
+
+  struct ArenaChunk *chunk = arena->head;
+  if (!chunk || chunk->size - chunk->used < nbytes) {
+    size_t size = nbytes > ARENA_CHUNK_SIZE ? nbytes : ARENA_CHUNK_SIZE;
+    chunk = new_chunk(size, arena->head);
+    if (!chunk) {
+      return NULL;
+    }
+    arena->head = chunk;
+  }
+
+  void *ptr = chunk->data + chunk->used;
+  chunk->used += nbytes;
+  return ptr;
+}
+
+void *arena_calloc(struct Arena *arena, size_t count, size_t size) {
+  if (size && count > SIZE_MAX / size) {
+    return NULL;
+  }
+  void *ptr = arena_alloc(arena, count * size);
+  if (ptr) {
+    memset(ptr, 0, count * size);
+  }
+  return ptr;
+}
+
+char *arena_strdup(struct Arena *arena, const char *s) {
+  size_t len = strlen(s);
+  char *copy = arena_alloc(arena, len + 1);
+  if (copy) {
+    memcpy(copy, s, len + 1);
+  }
+  return copy;
+}
+
+void arena_reset(struct Arena *arena) {
+  struct ArenaChunk *chunk = arena->head;
+  struct ArenaChunk *keep = NULL;
+
+  while (chunk) {
+    struct ArenaChunk *next = chunk->next;
+    /* The oldest chunk is the one we want to hold on to, but only if it is a
+       regular-sized one: an oversized chunk from a huge line is given back. */
+    if (!next && chunk->size == ARENA_CHUNK_SIZE) {
+      keep = chunk;
+    } else {
+      free(chunk);
+    }
+    chunk = next;
+  }
+
+  if (keep) {
+    keep->used = 0;
+  }
+  arena->head = keep;
+}
+
+void arena_destroy(struct Arena *arena) {
+  arena_reset(arena);
+  free(arena->head);
+  arena->head = NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef UTCSH_ARENA_H
+#define UTCSH_ARENA_H
+
+#include <stddef.h>
+
+/* Size of a regular arena chunk. Requests larger than this get a chunk of
+   their own. */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+struct ArenaChunk;
+
+/**
+ * A bump allocator that owns every allocation made while handling a single
+ * command line. Memory is handed out from a chain of chunks and is released
+ * all at once by arena_reset(), so callers never free() individual tokens.
+ */
+struct Arena {
+  struct ArenaChunk *head; /* Chunk currently being bumped (newest first) */
+};
+
+/** Allocate nbytes from the arena. Returns NULL if the system is out of
+ * memory. The returned pointer is suitably aligned for any type. */
+void *arena_alloc(struct Arena *arena, size_t nbytes);
+
+/** Like arena_alloc, but the memory is zeroed and the size is count * size.
+ * Returns NULL on overflow or if the system is out of memory. */
+void *arena_calloc(struct Arena *arena, size_t count, size_t size);
+
+/** Copy the string s into the arena. Returns NULL on allocation failure. */
+char *arena_strdup(struct Arena *arena, const char *s);
+
+/** Release everything allocated since the last reset. The first regular
+ * chunk is kept so that the next command line does not hit malloc() again. */
+void arena_reset(struct Arena *arena);
+
+/** Release every chunk owned by the arena, including the retained one. */
+void arena_destroy(struct Arena *arena);
+
+#endif
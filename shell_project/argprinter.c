@@ -1,10 +1,90 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "trace.h"
 
 #define ANSI_COLOR_RED     "\x1b[31m"
 #define ANSI_COLOR_RESET   "\x1b[0m"
 
+extern char **environ;
+
+/* When the first constructor ran: everything before it is execve() and the
+   dynamic loader */
+static unsigned long long ctor_ns;
+
+static unsigned long long now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+__attribute__((constructor)) static void note_ctor(void){
+    ctor_ns = now_ns();
+}
+
+/* Bytes of the strings in a NULL-terminated vector, NULs included */
+static long vector_bytes(char **v, int *count){
+    long bytes = 0;
+    for(*count = 0; v[*count] != NULL; ++*count){
+        bytes += strlen(v[*count]) + 1;
+    }
+    return bytes;
+}
+
+/* Print `name`:(now - the time in env var `var`), or null if it is unset */
+static void print_since(const char *name, const char *var, unsigned long long now){
+    const char *stamp = getenv(var);
+    if(stamp == NULL){
+        printf(",\"%s\":null", name);
+    }else{
+        printf(",\"%s\":%lld", name, (long long)(now - strtoull(stamp, NULL, 10)));
+    }
+}
+
+/*
+ * argprinter --probe [ARGS...]: instead of echoing argv, print one JSON line
+ * about how this process got started, for timing the parent's exec path.
+ * The *_ns fields need the parent to export SPAWN_NS_ENV_NAME and
+ * EXEC_NS_ENV_NAME (utcsh does for every external command) and are null
+ * otherwise. loader_ns runs from execv() in the child to the first
+ * constructor, so it covers the kernel's exec as well as ld.so.
+ */
+static int probe(int argc, char* argv[]){
+    unsigned long long main_ns = now_ns();
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    int envc;
+    long argv_bytes = vector_bytes(argv, &argc);
+    long env_bytes = vector_bytes(environ, &envc);
+    // what counts against ARG_MAX: the strings and both pointer arrays
+    long exec_bytes = argv_bytes + env_bytes + (argc + envc + 2) * sizeof(char *);
+
+    printf("{\"probe\":\"argprinter\",\"pid\":%d,\"argc\":%d,\"argv_bytes\":%ld,"
+           "\"envc\":%d,\"env_bytes\":%ld,\"exec_bytes\":%ld",
+           (int)getpid(), argc, argv_bytes, envc, env_bytes, exec_bytes);
+    print_since("spawn_to_main_ns", SPAWN_NS_ENV_NAME, main_ns);
+    const char *spawn = getenv(SPAWN_NS_ENV_NAME);
+    const char *exec = getenv(EXEC_NS_ENV_NAME);
+    if(spawn && exec){
+        printf(",\"fork_to_exec_ns\":%lld",
+               (long long)(strtoull(exec, NULL, 10) - strtoull(spawn, NULL, 10)));
+    }else{
+        printf(",\"fork_to_exec_ns\":null");
+    }
+    print_since("loader_ns", EXEC_NS_ENV_NAME, ctor_ns);
+    printf(",\"ctor_to_main_ns\":%llu,\"minflt\":%ld,\"majflt\":%ld}\n",
+           main_ns - ctor_ns, ru.ru_minflt, ru.ru_majflt);
+    return 0;
+}
+
 int main(int argc, char* argv[]){
+    if(argc > 1 && !strcmp(argv[1], "--probe")){
+        return probe(argc, argv);
+    }
     printf("Hello, I am the argprinter!\n");
 
     // Detect unprintable ASCII: while not a surefire giveaway, suggests that
@@ -0,0 +1,469 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "audit.h"
+#include "trace.h"
+
+/* Like the trace fd, the log is kept clear of the fds redirections touch */
+#define AUDIT_FD_MIN 10
+#define RING_SLOTS 256 /* A power of two */
+#define ARGV_MAX 2048
+#define CWD_MAX 1024
+#define LINE_MAX_BYTES 16384
+#define LINE_TAIL_BYTES 96 /* Kept free to close a line and mark it truncated */
+#define BATCH_BYTES (64 * 1024)
+#define MAX_KEEP 99
+#define WAIT_NS 50000 /* How long the shell naps while waiting on the writer */
+#define LINGER_NS 1000000 /* How long the writer lets a batch build up */
+
+struct AuditRecord {
+  uint64_t seq;
+  int64_t time_ns; /* Wall clock time the command started */
+  uint64_t dur_ns;
+  pid_t pid;
+  int status;
+  int argc;
+  bool truncated; /* Arguments past argc did not fit */
+  char cwd[CWD_MAX];
+  char argv[ARGV_MAX]; /* argc strings, one after another */
+};
+
+enum AuditPolicy { POLICY_DROP, POLICY_BLOCK };
+
+static struct AuditRecord ring[RING_SLOTS];
+/* The shell only writes head and the writer thread only writes tail, so
+   neither side ever takes a lock. A slot is free again once tail passes it. */
+static _Atomic uint64_t head;
+static _Atomic uint64_t tail;
+static _Atomic uint64_t written; /* The writer has handled up to here */
+
+static bool enabled;
+static bool hooks_installed;
+static pid_t shell_pid;
+static char *log_path;
+static int log_fd = -1;
+static off_t log_size;
+static pthread_t writer;
+static sem_t wake;
+static atomic_bool stopping;
+static atomic_bool sleeping; /* The writer is waiting for the ring to fill */
+
+static enum AuditPolicy policy;
+static _Atomic long long rotate_bytes; /* 0 means never rotate */
+static _Atomic int rotate_keep;
+static atomic_bool sync_batches = true;
+
+/* The shell's counters */
+static uint64_t next_seq;
+static uint64_t dropped;
+static uint64_t blocked;
+/* The writer's counters */
+static _Atomic uint64_t batches;
+static _Atomic uint64_t rotations;
+static _Atomic uint64_t write_errors;
+static _Atomic uint64_t lost; /* Records in batches that failed to write */
+
+static int open_log(const char *path) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return -1;
+  }
+  int high = fcntl(fd, F_DUPFD_CLOEXEC, AUDIT_FD_MIN);
+  close(fd);
+  return high;
+}
+
+/* Length of s once trace_json_string() has quoted and escaped it */
+static size_t json_string_len(const char *s) {
+  size_t n = 2;
+  for (; *s; s++) {
+    unsigned char c = *s;
+    n += (c == '"' || c == '\\') ? 2 : c < 0x20 ? 6 : 1;
+  }
+  return n;
+}
+
+/* Format one record as a JSON line at buf. Arguments that would not leave
+   LINE_TAIL_BYTES free are left out and the line marked truncated. Returns
+   its length. */
+static size_t format_record(const struct AuditRecord *r, char *buf,
+                            size_t size) {
+  time_t secs = r->time_ns / 1000000000;
+  struct tm tm;
+  gmtime_r(&secs, &tm);
+  char when[32];
+  strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+
+  size_t len = snprintf(buf, size,
+                        "{\"seq\":%llu,\"time\":\"%s.%06ldZ\",\"shell_pid\":%d,"
+                        "\"pid\":%d,\"cwd\":",
+                        (unsigned long long)r->seq, when,
+                        (long)(r->time_ns % 1000000000 / 1000), (int)shell_pid,
+                        (int)r->pid);
+  trace_json_string(buf + len, size - len, r->cwd);
+  len += strlen(buf + len);
+  len += snprintf(buf + len, size - len, ",\"argv\":[");
+  bool truncated = r->truncated;
+  const char *arg = r->argv;
+  for (int i = 0; i < r->argc; i++) {
+    if (len + json_string_len(arg) + 1 > size - LINE_TAIL_BYTES) {
+      truncated = true;
+      break;
+    }
+    if (i) {
+      buf[len++] = ',';
+    }
+    trace_json_string(buf + len, size - len, arg);
+    len += strlen(buf + len);
+    arg += strlen(arg) + 1;
+  }
+  len += snprintf(buf + len, size - len, "],\"status\":%d,\"dur_ns\":%llu%s}\n",
+                  r->status, (unsigned long long)r->dur_ns,
+                  truncated ? ",\"truncated\":true" : "");
+  return len;
+}
+
+/* Move FILE to FILE.1, FILE.1 to FILE.2 and so on, and start a new FILE */
+static void rotate(void) {
+  int keep = atomic_load(&rotate_keep);
+  char from[PATH_MAX + 8];
+  char to[PATH_MAX + 8];
+  for (int i = keep - 1; i >= 1; i--) {
+    snprintf(from, sizeof(from), "%s.%d", log_path, i);
+    snprintf(to, sizeof(to), "%s.%d", log_path, i + 1);
+    rename(from, to);
+  }
+  snprintf(to, sizeof(to), "%s.1", log_path);
+  int fd = -1;
+  if (rename(log_path, to) == 0) {
+    fd = open_log(log_path);
+  }
+  if (fd < 0) {
+    atomic_fetch_add(&write_errors, 1);
+    return; /* Keep writing where we were */
+  }
+  close(log_fd);
+  log_fd = fd;
+  log_size = 0;
+  atomic_fetch_add(&rotations, 1);
+}
+
+/* Returns 0, or -1 if the batch could not be written out in full */
+static int write_batch(const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(log_fd, buf, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      atomic_fetch_add(&write_errors, 1);
+      return -1;
+    }
+    buf += n;
+    len -= n;
+    log_size += n;
+  }
+  if (atomic_load(&sync_batches) && fdatasync(log_fd) < 0) {
+    atomic_fetch_add(&write_errors, 1);
+  }
+  atomic_fetch_add(&batches, 1);
+  long long limit = atomic_load(&rotate_bytes);
+  if (limit > 0 && log_size >= limit) {
+    rotate();
+  }
+  return 0;
+}
+
+/* Write out everything in the ring, in as few writes as will hold it */
+static void drain(void) {
+  static char batch[BATCH_BYTES];
+  uint64_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+  uint64_t h = atomic_load_explicit(&head, memory_order_acquire);
+  size_t len = 0;
+  uint64_t records = 0;
+  for (; t != h; t++) {
+    if (BATCH_BYTES - len < LINE_MAX_BYTES) {
+      if (write_batch(batch, len) < 0) {
+        atomic_fetch_add(&lost, records);
+      }
+      len = 0;
+      records = 0;
+    }
+    len += format_record(&ring[t & (RING_SLOTS - 1)], batch + len,
+                         LINE_MAX_BYTES);
+    records++;
+    // the slot has been copied out, so the shell may reuse it
+    atomic_store_explicit(&tail, t + 1, memory_order_release);
+  }
+  if (len > 0 && write_batch(batch, len) < 0) {
+    atomic_fetch_add(&lost, records);
+  }
+  // lost records count as handled too, or audit flush would wait forever
+  atomic_store_explicit(&written, h, memory_order_release);
+}
+
+static uint64_t queued(void) {
+  return atomic_load(&head) - atomic_load(&tail);
+}
+
+static void *writer_main(void *unused) {
+  (void)unused;
+  for (;;) {
+    // the shell only wakes a sleeping writer, so say so before the last look
+    atomic_store(&sleeping, true);
+    if (queued() == 0 && !atomic_load(&stopping)) {
+      while (sem_wait(&wake) < 0 && errno == EINTR) {
+      }
+    }
+    atomic_store(&sleeping, false);
+    // linger so that a burst of commands goes out in one batch; the shell
+    // cuts this short once the ring is half full
+    if (queued() < RING_SLOTS / 2 && !atomic_load(&stopping)) {
+      struct timespec until;
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += LINGER_NS;
+      if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+      }
+      while (sem_timedwait(&wake, &until) < 0 && errno == EINTR) {
+      }
+    }
+    // one pass serves every wakeup posted so far
+    while (sem_trywait(&wake) == 0) {
+    }
+    bool stop = atomic_load(&stopping);
+    drain();
+    if (stop) {
+      return NULL;
+    }
+  }
+}
+
+/* Wait until the writer has seen everything pushed so far */
+static void wait_for_writer(uint64_t until) {
+  struct timespec pause = {0, WAIT_NS};
+  while (atomic_load_explicit(&written, memory_order_acquire) < until) {
+    sem_post(&wake);
+    nanosleep(&pause, NULL);
+  }
+}
+
+static void audit_stop(void) {
+  if (!enabled) {
+    return;
+  }
+  atomic_store(&stopping, true);
+  sem_post(&wake);
+  pthread_join(writer, NULL);
+  sem_destroy(&wake);
+  close(log_fd);
+  log_fd = -1;
+  free(log_path);
+  log_path = NULL;
+  enabled = false;
+}
+
+/* A forked child has no writer thread, and leaves logging to the shell */
+static void forget_in_child(void) {
+  enabled = false;
+}
+
+static int audit_start(const char *path) {
+  int fd = open_log(path);
+  // rotation must find the log again after the shell has changed directory
+  char *copy = fd >= 0 ? realpath(path, NULL) : NULL;
+  struct stat st;
+  if (copy == NULL || fstat(fd, &st) < 0) {
+    free(copy);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  audit_stop();
+
+  if (sem_init(&wake, 0, 0) < 0) {
+    free(copy);
+    close(fd);
+    return -1;
+  }
+  atomic_store(&stopping, false);
+  // signals such as SIGCHLD must be handled by the shell's own thread
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  int rc = pthread_create(&writer, NULL, writer_main, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (rc != 0) {
+    sem_destroy(&wake);
+    free(copy);
+    close(fd);
+    return -1;
+  }
+
+  log_path = copy;
+  log_fd = fd;
+  log_size = st.st_size;
+  shell_pid = getpid();
+  enabled = true;
+  if (!hooks_installed) {
+    pthread_atfork(NULL, NULL, forget_in_child);
+    atexit(audit_stop);
+    hooks_installed = true;
+  }
+  return 0;
+}
+
+void audit_init_from_env(void) {
+  char *path = getenv(AUDIT_ENV_NAME);
+  if (path && *path && audit_start(path) < 0) {
+    fprintf(stderr, "audit: cannot open %s\n", path);
+  }
+}
+
+bool audit_enabled(void) {
+  return enabled;
+}
+
+void audit_log(char *const *argv, pid_t pid, int status, uint64_t start_ns) {
+  if (!enabled) {
+    return;
+  }
+  uint64_t seq = ++next_seq;
+  uint64_t h = atomic_load_explicit(&head, memory_order_relaxed);
+  if (h - atomic_load_explicit(&tail, memory_order_acquire) == RING_SLOTS) {
+    if (policy == POLICY_DROP) {
+      dropped++; /* The gap in seq shows where */
+      return;
+    }
+    blocked++;
+    struct timespec pause = {0, WAIT_NS};
+    do {
+      sem_post(&wake);
+      nanosleep(&pause, NULL);
+    } while (h - atomic_load_explicit(&tail, memory_order_acquire) ==
+             RING_SLOTS);
+  }
+
+  struct AuditRecord *r = &ring[h & (RING_SLOTS - 1)];
+  struct timespec wall;
+  clock_gettime(CLOCK_REALTIME, &wall);
+  r->seq = seq;
+  r->dur_ns = trace_now_ns() - start_ns;
+  r->time_ns = (int64_t)wall.tv_sec * 1000000000 + wall.tv_nsec - r->dur_ns;
+  r->pid = pid;
+  r->status = status;
+  if (getcwd(r->cwd, sizeof(r->cwd)) == NULL) {
+    r->cwd[0] = '\0';
+  }
+  size_t used = 0;
+  r->argc = 0;
+  r->truncated = false;
+  for (int i = 0; argv[i] != NULL; i++) {
+    size_t n = strlen(argv[i]) + 1;
+    if (used + n > ARGV_MAX) {
+      r->truncated = true;
+      break;
+    }
+    memcpy(r->argv + used, argv[i], n);
+    used += n;
+    r->argc++;
+  }
+  atomic_store(&head, h + 1);
+  if (atomic_load(&sleeping) || h + 1 - atomic_load(&tail) == RING_SLOTS / 2) {
+    sem_post(&wake);
+  }
+}
+
+/* Parse a whole decimal number in [min, max], or return -1 */
+static long long parse_number(const char *arg, long long min, long long max) {
+  char *end;
+  errno = 0;
+  long long n = strtoll(arg, &end, 10);
+  if (end == arg || *end != '\0' || errno || n < min || n > max) {
+    return -1;
+  }
+  return n;
+}
+
+static void print_status(FILE *out) {
+  if (enabled) {
+    fprintf(out, "audit: on %s\n", log_path);
+  } else {
+    fprintf(out, "audit: off\n");
+  }
+  fprintf(out, "policy: %s\n", policy == POLICY_BLOCK ? "block" : "drop");
+  long long limit = atomic_load(&rotate_bytes);
+  if (limit > 0) {
+    fprintf(out, "rotate: %lld bytes, keep %d\n", limit,
+            atomic_load(&rotate_keep));
+  } else {
+    fprintf(out, "rotate: off\n");
+  }
+  fprintf(out, "sync: %s\n", atomic_load(&sync_batches) ? "on" : "off");
+  fprintf(out, "logged %llu\n", (unsigned long long)(next_seq - dropped));
+  fprintf(out, "written %llu\n",
+          (unsigned long long)(atomic_load(&written) - atomic_load(&lost)));
+  fprintf(out, "dropped %llu\n", (unsigned long long)dropped);
+  fprintf(out, "lost %llu\n", (unsigned long long)atomic_load(&lost));
+  fprintf(out, "blocked %llu\n", (unsigned long long)blocked);
+  fprintf(out, "batches %llu\n", (unsigned long long)atomic_load(&batches));
+  fprintf(out, "rotations %llu\n", (unsigned long long)atomic_load(&rotations));
+  fprintf(out, "write errors %llu\n",
+          (unsigned long long)atomic_load(&write_errors));
+}
+
+int audit_builtin(char **args, FILE *out) {
+  const char *sub = args[1];
+  if (sub == NULL) {
+    print_status(out);
+    return 0;
+  }
+  const char *arg = args[2];
+  const char *arg2 = arg ? args[3] : NULL;
+  if (arg2 != NULL && args[4] != NULL) {
+    return -1;
+  }
+
+  if (!strcmp(sub, "on") && arg != NULL && arg2 == NULL) {
+    return audit_start(arg);
+  } else if (!strcmp(sub, "off") && arg == NULL) {
+    audit_stop();
+  } else if (!strcmp(sub, "flush") && arg == NULL) {
+    if (enabled) {
+      wait_for_writer(atomic_load(&head));
+    }
+  } else if (!strcmp(sub, "policy") && arg != NULL && arg2 == NULL &&
+             (!strcmp(arg, "drop") || !strcmp(arg, "block"))) {
+    policy = !strcmp(arg, "block") ? POLICY_BLOCK : POLICY_DROP;
+  } else if (!strcmp(sub, "sync") && arg != NULL && arg2 == NULL &&
+             (!strcmp(arg, "on") || !strcmp(arg, "off"))) {
+    atomic_store(&sync_batches, !strcmp(arg, "on"));
+  } else if (!strcmp(sub, "rotate") && arg != NULL) {
+    if (!strcmp(arg, "off") && arg2 == NULL) {
+      atomic_store(&rotate_bytes, 0);
+      return 0;
+    }
+    long long bytes = parse_number(arg, 1, LLONG_MAX);
+    long long keep = arg2 ? parse_number(arg2, 1, MAX_KEEP) : -1;
+    if (bytes < 0 || keep < 0) {
+      return -1;
+    }
+    atomic_store(&rotate_keep, (int)keep);
+    atomic_store(&rotate_bytes, bytes);
+  } else {
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef UTCSH_AUDIT_H
+#define UTCSH_AUDIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/* Environment variable naming an audit log to open at startup */
+#define AUDIT_ENV_NAME "UTCSH_AUDIT"
+
+/**
+ * The audit log records every command the shell runs as one JSON line:
+ * seq, time, shell_pid, pid, cwd, argv, status and dur_ns. The shell only
+ * copies each record into a lock-free single-producer ring; a writer thread
+ * drains the ring, writes records in batches (with an fsync per batch when
+ * sync is on) and rotates the log, so no file I/O happens between commands.
+ *
+ * Records are only ever pushed from the shell's main thread. Children the
+ * shell forks log nothing; their commands are logged by the shell when it
+ * reaps them.
+ */
+
+/** Open the log named by AUDIT_ENV_NAME, if it is set. Call once at startup. */
+void audit_init_from_env(void);
+
+/** Returns true if commands are being logged */
+bool audit_enabled(void);
+
+/**
+ * Log one command. `argv` is its NULL-terminated argument list, `pid` the
+ * process that ran it (the shell itself for builtins), `status` its exit
+ * status as the shell reports it and `start_ns` when it started, from
+ * trace_now_ns(). Does nothing when the log is off.
+ *
+ * If the ring is full the record is dropped and counted, or with the block
+ * policy the shell waits for the writer to make room.
+ */
+void audit_log(char *const *argv, pid_t pid, int status, uint64_t start_ns);
+
+/**
+ * The `audit` builtin. `args` is the NULL-terminated argv; status goes to
+ * `out`.
+ *
+ * audit                      show the settings and counters
+ * audit on FILE              start logging to FILE (appending)
+ * audit off                  write out what is queued and stop logging
+ * audit policy drop|block    when the ring is full, drop records or wait
+ * audit rotate BYTES KEEP    rotate FILE once it reaches BYTES, keeping
+ *                            FILE.1 to FILE.KEEP
+ * audit rotate off           never rotate
+ * audit sync on|off          fsync after every batch (on by default)
+ * audit flush                wait until everything queued has been written
+ *
+ * Returns 0 on success and -1 on a usage error or a log that could not be
+ * opened.
+ */
+int audit_builtin(char **args, FILE *out);
+
+#endif
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Measure what the audit log costs per command. The commands are `cd .`, a
+# builtin, so the shell's own share of the cost is not hidden behind a fork.
+# Each mode ends with `audit`, whose dropped and blocked counters show how
+# often the ring filled up.
+#
+# Usage: bench/audit.sh [N]   (run from shell_project after `make`)
+
+N=${1:-20000}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+make_script() { # name setup...
+  name=$1
+  shift
+  {
+    for line in "$@"; do
+      echo "$line"
+    done
+    i=0
+    while [ $i -lt "$N" ]; do
+      echo "cd ."
+      i=$((i + 1))
+    done
+    echo "audit off"
+    echo "audit"
+  } > "$TMP/$name"
+}
+
+now_ns() { date +%s%N; }
+
+make_script off
+make_script drop "audit on $TMP/drop.log"
+make_script drop-nosync "audit sync off" "audit on $TMP/nosync.log"
+make_script block "audit policy block" "audit on $TMP/block.log"
+for mode in off drop drop-nosync block; do
+  start=$(now_ns)
+  ./utcsh "$TMP/$mode" > "$TMP/$mode.out" || exit 1
+  end=$(now_ns)
+  echo "$mode: $(( (end - start) / N )) ns/command over $N commands," \
+       "$(grep -E '^(dropped|blocked)' "$TMP/$mode.out" | tr '\n' ' ')"
+done
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Compare running wc and paste in-process against fork+exec of the same
+# tools built standalone from ../wc and ../paste.
+#
+# Usage: bench/builtins.sh [N]   (run from shell_project after `make tools`)
+
+N=${1:-2000}
+WCDIR=$(cd ../wc && pwd)
+PASTEDIR=$(cd ../paste && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+seq 1 200 > "$TMP/data"
+
+# One script per (tool, mode): N identical command lines
+make_script() { # name mode cmd
+  {
+    echo "path $WCDIR $PASTEDIR"
+    [ "$2" = external ] && echo "builtin -d wc paste"
+    i=0
+    while [ $i -lt "$N" ]; do
+      echo "$3 > /dev/null"
+      i=$((i + 1))
+    done
+    echo exit
+  } > "$TMP/$1-$2"
+}
+
+now_ns() { date +%s%N; }
+
+for tool in wc paste; do
+  if [ $tool = wc ]; then cmd="wc $TMP/data"; else cmd="paste -s -d , $TMP/data"; fi
+  for mode in in-process external; do
+    make_script $tool $mode "$cmd"
+    start=$(now_ns)
+    ./utcsh "$TMP/$tool-$mode" || exit 1
+    end=$(now_ns)
+    echo "$tool $mode: $(( (end - start) / N / 1000 )) us/call over $N calls"
+  done
+done
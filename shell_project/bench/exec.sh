@@ -0,0 +1,27 @@
+#!/bin/sh
+# How fast exec_external_cmd() gets a command running: run argprinter
+# --probe N times through the shell and report the median of each latency
+# it measured, along with its page faults.
+#
+# Usage: bench/exec.sh [N]   (run from shell_project after `make`)
+
+N=${1:-500}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+make -s argprinter || exit 1
+{
+  i=0
+  while [ $i -lt "$N" ]; do
+    echo "$(pwd)/argprinter --probe"
+    i=$((i + 1))
+  done
+  echo exit
+} > "$TMP/probes"
+./utcsh "$TMP/probes" > "$TMP/out" || exit 1
+
+for field in spawn_to_main_ns fork_to_exec_ns loader_ns ctor_to_main_ns minflt; do
+  sed -n "s/.*\"$field\":\([0-9]*\).*/\1/p" "$TMP/out" | sort -n |
+    awk -v f="$field" '{ v[NR] = $1 }
+      END { printf "%-18s median %s over %d runs\n", f, v[int((NR + 1) / 2)], NR }'
+done
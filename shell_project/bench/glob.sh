@@ -0,0 +1,43 @@
+#!/bin/sh
+# Time glob expansion over a large directory.
+#
+# Usage: bench/glob.sh [ENTRIES] [LINES]   (run from shell_project after `make`)
+#
+# The directory holds ENTRIES files, five of which end in .log. A script of
+# LINES lines each expands *.log in it; only the first line should read the
+# directory, the rest reuse the cached listing.
+
+N=${1:-200000}
+LINES=${2:-1000}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+DIR=$TMP/logs
+TRACE=$TMP/trace
+
+mkdir "$DIR"
+(cd "$DIR" && seq -f "entry-%07g.dat" 1 "$N" | xargs touch &&
+  touch a.log b.log c.log d.log e.log)
+# A listing taken within a second of a change is not trusted, so let the
+# directory settle before timing the cached case
+sleep 1.1
+
+i=0
+{
+  echo "cd $DIR"
+  while [ $i -lt "$LINES" ]; do
+    echo "wc *.log > /dev/null"
+    i=$((i + 1))
+  done
+  echo "stats"
+  echo exit
+} > "$TMP/script"
+
+echo "glob: $N entries, $LINES lines expanding *.log"
+UTCSH_TRACE=$TRACE ./utcsh "$TMP/script" | grep -E '^(dir_reads|glob)'
+awk -F'"dur_ns":' '/"ev":"glob"/ {
+  split($2, v, /[,}]/)
+  if (n++ == 0) first = v[1]; else rest += v[1]
+} END {
+  printf "first expansion: %d us, later ones: %.1f us each\n",
+         first / 1000, (n > 1 ? rest / (n - 1) / 1000 : 0)
+}' "$TRACE"
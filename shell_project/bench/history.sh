@@ -0,0 +1,51 @@
+#!/bin/sh
+# Time history start-up and searches against a large history file.
+#
+# Usage: bench/history.sh [ENTRIES]   (run from shell_project after `make`)
+#
+# Start-up should not depend on the file size: only the mapping is set up.
+# The first search pays for indexing; `stats` then shows the latency of the
+# searches that follow, which only touch the index.
+
+N=${1:-1000000}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+HIST=$TMP/history
+
+awk -v n="$N" 'BEGIN {
+  srand(1)
+  split("ls -l /tmp|/bin/echo hello|cd /var/log|make -j8 bench|git status|" \
+        "grep -rn TODO src|/usr/bin/time ./fib 30", cmds, "|")
+  for (i = 0; i < n; i++) printf "%s %d\n", cmds[int(rand() * 7) + 1], i
+}' > "$HIST"
+echo "history: $N entries, $(wc -c < "$HIST") bytes"
+
+now_ns() { date +%s%N; }
+
+start=$(now_ns)
+echo exit | UTCSH_HISTFILE=$HIST ./utcsh > /dev/null
+echo "start-up and exit: $(( ($(now_ns) - start) / 1000 )) us"
+
+# The first -s builds the prefix index and the first -r the suffix array
+{
+  echo 'stats -r'
+  echo 'history -s git status 4242'
+  echo '/bin/echo first -s, building the prefix index:'
+  echo 'stats'
+  echo 'stats -r'
+  echo 'history -r TODO src 99999'
+  echo '/bin/echo first -r, building the suffix array:'
+  echo 'stats'
+  echo 'stats -r'
+  i=0
+  while [ $i -lt 100 ]; do
+    echo "history -s make -j8 bench 12$i"
+    echo "history -r 7$i"
+    i=$((i + 1))
+  done
+  echo '/bin/echo 200 more searches:'
+  echo stats
+} > "$TMP/queries"
+start=$(now_ns)
+UTCSH_HISTFILE=$HIST ./utcsh < "$TMP/queries" | grep -E '^(builtin:|first|200)' | sed 's/utcsh> //g'
+echo "total: $(( ($(now_ns) - start) / 1000 )) us"
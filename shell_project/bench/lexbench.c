@@ -0,0 +1,146 @@
+/*
+  lexbench - microbenchmark for the utcsh command line front end
+
+  Lexes and parses a set of short, long and pathological command lines many
+  times and reports the cost per line and per byte. lex_command_line()
+  rewrites its input, so every iteration starts from a fresh copy of the line;
+  the cost of that copy is measured separately and subtracted. The parse
+  column is the extra cost of running parse_command() over every command on
+  the lexed line.
+
+  For the very long cases most of the time goes to first-touch page faults on
+  the token array, which no longer fits in the arena's retained chunk. The
+  cost per byte still stays flat as the line grows.
+
+  Usage: lexbench [min_seconds_per_case]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "lexer.h"
+#include "parse.h"
+
+struct BenchCase {
+  const char *name;
+  char *line;
+  size_t len;
+};
+
+static double now_sec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Build a line of `len` bytes by repeating `unit`, starting with `prefix` */
+static char *repeat_line(const char *prefix, const char *unit, size_t len) {
+  char *line = malloc(len + 1);
+  if (!line) {
+    perror("malloc");
+    exit(1);
+  }
+  size_t plen = strlen(prefix), ulen = strlen(unit), pos = 0;
+  memcpy(line, prefix, plen < len ? plen : len);
+  pos = plen < len ? plen : len;
+  while (pos < len) {
+    size_t n = len - pos < ulen ? len - pos : ulen;
+    memcpy(line + pos, unit, n);
+    pos += n;
+  }
+  line[len] = '\0';
+  return line;
+}
+
+static char *quoted_blob(size_t len) {
+  char *line = repeat_line("echo '", "x", len);
+  line[len - 1] = '\'';
+  return line;
+}
+
+enum Stage { STAGE_COPY, STAGE_LEX, STAGE_PARSE };
+
+/* Time `iters` rounds of copying the line and running it up to `stage` */
+static double run_rounds(struct BenchCase *bc, char *scratch, long iters,
+                         enum Stage stage, struct Arena *arena) {
+  double start = now_sec();
+  for (long i = 0; i < iters; i++) {
+    memcpy(scratch, bc->line, bc->len + 1);
+    if (stage == STAGE_COPY) {
+      continue;
+    }
+    const struct Token *tokens = lex_command_line(scratch, arena, NULL);
+    if (!tokens) {
+      fprintf(stderr, "lexbench: lexing failed for case %s\n", bc->name);
+      exit(1);
+    }
+    for (; stage == STAGE_PARSE && tokens; tokens = next_command(tokens)) {
+      struct Command cmd;
+      if (parse_command(tokens, arena, &cmd) == PARSE_NO_MEMORY) {
+        fprintf(stderr, "lexbench: parsing failed for case %s\n", bc->name);
+        exit(1);
+      }
+    }
+    arena_reset(arena);
+  }
+  return now_sec() - start;
+}
+
+static void bench_case(struct BenchCase *bc, double min_secs) {
+  struct Arena arena = {NULL};
+  char *scratch = malloc(bc->len + 1);
+  if (!scratch) {
+    perror("malloc");
+    exit(1);
+  }
+
+  /* Double the iteration count until one round takes long enough */
+  long iters = 1;
+  double lex_secs;
+  while ((lex_secs = run_rounds(bc, scratch, iters, STAGE_LEX, &arena)) <
+         min_secs) {
+    iters *= 2;
+  }
+  double copy_secs = run_rounds(bc, scratch, iters, STAGE_COPY, &arena);
+  double parse_secs = run_rounds(bc, scratch, iters, STAGE_PARSE, &arena);
+  double secs = lex_secs > copy_secs ? lex_secs - copy_secs : 0;
+  double psecs = parse_secs > lex_secs ? parse_secs - lex_secs : 0;
+
+  double ns_line = secs * 1e9 / iters;
+  double parse_ns_line = psecs * 1e9 / iters;
+  printf("%-16s %10zu %12.1f %10.3f %10.1f %12.1f\n", bc->name, bc->len,
+         ns_line, ns_line / bc->len, bc->len / (ns_line / 1e9) / (1 << 20),
+         parse_ns_line);
+
+  free(scratch);
+  arena_destroy(&arena);
+}
+
+int main(int argc, char **argv) {
+  double min_secs = argc > 1 ? atof(argv[1]) : 0.2;
+  const size_t MB = 1 << 20;
+
+  struct BenchCase cases[] = {
+      {"short", strdup("ls -la /tmp > out.txt"), 0},
+      {"quoted", strdup("echo \"a  b\" 'c & d' e\\ f \"g\\\"h\" > x & ls"), 0},
+      {"args-2KB", repeat_line("ls", " a", 2048), 0},
+      {"args-64KB", repeat_line("ls", " a", 64 * 1024), 0},
+      {"args-1MB", repeat_line("ls", " a", MB), 0},
+      {"blanks-1MB", repeat_line("ls", " \t", MB), 0},
+      {"amps-1MB", repeat_line("ls", " &", MB), 0},
+      {"redirs-1MB", repeat_line("ls", " a > b &", MB), 0},
+      {"quoted-1MB", quoted_blob(MB), 0},
+  };
+  size_t ncases = sizeof(cases) / sizeof(cases[0]);
+
+  printf("%-16s %10s %12s %10s %10s %12s\n", "case", "bytes", "ns/line",
+         "ns/byte", "MB/s", "parse ns");
+  for (size_t i = 0; i < ncases; i++) {
+    cases[i].len = strlen(cases[i].line);
+    bench_case(&cases[i], min_secs);
+    free(cases[i].line);
+  }
+  return 0;
+}
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Time the memo builtin: the first run of an expensive command against the
+# replays that follow.
+#
+# Usage: bench/memo.sh [MB] [RUNS]   (run from shell_project after `make`)
+#
+# Checksums an MB-megabyte file RUNS times through memo, once with the file
+# declared by identity (-i) and once by content (-c), which has to read the
+# whole file to compute the key.
+
+MB=${1:-64}
+RUNS=${2:-100}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+head -c $((MB << 20)) /dev/urandom > "$TMP/data"
+SUM=$(command -v sha256sum)
+
+for mode in -i -c; do
+  i=0
+  {
+    while [ $i -lt "$RUNS" ]; do
+      echo "memo $mode $TMP/data $SUM $TMP/data > /dev/null"
+      i=$((i + 1))
+    done
+    echo exit
+  } > "$TMP/script"
+  rm -rf "$TMP/cache"
+  UTCSH_MEMO_DIR=$TMP/cache UTCSH_TRACE=$TMP/trace$mode ./utcsh "$TMP/script"
+  awk -v mode="$mode" -F'"dur_ns":' '/"ev":"builtin"/ {
+    split($2, v, /[,}]/)
+    if (n++ == 0) first = v[1]; else rest += v[1]
+  } END {
+    printf "memo %s, %d MB: first run %.1f ms, replays %.1f us each\n",
+           mode, '"$MB"', first / 1e6, (n > 1 ? rest / (n - 1) / 1000 : 0)
+  }' "$TMP/trace$mode"
+done
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Compare running a small nested script in-process (`utcsh FILE` naming this
+# shell, and `source FILE`) against starting a separate utcsh for it.
+#
+# Usage: bench/scripts.sh [N]   (run from shell_project after `make`)
+
+N=${1:-1000}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# A copy of the shell is a different file, so it is always exec'd
+mkdir "$TMP/copy"
+cp utcsh "$TMP/copy/utcsh"
+
+cat > "$TMP/helper.utcsh" <<'SCRIPT'
+path /bin /usr/bin
+cd /tmp
+true
+SCRIPT
+
+make_script() { # name cmd
+  {
+    i=0
+    while [ $i -lt "$N" ]; do
+      echo "$2"
+      i=$((i + 1))
+    done
+    echo exit
+  } > "$TMP/$1"
+}
+
+now_ns() { date +%s%N; }
+
+make_script in-process "$(pwd)/utcsh $TMP/helper.utcsh"
+make_script source "source $TMP/helper.utcsh"
+make_script new-shell "$TMP/copy/utcsh $TMP/helper.utcsh"
+for mode in in-process source new-shell; do
+  start=$(now_ns)
+  ./utcsh "$TMP/$mode" || exit 1
+  end=$(now_ns)
+  echo "$mode: $(( (end - start) / N / 1000 )) us/script over $N scripts"
+done
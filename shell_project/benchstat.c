@@ -0,0 +1,190 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "benchstat.h"
+#include "trace.h"
+
+enum Column { COL_WALL, COL_USER, COL_SYS, NUM_COLUMNS };
+
+static const char *const column_names[NUM_COLUMNS] = {"wall", "user", "sys"};
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* The q-quantile of n sorted values, interpolating between neighbours */
+static double quantile(const double *sorted, int n, double q) {
+  double pos = q * (n - 1);
+  int lo = (int)pos;
+  if (lo + 1 >= n) {
+    return sorted[n - 1];
+  }
+  return sorted[lo] + (pos - lo) * (sorted[lo + 1] - sorted[lo]);
+}
+
+void bench_stats(const double *values, int n, struct BenchStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  // Welford's update keeps the variance accurate for long, tight runs
+  double mean = 0;
+  double m2 = 0;
+  for (int i = 0; i < n; i++) {
+    double delta = values[i] - mean;
+    mean += delta / (i + 1);
+    m2 += delta * (values[i] - mean);
+  }
+  stats->mean = mean;
+  stats->stddev = n > 1 ? sqrt(m2 / (n - 1)) : 0;
+
+  double *sorted = malloc(n * sizeof(double));
+  if (sorted == NULL) {
+    stats->min = stats->median = stats->p95 = stats->max = mean;
+    return;
+  }
+  memcpy(sorted, values, n * sizeof(double));
+  qsort(sorted, n, sizeof(double), compare_doubles);
+  stats->min = sorted[0];
+  stats->median = quantile(sorted, n, 0.5);
+  stats->p95 = quantile(sorted, n, 0.95);
+  stats->max = sorted[n - 1];
+
+  // Tukey's fences
+  double q1 = quantile(sorted, n, 0.25);
+  double q3 = quantile(sorted, n, 0.75);
+  double iqr = q3 - q1;
+  for (int i = 0; i < n; i++) {
+    stats->low_outliers += sorted[i] < q1 - 1.5 * iqr;
+    stats->high_outliers += sorted[i] > q3 + 1.5 * iqr;
+  }
+  free(sorted);
+}
+
+static uint64_t column_value(const struct BenchSample *s, enum Column col) {
+  switch (col) {
+  case COL_USER:
+    return s->user_ns;
+  case COL_SYS:
+    return s->sys_ns;
+  default:
+    return s->wall_ns;
+  }
+}
+
+/* Summarize every column. Returns -1 if there is no memory for it. */
+static int column_stats(const struct BenchSample *samples, int n,
+                        struct BenchStats stats[NUM_COLUMNS]) {
+  double *values = malloc(n * sizeof(double));
+  if (values == NULL) {
+    return -1;
+  }
+  for (int col = 0; col < NUM_COLUMNS; col++) {
+    for (int i = 0; i < n; i++) {
+      values[i] = (double)column_value(&samples[i], col);
+    }
+    bench_stats(values, n, &stats[col]);
+  }
+  free(values);
+  return 0;
+}
+
+/* The status as the shell reports it: the exit code, or 128 + signal */
+static int exit_code(int status) {
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+void bench_report(FILE *out, char *const *argv, int warmups,
+                  const struct BenchSample *samples, int n) {
+  fprintf(out, "bench:");
+  for (int i = 0; argv[i] != NULL; i++) {
+    fprintf(out, " %s", argv[i]);
+  }
+  fprintf(out, " (%d run%s, %d warmup%s)\n", n, n == 1 ? "" : "s", warmups,
+          warmups == 1 ? "" : "s");
+
+  struct BenchStats stats[NUM_COLUMNS];
+  if (column_stats(samples, n, stats) < 0) {
+    return;
+  }
+  fprintf(out, "%-8s %9s %9s %9s %9s %9s %9s\n", "ms", "mean", "median",
+          "p95", "stddev", "min", "max");
+  for (int col = 0; col < NUM_COLUMNS; col++) {
+    const struct BenchStats *st = &stats[col];
+    fprintf(out, "%-8s %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+            column_names[col], st->mean / 1e6, st->median / 1e6,
+            st->p95 / 1e6, st->stddev / 1e6, st->min / 1e6, st->max / 1e6);
+  }
+
+  long maxrss = 0;
+  int failed = 0;
+  for (int i = 0; i < n; i++) {
+    maxrss = samples[i].maxrss_kb > maxrss ? samples[i].maxrss_kb : maxrss;
+    failed += exit_code(samples[i].status) != 0;
+  }
+  fprintf(out, "max rss %ld KB\n", maxrss);
+  const struct BenchStats *wall = &stats[COL_WALL];
+  if (wall->low_outliers || wall->high_outliers) {
+    fprintf(out, "outliers: %d low, %d high (wall time beyond 1.5 IQR)\n",
+            wall->low_outliers, wall->high_outliers);
+  }
+  if (failed) {
+    fprintf(out, "%d run%s exited with a non-zero status\n", failed,
+            failed == 1 ? "" : "s");
+  }
+}
+
+int bench_write_csv(const char *path, const struct BenchSample *samples,
+                    int n) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    return -1;
+  }
+  fprintf(f, "run,wall_ns,user_ns,sys_ns,maxrss_kb,status\n");
+  for (int i = 0; i < n; i++) {
+    const struct BenchSample *s = &samples[i];
+    fprintf(f, "%d,%llu,%llu,%llu,%ld,%d\n", i + 1,
+            (unsigned long long)s->wall_ns, (unsigned long long)s->user_ns,
+            (unsigned long long)s->sys_ns, s->maxrss_kb, exit_code(s->status));
+  }
+  return fclose(f) == 0 ? 0 : -1;
+}
+
+int bench_write_json(const char *path, char *const *argv, int warmups,
+                     const struct BenchSample *samples, int n) {
+  struct BenchStats stats[NUM_COLUMNS];
+  if (column_stats(samples, n, stats) < 0) {
+    return -1;
+  }
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    return -1;
+  }
+
+  char arg[4096];
+  fprintf(f, "{\"argv\":[");
+  for (int i = 0; argv[i] != NULL; i++) {
+    fprintf(f, "%s%s", i ? "," : "", trace_json_string(arg, sizeof(arg), argv[i]));
+  }
+  fprintf(f, "],\"warmups\":%d,\"runs\":%d", warmups, n);
+  for (int col = 0; col < NUM_COLUMNS; col++) {
+    const struct BenchStats *st = &stats[col];
+    fprintf(f, ",\"%s_ns\":{\"mean\":%.0f,\"median\":%.0f,\"p95\":%.0f,"
+               "\"stddev\":%.0f,\"min\":%.0f,\"max\":%.0f,"
+               "\"low_outliers\":%d,\"high_outliers\":%d}",
+            column_names[col], st->mean, st->median, st->p95, st->stddev,
+            st->min, st->max, st->low_outliers, st->high_outliers);
+  }
+  fprintf(f, ",\"samples\":[");
+  for (int i = 0; i < n; i++) {
+    const struct BenchSample *s = &samples[i];
+    fprintf(f, "%s{\"wall_ns\":%llu,\"user_ns\":%llu,\"sys_ns\":%llu,"
+               "\"maxrss_kb\":%ld,\"status\":%d}",
+            i ? "," : "", (unsigned long long)s->wall_ns,
+            (unsigned long long)s->user_ns, (unsigned long long)s->sys_ns,
+            s->maxrss_kb, exit_code(s->status));
+  }
+  fprintf(f, "]}\n");
+  return fclose(f) == 0 ? 0 : -1;
+}
@@ -0,0 +1,51 @@
+#ifndef UTCSH_BENCHSTAT_H
+#define UTCSH_BENCHSTAT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* One timed run of the `bench` builtin */
+struct BenchSample {
+  uint64_t wall_ns; /* Fork to reap, as seen by the shell */
+  uint64_t user_ns; /* From the child's rusage */
+  uint64_t sys_ns;
+  long maxrss_kb;
+  int status; /* Wait status */
+};
+
+/* Summary of one column of samples */
+struct BenchStats {
+  double mean;
+  double stddev; /* Sample standard deviation, 0 for a single sample */
+  double min;
+  double median;
+  double p95;
+  double max;
+  int low_outliers;  /* Below Q1 - 1.5 IQR */
+  int high_outliers; /* Above Q3 + 1.5 IQR */
+};
+
+/** Summarize `n` values (n >= 1). Quantiles are interpolated between the
+ * two nearest sorted values. */
+void bench_stats(const double *values, int n, struct BenchStats *stats);
+
+/**
+ * Print the summary of `n` runs of `argv`, after `warmups` untimed ones:
+ * mean, median, p95, stddev, min and max of the wall, user and system
+ * time, the largest max RSS, the outliers of the wall time and the number
+ * of runs that did not exit with status 0.
+ */
+void bench_report(FILE *out, char *const *argv, int warmups,
+                  const struct BenchSample *samples, int n);
+
+/** Write one CSV row per run, after a header. Returns 0 on success and -1
+ * on error. */
+int bench_write_csv(const char *path, const struct BenchSample *samples,
+                    int n);
+
+/** Write the command, the summary and every run as one JSON object. Returns
+ * 0 on success and -1 on error. */
+int bench_write_json(const char *path, char *const *argv, int warmups,
+                     const struct BenchSample *samples, int n);
+
+#endif
@@ -0,0 +1,210 @@
+#define _GNU_SOURCE /* ino64_t, off64_t */
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dircache.h"
+#include "trace.h"
+
+#define GETDENTS_BUF_SIZE (256 * 1024)
+
+/* A listing taken less than this long after the directory changed is not
+   trusted: the mtime only moves once per clock tick */
+#define RACY_NS 1000000000ll
+
+struct linux_dirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+struct CachedDir {
+  bool used;
+  bool racy; /* Read too soon after a change; re-read on the next lookup */
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  uint64_t last_used;
+  struct DirListing listing;
+  struct DirEntry *entries;
+  char *names; /* Every name, NUL-terminated, back to back */
+};
+
+static struct CachedDir cache[DIRCACHE_MAX_DIRS];
+static uint64_t use_clock;
+static uint64_t generations;
+
+static void free_dir(struct CachedDir *dir) {
+  free(dir->entries);
+  free(dir->names);
+  memset(dir, 0, sizeof(*dir));
+}
+
+static int compare_entries(const void *a, const void *b) {
+  return strcmp(((const struct DirEntry *)a)->name,
+                ((const struct DirEntry *)b)->name);
+}
+
+/* Grow *buf to hold at least `need` bytes, doubling. Returns 0 on success. */
+static int reserve(void *buf, size_t *cap, size_t need) {
+  if (need <= *cap) {
+    return 0;
+  }
+  size_t newcap = *cap ? *cap : 4096;
+  while (newcap < need) {
+    newcap *= 2;
+  }
+  void *grown = realloc(*(void **)buf, newcap);
+  if (grown == NULL) {
+    return -1;
+  }
+  *(void **)buf = grown;
+  *cap = newcap;
+  return 0;
+}
+
+/* Read every entry of directory `path` into `dir` in one getdents64 pass and
+   sort them. Returns 0 on success. */
+static int read_dir(const char *path, struct CachedDir *dir) {
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  char *buf = malloc(GETDENTS_BUF_SIZE);
+  char *names = NULL;
+  struct DirEntry *entries = NULL;
+  size_t names_len = 0, names_cap = 0, nentries = 0, entries_cap = 0;
+  int rc = buf ? 0 : -1;
+
+  while (rc == 0) {
+    long n = syscall(SYS_getdents64, fd, buf, GETDENTS_BUF_SIZE);
+    if (n <= 0) {
+      rc = n < 0 ? -1 : 0;
+      break;
+    }
+    for (long off = 0; off < n;) {
+      struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+      off += d->d_reclen;
+      const char *name = d->d_name;
+      if (name[0] == '.' &&
+          (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+        continue;
+      }
+      size_t len = strlen(name) + 1;
+      if (reserve(&names, &names_cap, names_len + len) < 0 ||
+          reserve(&entries, &entries_cap,
+                  (nentries + 1) * sizeof(*entries)) < 0) {
+        rc = -1;
+        break;
+      }
+      memcpy(names + names_len, name, len);
+      /* Names may still move, so keep the offset until the end */
+      entries[nentries].name = (const char *)(uintptr_t)names_len;
+      entries[nentries].len = len - 1;
+      entries[nentries].type = d->d_type;
+      names_len += len;
+      nentries++;
+    }
+  }
+  free(buf);
+  close(fd);
+  if (rc < 0) {
+    free(names);
+    free(entries);
+    return -1;
+  }
+
+  for (size_t i = 0; i < nentries; i++) {
+    entries[i].name = names + (uintptr_t)entries[i].name;
+  }
+  if (nentries > 1) {
+    qsort(entries, nentries, sizeof(*entries), compare_entries);
+  }
+
+  /* Copy the names in sorted order, so matching walks memory in order */
+  char *sorted = malloc(names_len ? names_len : 1);
+  if (sorted == NULL) {
+    free(names);
+    free(entries);
+    return -1;
+  }
+  char *p = sorted;
+  for (size_t i = 0; i < nentries; i++) {
+    memcpy(p, entries[i].name, entries[i].len + 1);
+    entries[i].name = p;
+    p += entries[i].len + 1;
+  }
+  free(names);
+  names = sorted;
+
+  dir->names = names;
+  dir->entries = entries;
+  dir->listing.entries = entries;
+  dir->listing.nentries = nentries;
+  dir->listing.generation = ++generations;
+  stats_count(STAT_DIR_READS);
+  return 0;
+}
+
+static bool same_time(const struct timespec *a, const struct timespec *b) {
+  return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+const struct DirListing *dircache_get(const char *path) {
+  if (*path == '\0') {
+    path = ".";
+  }
+  struct stat st;
+  if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+    return NULL;
+  }
+
+  /* Find the directory, or else the slot to read it into */
+  struct CachedDir *dir = NULL, *victim = &cache[0];
+  for (int i = 0; i < DIRCACHE_MAX_DIRS; i++) {
+    struct CachedDir *c = &cache[i];
+    if (c->used && c->dev == st.st_dev && c->ino == st.st_ino) {
+      dir = c;
+      break;
+    }
+    if (victim->used && (!c->used || c->last_used < victim->last_used)) {
+      victim = c;
+    }
+  }
+  if (dir && !dir->racy && same_time(&dir->mtime, &st.st_mtim)) {
+    dir->last_used = ++use_clock;
+    return &dir->listing;
+  }
+
+  dir = dir ? dir : victim;
+  free_dir(dir);
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  if (read_dir(path, dir) < 0) {
+    return NULL;
+  }
+  dir->used = true;
+  dir->dev = st.st_dev;
+  dir->ino = st.st_ino;
+  dir->mtime = st.st_mtim;
+  dir->racy = (now.tv_sec - st.st_mtim.tv_sec) * 1000000000ll +
+                  (now.tv_nsec - st.st_mtim.tv_nsec) <
+              RACY_NS;
+  dir->last_used = ++use_clock;
+  return &dir->listing;
+}
+
+void dircache_clear(void) {
+  for (int i = 0; i < DIRCACHE_MAX_DIRS; i++) {
+    free_dir(&cache[i]);
+  }
+}
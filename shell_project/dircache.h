@@ -0,0 +1,46 @@
+#ifndef UTCSH_DIRCACHE_H
+#define UTCSH_DIRCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Most directories whose listings are kept at once. The least recently used
+   listing is dropped to make room for a new one. */
+#define DIRCACHE_MAX_DIRS 32
+
+struct DirEntry {
+  const char *name;
+  unsigned short len; /* strlen(name) */
+  unsigned char type; /* d_type from getdents64, DT_UNKNOWN if not known */
+};
+
+/** The entries of one directory, sorted by name with strcmp(), without "."
+ * and "..". The names are stored in the same order, so a scan is sequential.
+ * Owned by the cache. */
+struct DirListing {
+  const struct DirEntry *entries;
+  size_t nentries;
+  uint64_t generation; /* Unique to this reading of the directory */
+};
+
+/**
+ * Look up the listing of directory `path` ("" means the current directory).
+ *
+ * Listings are keyed by device and inode, so different spellings of a path
+ * and a change of working directory are handled. The first lookup reads the
+ * whole directory with getdents64 and sorts it; later lookups cost one stat()
+ * and reuse that listing for as long as the directory's mtime stays the same,
+ * so a script expanding the same pattern again and again reads the directory
+ * once. A listing taken within a second of the directory's last change is
+ * re-read on the next lookup, since a change in the same clock tick would not
+ * move the mtime.
+ *
+ * The listing stays valid until the next call. Returns NULL if the directory
+ * cannot be read.
+ */
+const struct DirListing *dircache_get(const char *path);
+
+/** Free every cached listing */
+void dircache_clear(void);
+
+#endif
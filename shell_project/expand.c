@@ -0,0 +1,363 @@
+#include <dirent.h>
+#include <fnmatch.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "dircache.h"
+#include "expand.h"
+#include "trace.h"
+
+/* A growable array of paths. The array is malloc()ed, the paths live in the
+   arena. */
+struct PathList {
+  char **paths;
+  size_t n;
+  size_t cap;
+};
+
+/* One component of a pattern, between slashes */
+struct Component {
+  char *pattern;     /* NUL-terminated copy */
+  size_t prefix_len; /* Literal characters before the first glob character */
+  /* Set if the pattern is PREFIX*SUFFIX with no other glob characters, which
+     is matched without fnmatch() */
+  bool one_star;
+  const char *suffix;
+  size_t suffix_len;
+};
+
+/* The matches of a recently expanded pattern component, as indexes into the
+   listing they were found in. A script that expands the same pattern on every
+   line scans the directory once per change instead of once per line. */
+#define MATCH_MEMO_SIZE 16
+
+struct MatchMemo {
+  uint64_t generation; /* Of the listing; 0 marks a free slot */
+  bool more;
+  char *pattern;
+  size_t *indexes;
+  size_t n;
+  uint64_t last_used;
+};
+
+static struct MatchMemo memo[MATCH_MEMO_SIZE];
+static uint64_t memo_clock;
+
+static int push_path(struct PathList *list, char *path) {
+  if (list->n == list->cap) {
+    size_t newcap = list->cap ? list->cap * 2 : 16;
+    char **grown = realloc(list->paths, newcap * sizeof(*grown));
+    if (grown == NULL) {
+      return -1;
+    }
+    list->paths = grown;
+    list->cap = newcap;
+  }
+  list->paths[list->n++] = path;
+  return 0;
+}
+
+static bool is_glob_char(char c) { return c == '*' || c == '?' || c == '['; }
+
+static bool has_glob_chars(const char *s, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (is_glob_char(s[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool is_pattern(const struct Token *token) {
+  return token->type == TOK_WORD && !(token->flags & TOKEN_QUOTED) &&
+         has_glob_chars(token->text, strlen(token->text));
+}
+
+/* Join a (alen bytes), b (blen bytes) and the string tail into one new string
+   in the arena */
+static char *join(struct Arena *arena, const char *a, size_t alen,
+                  const char *b, size_t blen, const char *tail) {
+  size_t tlen = strlen(tail);
+  char *path = arena_alloc(arena, alen + blen + tlen + 1);
+  if (path != NULL) {
+    memcpy(path, a, alen);
+    memcpy(path + alen, b, blen);
+    memcpy(path + alen + blen, tail, tlen + 1);
+  }
+  return path;
+}
+
+static int set_component(struct Component *c, const char *s, size_t len,
+                         struct Arena *arena) {
+  c->pattern = join(arena, s, len, "", 0, "");
+  if (c->pattern == NULL) {
+    return -1;
+  }
+  c->prefix_len = 0;
+  while (!is_glob_char(c->pattern[c->prefix_len])) {
+    c->prefix_len++;
+  }
+  const char *rest = c->pattern + c->prefix_len;
+  c->one_star = *rest == '*' && !has_glob_chars(rest + 1, strlen(rest + 1));
+  c->suffix = rest + 1;
+  c->suffix_len = c->one_star ? strlen(c->suffix) : 0;
+  return 0;
+}
+
+/* Does the entry match the component? Its literal prefix is already known to
+   match. */
+static bool component_matches(const struct Component *c,
+                              const struct DirEntry *entry) {
+  if (!c->one_star) {
+    return fnmatch(c->pattern, entry->name, FNM_PERIOD | FNM_NOESCAPE) == 0;
+  }
+  if (entry->name[0] == '.' && c->prefix_len == 0) {
+    return false;
+  }
+  return entry->len >= c->prefix_len + c->suffix_len &&
+         !memcmp(entry->name + entry->len - c->suffix_len, c->suffix,
+                 c->suffix_len);
+}
+
+/* Index of the first entry not sorting before `prefix` */
+static size_t lower_bound(const struct DirListing *dir, const char *prefix,
+                          size_t len) {
+  size_t lo = 0, hi = dir->nentries;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (strncmp(dir->entries[mid].name, prefix, len) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Find the entries of `dir` matching `c`. If `more` the pattern goes on
+   below, so only entries that may be directories are kept. Returns a
+   malloc()ed array of entry indexes, or NULL if out of memory. */
+static size_t *scan_dir(const struct DirListing *dir, const struct Component *c,
+                        bool more, size_t *nmatches) {
+  size_t n = 0, cap = 16;
+  size_t *indexes = malloc(cap * sizeof(*indexes));
+  /* Names sharing the literal prefix are next to each other in the listing */
+  for (size_t i = lower_bound(dir, c->pattern, c->prefix_len);
+       indexes && i < dir->nentries; i++) {
+    const struct DirEntry *entry = &dir->entries[i];
+    if (strncmp(entry->name, c->pattern, c->prefix_len)) {
+      break;
+    }
+    if (!component_matches(c, entry) ||
+        (more && entry->type != DT_DIR && entry->type != DT_LNK &&
+         entry->type != DT_UNKNOWN)) {
+      continue;
+    }
+    if (n == cap) {
+      size_t *grown = realloc(indexes, 2 * cap * sizeof(*grown));
+      if (grown == NULL) {
+        free(indexes);
+        return NULL;
+      }
+      indexes = grown;
+      cap *= 2;
+    }
+    indexes[n++] = i;
+  }
+  *nmatches = n;
+  return indexes;
+}
+
+/* The memo entry for pattern `c` in the listing, or NULL. Memo entries are
+   keyed by the listing's generation, so they lapse when it is re-read. */
+static struct MatchMemo *find_memo(const struct DirListing *dir,
+                                   const struct Component *c, bool more) {
+  for (int i = 0; i < MATCH_MEMO_SIZE; i++) {
+    struct MatchMemo *m = &memo[i];
+    if (m->generation == dir->generation && m->more == more &&
+        !strcmp(m->pattern, c->pattern)) {
+      m->last_used = ++memo_clock;
+      return m;
+    }
+  }
+  return NULL;
+}
+
+/* Remember the matches of `c`, replacing the least recently used entry. Takes
+   ownership of `indexes`, or frees them if they cannot be remembered. */
+static void add_memo(const struct DirListing *dir, const struct Component *c,
+                     bool more, size_t *indexes, size_t n) {
+  struct MatchMemo *victim = &memo[0];
+  for (int i = 1; i < MATCH_MEMO_SIZE; i++) {
+    if (memo[i].last_used < victim->last_used) {
+      victim = &memo[i];
+    }
+  }
+  char *pattern = strdup(c->pattern);
+  if (pattern == NULL) {
+    free(indexes);
+    return;
+  }
+  free(victim->pattern);
+  free(victim->indexes);
+  victim->generation = dir->generation;
+  victim->more = more;
+  victim->pattern = pattern;
+  victim->indexes = indexes;
+  victim->n = n;
+  victim->last_used = ++memo_clock;
+}
+
+/* Add base + name for every name in directory `base` matching `c` to `out`.
+   If `more` the pattern goes on below, so a slash is added. */
+static int match_in_dir(const char *base, const struct Component *c, bool more,
+                        struct PathList *out, struct Arena *arena) {
+  const struct DirListing *dir = dircache_get(base);
+  if (dir == NULL) {
+    return 0; /* Not a directory or unreadable: nothing matches */
+  }
+  struct MatchMemo *m = find_memo(dir, c, more);
+  size_t n, *indexes = m ? m->indexes : scan_dir(dir, c, more, &n);
+  if (indexes == NULL) {
+    return -1;
+  }
+  n = m ? m->n : n;
+
+  int rc = 0;
+  for (size_t i = 0; rc == 0 && i < n; i++) {
+    const struct DirEntry *entry = &dir->entries[indexes[i]];
+    char *path = join(arena, base, strlen(base), entry->name, entry->len,
+                      more ? "/" : "");
+    rc = path && push_path(out, path) == 0 ? 0 : -1;
+  }
+  if (m == NULL) {
+    add_memo(dir, c, more, indexes, n);
+  }
+  return rc;
+}
+
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Expand one pattern into `result`, one component at a time */
+static int expand_word(const char *word, struct Arena *arena,
+                       struct PathList *result) {
+  struct PathList cur = {NULL, 0, 0}, next = {NULL, 0, 0};
+  const char *p = word;
+  while (*p == '/') {
+    p++;
+  }
+  char *root = join(arena, word, p - word, "", 0, "");
+  int rc = root && push_path(&cur, root) == 0 ? 0 : -1;
+
+  /* Set once a literal component follows the last glob, since nothing has
+     checked yet that such paths exist */
+  bool unchecked = false;
+  while (rc == 0 && cur.n > 0) {
+    const char *slash = strchr(p, '/');
+    size_t len = slash ? (size_t)(slash - p) : strlen(p);
+    bool more = slash != NULL;
+    next.n = 0;
+    if (has_glob_chars(p, len)) {
+      struct Component c;
+      rc = set_component(&c, p, len, arena);
+      for (size_t i = 0; rc == 0 && i < cur.n; i++) {
+        rc = match_in_dir(cur.paths[i], &c, more, &next, arena);
+      }
+      unchecked = false;
+    } else {
+      for (size_t i = 0; rc == 0 && i < cur.n; i++) {
+        char *path = join(arena, cur.paths[i], strlen(cur.paths[i]), p, len,
+                          more ? "/" : "");
+        rc = path && push_path(&next, path) == 0 ? 0 : -1;
+      }
+      unchecked = true;
+    }
+    struct PathList swap = cur;
+    cur = next;
+    next = swap;
+    if (!more) {
+      break;
+    }
+    for (p = slash; *p == '/'; p++) {
+    }
+  }
+
+  for (size_t i = 0; rc == 0 && i < cur.n; i++) {
+    struct stat st;
+    if (!unchecked || lstat(cur.paths[i], &st) == 0) {
+      rc = push_path(result, cur.paths[i]);
+    }
+  }
+  free(cur.paths);
+  free(next.paths);
+  if (rc == 0 && result->n > 1) {
+    qsort(result->paths, result->n, sizeof(char *), compare_paths);
+  }
+  return rc;
+}
+
+/* Append a token to a malloc()ed array. Returns 0 on success. */
+static int push_token(struct Token **vec, size_t *n, size_t *cap,
+                      struct Token token) {
+  if (*n == *cap) {
+    size_t newcap = *cap ? *cap * 2 : 16;
+    struct Token *grown = realloc(*vec, newcap * sizeof(*grown));
+    if (grown == NULL) {
+      return -1;
+    }
+    *vec = grown;
+    *cap = newcap;
+  }
+  (*vec)[(*n)++] = token;
+  return 0;
+}
+
+struct Token *expand_globs(struct Token *tokens, struct Arena *arena) {
+  size_t ntokens = 0;
+  bool any = false;
+  for (; tokens[ntokens].type != TOK_END; ntokens++) {
+    any = any || is_pattern(&tokens[ntokens]);
+  }
+  if (!any) {
+    return tokens;
+  }
+
+  struct PathList words = {NULL, 0, 0};
+  struct Token *vec = NULL;
+  size_t n = 0, cap = 0;
+  int rc = 0;
+  for (size_t i = 0; rc == 0 && i <= ntokens; i++) {
+    if (!is_pattern(&tokens[i])) {
+      rc = push_token(&vec, &n, &cap, tokens[i]); /* including TOK_END */
+      continue;
+    }
+    uint64_t start = trace_now_ns();
+    words.n = 0;
+    rc = expand_word(tokens[i].text, arena, &words);
+    if (rc == 0 && words.n == 0) {
+      rc = push_token(&vec, &n, &cap, tokens[i]);
+    }
+    for (size_t w = 0; rc == 0 && w < words.n; w++) {
+      rc = push_token(&vec, &n, &cap,
+                      (struct Token){words.paths[w], TOK_WORD, 0});
+    }
+    if (trace_enabled()) {
+      char pattern[256];
+      trace_event("glob", "\"pattern\":%s,\"matches\":%zu,\"dur_ns\":%llu",
+                  trace_json_string(pattern, sizeof(pattern), tokens[i].text),
+                  words.n, (unsigned long long)(trace_now_ns() - start));
+    }
+  }
+
+  struct Token *out = rc == 0 ? arena_alloc(arena, n * sizeof(*out)) : NULL;
+  if (out != NULL) {
+    memcpy(out, vec, n * sizeof(*out));
+  }
+  free(vec);
+  free(words.paths);
+  return out;
+}
@@ -0,0 +1,24 @@
+#ifndef UTCSH_EXPAND_H
+#define UTCSH_EXPAND_H
+
+#include "arena.h"
+#include "lexer.h"
+
+/**
+ * Expand glob patterns in a lexed command line.
+ *
+ * Every word containing `*`, `?` or `[...]` is replaced by the paths that
+ * match it, in sorted order. `*` and `?` never match a `/`, and a leading `.`
+ * in a name must be matched by a `.` in the pattern. A word that matches
+ * nothing is kept as it is, and a word with any quoted or escaped part
+ * (TOKEN_QUOTED) is never expanded. Directories are listed through the
+ * directory cache, so expanding the same pattern on later lines does not
+ * read the directory again.
+ *
+ * Returns `tokens` itself if there was nothing to expand, otherwise a new
+ * TOK_END-terminated array in `arena` whose new words also live in `arena`.
+ * Returns NULL if the arena runs out of memory.
+ */
+struct Token *expand_globs(struct Token *tokens, struct Arena *arena);
+
+#endif
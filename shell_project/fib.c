@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -7,11 +8,63 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <spawn.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+const int MAX = 13;     /* Largest n for fork mode: results travel in 8-bit exit statuses */
+#define MEMO_MAX 93     /* Largest n whose result fits in 64 bits */
+#define THREADS_MAX 45  /* Thread mode is exponential: fib(45) takes ~10s on one core */
+#define SERIAL_CUTOFF 20 /* Thread mode computes smaller n without making tasks */
+#define DEQUE_SIZE 128  /* More than the deepest recursion, MEMO_MAX */
+#define MAX_THREADS 256
+#define BENCH_MAX 16    /* fib(16) already spawns 3192 processes per tree */
+#define CHILD_STACK (256 * 1024) /* For clone() children and threads */
 
-const int MAX = 13;
 int res = 0;
 static void doFib(int n, int doPrint);
 
+enum SlotState { SLOT_EMPTY, SLOT_BUSY, SLOT_DONE };
+
+/* Lives in a MAP_SHARED mapping, so every process of the tree sees it */
+struct Shared {
+    atomic_long processes;
+    struct MemoSlot {
+        _Atomic uint32_t state; /* enum SlotState, and a futex */
+        uint64_t value;
+    } memo[MEMO_MAX + 1];
+};
+static struct Shared *shared;
+
+/* A fib(n) that thread mode has offered to other workers */
+struct Task {
+    int n;
+    uint64_t result;
+    atomic_bool done;
+};
+
+/* Each worker pushes and pops at the bottom of its own deque; idle workers
+   steal the oldest task from the top of someone else's */
+struct Worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    struct Task *tasks[DEQUE_SIZE];
+    int top, bottom;
+};
+static struct Worker *workers;
+static int nworkers;
+static atomic_bool finished;
+static atomic_long ntasks;
+static atomic_long nstolen;
+
 
 /*
  * unix_error - unix-style error routine.
@@ -22,26 +75,119 @@ inline static void unix_error(char *msg)
     exit(1);
 }
 
+static void usage(void)
+{
+    fprintf(stderr, "Usage: fib [-m fork|memo|threads] [-j THREADS] [-s] <num>\n"
+                    "       fib -m bench [-n RUNS] [-p PRIMITIVES] [-r MB,...] [-t TOUCH,...] <num>\n");
+    exit(-1);
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int runFork(int n, int doPrint);
+static uint64_t runMemo(int n);
+static uint64_t runThreads(int n, int threads);
+static void runBench(int n, int runs, const char *prims, const char *rss,
+                     const char *touches);
+static int benchNodeMain(char **argv);
+
 
 int main(int argc, char **argv)
 {
     int arg;
     int print=1;
+    const char *mode = "fork";
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int stats = 0;
+    int runs = 5;
+    const char *prims = "fork,forkexec,vfork,spawn,clone,thread";
+    const char *rss = "0,64,256";
+    const char *touches = "none,write";
+    int opt;
 
-    if(argc != 2){
-        fprintf(stderr, "Usage: fib <num>\n");
-        exit(-1);
+    if (argc > 1 && !strcmp(argv[1], "--node"))
+        return benchNodeMain(argv);
+    while ((opt = getopt(argc, argv, "m:j:sn:p:r:t:")) != -1) {
+        switch (opt) {
+        case 'm':
+            mode = optarg;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            if (threads < 1 || threads > MAX_THREADS)
+                usage();
+            break;
+        case 's':
+            stats = 1;
+            break;
+        case 'n':
+            runs = atoi(optarg);
+            if (runs < 1)
+                usage();
+            break;
+        case 'p':
+            prims = optarg;
+            break;
+        case 'r':
+            rss = optarg;
+            break;
+        case 't':
+            touches = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if(argc - optind != 1){
+        usage();
     }
 
-    arg = atoi(argv[1]);
-    if(arg < 0 || arg > MAX){
-        fprintf(stderr, "number must be between 0 and %d\n", MAX);
+    int limit = !strcmp(mode, "fork") ? MAX : !strcmp(mode, "bench") ? BENCH_MAX :
+                !strcmp(mode, "threads") ? THREADS_MAX : MEMO_MAX;
+    if (strcmp(mode, "fork") && strcmp(mode, "memo") && strcmp(mode, "threads") &&
+        strcmp(mode, "bench"))
+        usage();
+    arg = atoi(argv[optind]);
+    if(arg < 0 || arg > limit){
+        fprintf(stderr, "number must be between 0 and %d\n", limit);
         exit(-1);
     }
+    if (!strcmp(mode, "bench")) {
+        runBench(arg, runs, prims, rss, touches);
+        return 0;
+    }
 
-    doFib(arg, print);
+    shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+        unix_error("mmap error");
 
-    return 0;
+    double start = now_ms();
+    // only fork mode's result fits in an exit status; the others print it and exit 0
+    int status = 0;
+    if (!strcmp(mode, "fork")) {
+        status = runFork(arg, print);
+    } else if (!strcmp(mode, "memo")) {
+        printf("%llu\n", (unsigned long long)runMemo(arg));
+    } else {
+        printf("%llu\n", (unsigned long long)runThreads(arg, threads));
+    }
+    double wall = now_ms() - start;
+
+    if (stats && !strcmp(mode, "threads")) {
+        fprintf(stderr, "threads: fib(%d) in %.3f ms wall, %d threads, "
+                "%ld tasks, %ld stolen\n", arg, wall, nworkers,
+                atomic_load(&ntasks), atomic_load(&nstolen));
+    } else if (stats) {
+        fprintf(stderr, "%s: fib(%d) in %.3f ms wall, %ld processes\n",
+                mode, arg, wall, atomic_load(&shared->processes));
+    }
+    return status;
 }
 
 int helper(int n) {
@@ -54,7 +200,26 @@ int helper(int n) {
     }
 }
 
-/* 
+/*
+ * Fork mode: doFib() in a child of its own, so the time can be taken once
+ * the whole tree is gone. Exits with fib(n) like doFib() always has.
+ */
+static int runFork(int n, int doPrint)
+{
+    fflush(stdout);
+    pid_t root = fork();
+    if (root < 0) {
+        unix_error("fork error");
+    } else if (root == 0) {
+        doFib(n, doPrint);
+    }
+    int status;
+    if (waitpid(root, &status, 0) < 0)
+        unix_error("wait error");
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+/*
  * Recursively compute the specified number. If print is
  * true, print it. Otherwise, provide it to my parent process.
  *
@@ -65,16 +230,17 @@ int helper(int n) {
 #define DEBUG 0
 static void doFib(int n, int doPrint) // 1:1  2:1  3:2  0, 1, 1, 2, 3, 5, 8, 13, 21, 34, 55, 89, 144,
 {// fork()   wait()  exit(n)
+    atomic_fetch_add(&shared->processes, 1);
     if (n == 0) {
         if (doPrint)
             printf("0\n");
         exit(0);
-    } 
+    }
     else if (n == 1) {
         if (doPrint)
             printf("1\n");
         exit(1);
-    } 
+    }
     else {
         int c1, c2;
         c1 = fork();
@@ -107,10 +273,550 @@ static void doFib(int n, int doPrint) // 1:1  2:1  3:2  0, 1, 1, 2, 3, 5, 8, 13,
         printf("res: %d\n", sum);
     if (doPrint)
             printf("%d\n", sum);
-    exit(sum); 
-            
+    exit(sum);
+
+    }
+
+}
+
+/* Sleep until the slot is no longer busy. Works across processes because
+   the mapping is shared and the futex is not private. */
+static uint64_t memoWait(struct MemoSlot *slot)
+{
+    uint32_t state;
+    while ((state = atomic_load(&slot->state)) == SLOT_BUSY)
+        syscall(SYS_futex, &slot->state, FUTEX_WAIT, SLOT_BUSY, NULL, NULL, 0);
+    return slot->value;
+}
+
+static void memoFib(int n);
+
+/* Fork a child to compute n, unless some process already has it in hand */
+static pid_t memoFork(int n)
+{
+    if (atomic_load(&shared->memo[n].state) != SLOT_EMPTY)
+        return 0;
+    pid_t pid = fork();
+    if (pid < 0) {
+        unix_error("fork error");
+    } else if (pid == 0) {
+        atomic_fetch_add(&shared->processes, 1);
+        memoFib(n);
+        _exit(0);
+    }
+    return pid;
+}
+
+/*
+ * Memo mode: the same fork tree, but results go through the shared table
+ * instead of exit statuses. The process that claims n computes it once;
+ * any other process that needs n waits for it. Waits only ever go to a
+ * smaller n, so they cannot form a cycle.
+ */
+static void memoFib(int n)
+{
+    struct MemoSlot *slot = &shared->memo[n];
+    uint32_t expected = SLOT_EMPTY;
+    if (!atomic_compare_exchange_strong(&slot->state, &expected, SLOT_BUSY)) {
+        memoWait(slot);
+        return;
+    }
+    pid_t c1 = memoFork(n - 1);
+    pid_t c2 = memoFork(n - 2);
+    if ((c1 > 0 && waitpid(c1, NULL, 0) < 0) || (c2 > 0 && waitpid(c2, NULL, 0) < 0))
+        unix_error("wait error");
+    slot->value = memoWait(&shared->memo[n - 1]) + memoWait(&shared->memo[n - 2]);
+    atomic_store(&slot->state, SLOT_DONE);
+    syscall(SYS_futex, &slot->state, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static uint64_t runMemo(int n)
+{
+    shared->memo[0].state = SLOT_DONE;
+    shared->memo[1].value = 1;
+    shared->memo[1].state = SLOT_DONE;
+    fflush(stdout);
+    atomic_store(&shared->processes, 1);
+    if (n >= 2)
+        memoFib(n);
+    return shared->memo[n].value;
+}
+
+static void push(struct Worker *w, struct Task *t)
+{
+    pthread_mutex_lock(&w->lock);
+    w->tasks[w->bottom++] = t;
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* The newest task on w's own deque, or NULL if thieves took them all */
+static struct Task *pop(struct Worker *w)
+{
+    struct Task *t = NULL;
+    pthread_mutex_lock(&w->lock);
+    if (w->bottom > w->top)
+        t = w->tasks[--w->bottom];
+    if (w->bottom == w->top)
+        w->bottom = w->top = 0;
+    pthread_mutex_unlock(&w->lock);
+    return t;
+}
+
+/* The oldest task of any other worker, or NULL if there is none */
+static struct Task *steal(struct Worker *self)
+{
+    int me = self - workers;
+    for (int i = 1; i < nworkers; i++) {
+        struct Worker *victim = &workers[(me + i) % nworkers];
+        struct Task *t = NULL;
+        pthread_mutex_lock(&victim->lock);
+        if (victim->bottom > victim->top)
+            t = victim->tasks[victim->top++];
+        pthread_mutex_unlock(&victim->lock);
+        if (t) {
+            atomic_fetch_add(&nstolen, 1);
+            return t;
+        }
     }
+    return NULL;
+}
 
+static uint64_t taskFib(struct Worker *self, int n);
+
+static void runTask(struct Worker *self, struct Task *t)
+{
+    t->result = taskFib(self, t->n);
+    atomic_store(&t->done, 1);
 }
 
+/*
+ * Thread mode: fib(n - 1) is offered to the other workers while this one
+ * computes fib(n - 2). If nobody took it, it runs here; if it was stolen,
+ * this worker steals other work until it is done. By the time we pop, every
+ * task pushed after ours has been popped again, so ours is the newest left.
+ * Thieves take the oldest task, so if ours was stolen, every task pushed
+ * before it is gone too, and pop() finds the deque empty.
+ */
+static uint64_t taskFib(struct Worker *self, int n)
+{
+    if (n < SERIAL_CUTOFF)
+        return helper(n);
+    struct Task child = {.n = n - 1};
+    push(self, &child);
+    atomic_fetch_add(&ntasks, 1);
+    uint64_t sum = taskFib(self, n - 2);
+    if (pop(self) == &child) {
+        runTask(self, &child);
+    } else {
+        while (!atomic_load(&child.done)) {
+            struct Task *t = steal(self);
+            if (t)
+                runTask(self, t);
+            else
+                sched_yield();
+        }
+    }
+    return sum + child.result;
+}
+
+static void *workerMain(void *arg)
+{
+    struct Worker *self = arg;
+    while (!atomic_load(&finished)) {
+        struct Task *t = steal(self);
+        if (t)
+            runTask(self, t);
+        else
+            sched_yield();
+    }
+    return NULL;
+}
+
+static uint64_t runThreads(int n, int threads)
+{
+    nworkers = threads;
+    workers = calloc(nworkers, sizeof(*workers));
+    if (workers == NULL)
+        unix_error("calloc error");
+    for (int i = 0; i < nworkers; i++)
+        pthread_mutex_init(&workers[i].lock, NULL);
+    // this thread is worker 0
+    for (int i = 1; i < nworkers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, workerMain, &workers[i]))
+            unix_error("pthread_create error");
+    }
+    uint64_t result = taskFib(&workers[0], n);
+    atomic_store(&finished, 1);
+    for (int i = 1; i < nworkers; i++)
+        pthread_join(workers[i].thread, NULL);
+    return result;
+}
+
+/*
+ * Bench mode: build the fork tree of fib(n) with each way of creating a
+ * task, and report how long each spawn took as CSV. A spawn's "spawn"
+ * latency is how long the parent was held up by the call; its "start"
+ * latency is the time until the child's own code runs (after the exec,
+ * for the primitives that exec). The tree is walked again for every
+ * combination of primitive, parent RSS and page-touch pattern.
+ *
+ * Only the bench process itself carries the RSS ballast. fork(), clone()
+ * and thread children share or copy it, but an exec'd child starts small,
+ * so the "root" rows (spawns made by the bench process) compare the
+ * primitives at the same RSS, and the "tree" rows cover every spawn.
+ */
+
+enum Prim { PRIM_FORK, PRIM_FORKEXEC, PRIM_VFORK, PRIM_SPAWN, PRIM_CLONE,
+            PRIM_THREAD, NUM_PRIMS };
+static const char *const prim_names[NUM_PRIMS] = {
+    "fork", "forkexec", "vfork", "spawn", "clone", "thread"};
+
+enum Touch { TOUCH_NONE, TOUCH_READ, TOUCH_WRITE, TOUCH_HALF, NUM_TOUCHES };
+static const char *const touch_names[NUM_TOUCHES] = {
+    "none", "read", "write", "half"};
+
+struct SpawnSample {
+    uint64_t t0;       /* When the parent began the spawn */
+    uint64_t spawn_ns;
+    uint64_t start_ns;
+    int from_root;     /* Spawned by the bench process itself */
+};
+
+/* Shared through a memfd, so that exec'd children can map it too */
+struct BenchShared {
+    atomic_long next;
+    long capacity;
+    struct SpawnSample samples[];
+};
+
+static struct BenchShared *bench_shared;
+static int bench_fd = -1;
+static enum Prim bench_prim;
+
+struct NodeArgs {
+    int n;
+    long idx;
+};
 
+struct Child {
+    pid_t pid;
+    pthread_t thread;
+    void *stack;
+};
+
+static void benchNode(int n, long idx, int root);
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cloneMain(void *arg)
+{
+    struct NodeArgs *a = arg;
+    benchNode(a->n, a->idx, 0);
+    return 0;
+}
+
+static void *threadMain(void *arg)
+{
+    struct NodeArgs *a = arg;
+    benchNode(a->n, a->idx, 0);
+    return NULL;
+}
+
+/* Start the child for a. The argv for the exec'ing primitives is built
+   here, before any vfork(), since a vfork child may only exec or _exit. */
+static void spawnChild(struct Child *c, struct NodeArgs *a, int root)
+{
+    char n[16], idx[32], fd[16];
+    snprintf(n, sizeof(n), "%d", a->n);
+    snprintf(idx, sizeof(idx), "%ld", a->idx);
+    snprintf(fd, sizeof(fd), "%d", bench_fd);
+    char *argv[] = {"fib", "--node", (char *)prim_names[bench_prim], n, idx, fd, NULL};
+    extern char **environ;
+
+    struct SpawnSample *s = &bench_shared->samples[a->idx];
+    s->from_root = root;
+    s->t0 = now_ns();
+    switch (bench_prim) {
+    case PRIM_FORK:
+        if ((c->pid = fork()) == 0) {
+            benchNode(a->n, a->idx, 0);
+            _exit(0);
+        }
+        break;
+    case PRIM_FORKEXEC:
+        if ((c->pid = fork()) == 0) {
+            execv("/proc/self/exe", argv);
+            _exit(127);
+        }
+        break;
+    case PRIM_VFORK:
+        if ((c->pid = vfork()) == 0) {
+            execv("/proc/self/exe", argv);
+            _exit(127);
+        }
+        break;
+    case PRIM_SPAWN:
+        errno = posix_spawn(&c->pid, "/proc/self/exe", NULL, NULL, argv, environ);
+        if (errno)
+            c->pid = -1;
+        break;
+    case PRIM_CLONE:
+        c->stack = mmap(NULL, CHILD_STACK, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (c->stack == MAP_FAILED)
+            unix_error("mmap error");
+        c->pid = clone(cloneMain, (char *)c->stack + CHILD_STACK,
+                       CLONE_VM | SIGCHLD, a);
+        break;
+    default: {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, CHILD_STACK);
+        errno = pthread_create(&c->thread, &attr, threadMain, a);
+        pthread_attr_destroy(&attr);
+        if (errno)
+            unix_error("pthread_create error");
+        c->pid = 0;
+    }
+    }
+    s->spawn_ns = now_ns() - s->t0;
+    if (c->pid < 0)
+        unix_error("spawn error");
+}
+
+static void reapChild(struct Child *c)
+{
+    if (bench_prim == PRIM_THREAD) {
+        pthread_join(c->thread, NULL);
+        return;
+    }
+    while (waitpid(c->pid, NULL, 0) < 0) {
+        if (errno != EINTR)
+            unix_error("wait error");
+    }
+    if (bench_prim == PRIM_CLONE)
+        munmap(c->stack, CHILD_STACK);
+}
+
+static long newSample(void)
+{
+    long idx = atomic_fetch_add(&bench_shared->next, 1);
+    if (idx >= bench_shared->capacity) {
+        fprintf(stderr, "fib: more spawns than the tree should have\n");
+        _exit(1);
+    }
+    return idx;
+}
+
+/* One node of the tree: note when it started, then spawn and reap the
+   nodes for n - 1 and n - 2. root is set in the bench process's own call. */
+static void benchNode(int n, long idx, int root)
+{
+    if (idx >= 0) {
+        struct SpawnSample *s = &bench_shared->samples[idx];
+        s->start_ns = now_ns() - s->t0;
+    }
+    if (n < 2)
+        return;
+    struct NodeArgs args[2] = {{n - 1, newSample()}, {n - 2, newSample()}};
+    struct Child children[2];
+    for (int i = 0; i < 2; i++)
+        spawnChild(&children[i], &args[i], root);
+    for (int i = 0; i < 2; i++)
+        reapChild(&children[i]);
+}
+
+static int lookup(const char *name, const char *const *names, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (!strcmp(name, names[i]))
+            return i;
+    }
+    return -1;
+}
+
+/* fib --node PRIMITIVE N IDX FD: a node of the tree in an exec'd child */
+static int benchNodeMain(char **argv)
+{
+    if (!argv[2] || !argv[3] || !argv[4] || !argv[5])
+        return 127;
+    bench_prim = lookup(argv[2], prim_names, NUM_PRIMS);
+    bench_fd = atoi(argv[5]);
+    struct stat st;
+    if (bench_prim < 0 || fstat(bench_fd, &st) < 0)
+        return 127;
+    bench_shared = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        bench_fd, 0);
+    if (bench_shared == MAP_FAILED)
+        return 127;
+    benchNode(atoi(argv[3]), atol(argv[4]), 0);
+    return 0;
+}
+
+/* Map mb MiB and touch its pages the given way */
+static void *makeBallast(long mb, enum Touch touch)
+{
+    if (mb == 0)
+        return NULL;
+    size_t size = (size_t)mb << 20;
+    char *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        unix_error("mmap error");
+    long page = sysconf(_SC_PAGESIZE);
+    volatile char sink = 0;
+    for (size_t off = 0; touch != TOUCH_NONE && off < size; off += page) {
+        if (touch == TOUCH_READ)
+            sink += p[off];
+        else if (touch == TOUCH_WRITE || (off / page) % 2 == 0)
+            p[off] = 1;
+    }
+    (void)sink;
+    return p;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* The nearest-rank q-quantile of n sorted values */
+static uint64_t percentile(const uint64_t *sorted, long n, double q)
+{
+    long rank = (long)(q * n + 0.999999);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void printRow(const char *prim, long mb, const char *touch,
+                     const char *scope, const char *metric, uint64_t *v, long n)
+{
+    if (n == 0)
+        return;
+    qsort(v, n, sizeof(*v), compare_u64);
+    double sum = 0;
+    for (long i = 0; i < n; i++)
+        sum += v[i];
+    printf("%s,%ld,%s,%s,%s,%ld,%.2f,%.2f,%.2f,%.2f,%.2f\n", prim, mb, touch,
+           scope, metric, n, sum / n / 1e3, percentile(v, n, 0.5) / 1e3,
+           percentile(v, n, 0.9) / 1e3, percentile(v, n, 0.99) / 1e3,
+           v[n - 1] / 1e3);
+}
+
+static void reportConfig(long mb, enum Touch touch)
+{
+    long n = atomic_load(&bench_shared->next);
+    uint64_t *v = malloc(n * sizeof(*v));
+    if (v == NULL)
+        unix_error("malloc error");
+    for (int root = 1; root >= 0; root--) {
+        for (int metric = 0; metric < 2; metric++) {
+            long count = 0;
+            for (long i = 0; i < n; i++) {
+                struct SpawnSample *s = &bench_shared->samples[i];
+                if (!root || s->from_root)
+                    v[count++] = metric ? s->start_ns : s->spawn_ns;
+            }
+            printRow(prim_names[bench_prim], mb, touch_names[touch],
+                     root ? "root" : "tree", metric ? "start" : "spawn", v, count);
+        }
+    }
+    free(v);
+    fflush(stdout);
+}
+
+/* Call fn on every item of a comma-separated list */
+static void eachItem(const char *list, void (*fn)(const char *item, void *arg),
+                     void *arg)
+{
+    char *copy = strdup(list);
+    if (copy == NULL)
+        unix_error("strdup error");
+    for (char *save, *item = strtok_r(copy, ",", &save); item;
+         item = strtok_r(NULL, ",", &save))
+        fn(item, arg);
+    free(copy);
+}
+
+struct BenchPlan {
+    int n, runs;
+    const char *rss, *touches;
+    long mb;
+};
+
+static long parseMb(const char *mb)
+{
+    char *end;
+    long n = strtol(mb, &end, 10);
+    return end == mb || *end ? -1 : n;
+}
+
+/* Check every list before the first tree is built */
+static void checkItem(const char *item, void *arg)
+{
+    int ok = arg == prim_names ? lookup(item, prim_names, NUM_PRIMS) >= 0
+           : arg == touch_names ? lookup(item, touch_names, NUM_TOUCHES) >= 0
+           : parseMb(item) >= 0;
+    if (!ok)
+        usage();
+}
+
+static void benchTouch(const char *name, void *arg)
+{
+    struct BenchPlan *plan = arg;
+    int touch = lookup(name, touch_names, NUM_TOUCHES);
+    void *ballast = makeBallast(plan->mb, touch);
+    atomic_store(&bench_shared->next, 0);
+    for (int run = 0; run < plan->runs; run++)
+        benchNode(plan->n, -1, 1);
+    reportConfig(plan->mb, touch);
+    if (ballast)
+        munmap(ballast, (size_t)plan->mb << 20);
+}
+
+static void benchRss(const char *mb, void *arg)
+{
+    struct BenchPlan *plan = arg;
+    plan->mb = parseMb(mb);
+    eachItem(plan->touches, benchTouch, plan);
+}
+
+static void benchPrim(const char *name, void *arg)
+{
+    struct BenchPlan *plan = arg;
+    bench_prim = lookup(name, prim_names, NUM_PRIMS);
+    eachItem(plan->rss, benchRss, plan);
+}
+
+static void runBench(int n, int runs, const char *prims, const char *rss,
+                     const char *touches)
+{
+    eachItem(prims, checkItem, (void *)prim_names);
+    eachItem(rss, checkItem, NULL);
+    eachItem(touches, checkItem, (void *)touch_names);
+
+    long spawns[BENCH_MAX + 1] = {0, 0};
+    for (int i = 2; i <= n; i++)
+        spawns[i] = spawns[i - 1] + spawns[i - 2] + 2;
+    long capacity = spawns[n] * runs;
+    size_t size = sizeof(struct BenchShared) + capacity * sizeof(struct SpawnSample);
+
+    // not close-on-exec: exec'd nodes find the samples through it
+    bench_fd = memfd_create("fib-bench", 0);
+    if (bench_fd < 0 || ftruncate(bench_fd, size) < 0)
+        unix_error("memfd error");
+    bench_shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, bench_fd, 0);
+    if (bench_shared == MAP_FAILED)
+        unix_error("mmap error");
+    bench_shared->capacity = capacity;
+
+    struct BenchPlan plan = {n, runs, rss, touches, 0};
+    printf("primitive,rss_mb,touch,scope,metric,count,mean_us,p50_us,p90_us,p99_us,max_us\n");
+    fflush(stdout);
+    eachItem(prims, benchPrim, &plan);
+}
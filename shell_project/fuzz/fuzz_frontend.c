@@ -0,0 +1,220 @@
+/*
+  fuzz_frontend - fuzz target for the utcsh lexer and parser
+
+  Each input is one command line. It is lexed, then every command on it is
+  parsed, and the results are checked for consistency. Any crash, sanitizer
+  report or failed assert is a bug.
+
+  Built three ways (see the Makefile):
+
+    make fuzz         libFuzzer, with clang: ./fuzz/fuzz_frontend fuzz/corpus
+    make fuzz-afl     AFL: CC=afl-clang-fast make fuzz-afl, then
+                      afl-fuzz -i fuzz/corpus -o findings ./fuzz/fuzz_frontend_afl
+    make fuzz-check   gcc + ASan/UBSan, replays the corpus and then runs a
+                      short built-in random mutation pass; no fuzzer needed
+
+  The standalone build (FUZZ_STANDALONE) reads each file named on the command
+  line as one input, or standard input if there are none, which is what AFL
+  expects. With -r N it also runs N random mutations of those inputs.
+*/
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "lexer.h"
+#include "parse.h"
+
+static struct Arena arena;
+
+static void check_command(const struct Token *tokens) {
+  size_t ntokens = 0;
+  while (tokens[ntokens].type != TOK_END && tokens[ntokens].type != TOK_AMP) {
+    ntokens++;
+  }
+
+  struct Command cmd;
+  enum ParseError err = parse_command(tokens, &arena, &cmd);
+  if (err != PARSE_OK) {
+    assert(cmd.args == NULL && cmd.inputFile == NULL && cmd.outputFile == NULL &&
+           cmd.errorFile == NULL && cmd.procsubs == NULL);
+    assert(strlen(parse_error_string(err)) > 0);
+    return;
+  }
+  size_t nargs = 0;
+  while (cmd.args[nargs] != NULL) {
+    assert(nargs < ntokens);
+    nargs++;
+  }
+  /* Every redirect is an operator and a target, except 2>&1 */
+  size_t redirect_tokens = 2 * (cmd.inputFile != NULL) +
+                           2 * (cmd.outputFile != NULL) +
+                           2 * (cmd.errorFile != NULL) + cmd.errorToOutput;
+  assert(nargs + redirect_tokens == ntokens);
+  assert(redirect_tokens == 0 || nargs > 0);
+  assert(!cmd.appendOutput || cmd.outputFile != NULL);
+  assert(!(cmd.errorToOutput && cmd.errorFile != NULL));
+  for (int i = 0; i < cmd.nprocsubs; i++) {
+    assert(*cmd.procsubs[i].slot == cmd.procsubs[i].cmdline);
+    assert(cmd.procsubs[i].pid == -1 && cmd.procsubs[i].fd == -1);
+  }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  char *line = arena_alloc(&arena, size + 1);
+  if (line == NULL) {
+    return 0;
+  }
+  memcpy(line, data, size);
+  line[size] = '\0';
+  size_t len = strlen(line); /* The shell never sees past a NUL */
+
+  size_t ntokens = 0;
+  struct Token *tokens = lex_command_line(line, &arena, &ntokens);
+  if (tokens != NULL) {
+    assert(tokens[ntokens].type == TOK_END);
+    for (size_t i = 0; i < ntokens; i++) {
+      assert(tokens[i].type != TOK_END && tokens[i].text != NULL);
+      if (tokens[i].type == TOK_PROCSUB_IN || tokens[i].type == TOK_PROCSUB_OUT) {
+        /* Process substitutions are left in place */
+        assert(tokens[i].text >= line + 2 && tokens[i].text <= line + len);
+        assert(tokens[i].text + strlen(tokens[i].text) < line + len);
+      } else if (tokens[i].type == TOK_WORD) {
+        /* Words are rewritten in place and never grow */
+        assert(tokens[i].text >= line && tokens[i].text <= line + len);
+        assert(tokens[i].text + strlen(tokens[i].text) <= line + len);
+        assert(*tokens[i].text || (tokens[i].flags & TOKEN_QUOTED));
+      }
+    }
+    for (const struct Token *cmd = tokens; cmd; cmd = next_command(cmd)) {
+      check_command(cmd);
+    }
+  }
+  arena_reset(&arena);
+  return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+
+#define MAX_INPUT (64 * 1024)
+
+struct Input {
+  char *data;
+  size_t size;
+};
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint64_t next_random(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+/* Bytes the lexer and parser treat specially, picked more often than others */
+static const char interesting[] = " \t\n'\"\\><&()2";
+
+static char random_byte(void) {
+  if (next_random() % 2) {
+    return interesting[next_random() % (sizeof(interesting) - 1)];
+  }
+  return (char)next_random();
+}
+
+static size_t mutate(char *buf, size_t size) {
+  int nmutations = 1 + next_random() % 8;
+  for (int m = 0; m < nmutations; m++) {
+    size_t pos = size ? next_random() % size : 0;
+    switch (next_random() % 4) {
+    case 0: /* Overwrite */
+      if (size) {
+        buf[pos] = random_byte();
+      }
+      break;
+    case 1: /* Insert */
+      if (size < MAX_INPUT) {
+        memmove(buf + pos + 1, buf + pos, size - pos);
+        buf[pos] = random_byte();
+        size++;
+      }
+      break;
+    case 2: /* Delete */
+      if (size) {
+        memmove(buf + pos, buf + pos + 1, size - pos - 1);
+        size--;
+      }
+      break;
+    default: /* Repeat a chunk, to grow long and repetitive lines */
+      if (size) {
+        size_t n = 1 + next_random() % (size - pos);
+        if (size + n <= MAX_INPUT) {
+          memmove(buf + pos + n, buf + pos, size - pos);
+          size += n;
+        }
+      }
+      break;
+    }
+  }
+  return size;
+}
+
+static int read_input(FILE *f, struct Input *in) {
+  in->data = malloc(MAX_INPUT);
+  if (in->data == NULL) {
+    return -1;
+  }
+  in->size = fread(in->data, 1, MAX_INPUT, f);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  long rounds = 0;
+  int first = 1;
+  if (argc > 2 && !strcmp(argv[1], "-r")) {
+    rounds = atol(argv[2]);
+    first = 3;
+  }
+
+  int ninputs = argc - first > 0 ? argc - first : 1;
+  struct Input *inputs = calloc(ninputs, sizeof(*inputs));
+  if (inputs == NULL) {
+    return 1;
+  }
+  for (int i = 0; i < ninputs; i++) {
+    FILE *f = argc > first ? fopen(argv[first + i], "rb") : stdin;
+    if (f == NULL || read_input(f, &inputs[i]) < 0) {
+      perror(argc > first ? argv[first + i] : "stdin");
+      return 1;
+    }
+    if (f != stdin) {
+      fclose(f);
+    }
+    LLVMFuzzerTestOneInput((uint8_t *)inputs[i].data, inputs[i].size);
+  }
+
+  char *buf = malloc(MAX_INPUT);
+  if (buf == NULL) {
+    return 1;
+  }
+  for (long r = 0; r < rounds; r++) {
+    struct Input *seed = &inputs[next_random() % ninputs];
+    memcpy(buf, seed->data, seed->size);
+    size_t size = mutate(buf, seed->size);
+    LLVMFuzzerTestOneInput((uint8_t *)buf, size);
+  }
+  printf("fuzz_frontend: %d inputs, %ld mutations, no failures\n", ninputs,
+         rounds);
+
+  free(buf);
+  for (int i = 0; i < ninputs; i++) {
+    free(inputs[i].data);
+  }
+  free(inputs);
+  arena_destroy(&arena);
+  return 0;
+}
+
+#endif
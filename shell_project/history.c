@@ -0,0 +1,487 @@
+#define _GNU_SOURCE /* memmem */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history.h"
+
+/* The suffix array covers the entries from this many most recent ones */
+#define HISTORY_SA_WINDOW 65536
+
+/* One history entry. Entries loaded at startup point into the mapping and
+   are not NUL-terminated; entries added later are malloc'd. */
+struct HistEntry {
+  const char *text;
+  uint32_t len;
+};
+
+/* A suffix of a distinct entry text: text->text[off..len) */
+struct Suffix {
+  uint32_t entry;  /* Most recent entry with this text */
+  uint32_t off;
+};
+
+static int hist_fd = -1;
+static const char *map;
+static size_t map_len;
+
+static struct HistEntry *entries;
+static size_t nentries;
+static size_t cap_entries;
+static bool loaded; /* Mapped entries have been split into `entries` */
+/* The last entry is the line being run. `history` lists it, but searches
+   skip it so that `history -r foo` does not just find itself. */
+static bool last_is_current;
+
+/* Prefix index: entries[0, nindexed) sorted by text, equal texts by number.
+   Entries added after the index was built are searched linearly. */
+static uint32_t *by_text;
+static size_t nindexed;
+
+/* Suffix array over the distinct texts among entries[sa_start, nindexed) */
+static struct Suffix *suffixes;
+static size_t nsuffixes;
+static size_t sa_start;
+static bool sa_built;
+
+/* ------------------------------------------------------------------------ */
+/* Loading and appending                                                    */
+
+/* Number of entries that searches look at */
+static size_t searchable(void) { return nentries - last_is_current; }
+
+static int push_entry(const char *text, uint32_t len) {
+  if (nentries == cap_entries) {
+    size_t newcap = cap_entries ? cap_entries * 2 : 1024;
+    struct HistEntry *grown = realloc(entries, newcap * sizeof(*grown));
+    if (grown == NULL) {
+      return -1;
+    }
+    entries = grown;
+    cap_entries = newcap;
+  }
+  entries[nentries].text = text;
+  entries[nentries].len = len;
+  nentries++;
+  return 0;
+}
+
+/* Split the mapping into entries. Done once, on first use. */
+static int load_entries(void) {
+  if (loaded) {
+    return 0;
+  }
+  /* Entries added before loading go after the mapped ones */
+  struct HistEntry *added = entries;
+  size_t nadded = nentries;
+  entries = NULL;
+  nentries = cap_entries = 0;
+
+  const char *p = map;
+  const char *end = map + map_len;
+  while (p < end) {
+    const char *nl = memchr(p, '\n', end - p);
+    const char *stop = nl ? nl : end;
+    if (stop > p && push_entry(p, stop - p) < 0) {
+      break;
+    }
+    p = stop + 1;
+  }
+  for (size_t i = 0; i < nadded; i++) {
+    push_entry(added[i].text, added[i].len);
+  }
+  free(added);
+  loaded = true;
+  return 0;
+}
+
+void history_init_from_env(bool interactive) {
+  char *setting = getenv(HISTORY_ENV_NAME);
+  char *path = NULL;
+  if (setting) {
+    if (!*setting) {
+      return;
+    }
+    path = strdup(setting);
+  } else if (interactive && getenv("HOME")) {
+    const char *home = getenv("HOME");
+    path = malloc(strlen(home) + sizeof(HISTORY_DEFAULT_FILE) + 1);
+    if (path) {
+      sprintf(path, "%s/%s", home, HISTORY_DEFAULT_FILE);
+    }
+  }
+  if (path == NULL) {
+    return;
+  }
+
+  int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  free(path);
+  if (fd < 0) {
+    return;
+  }
+  /* The shared lock keeps us from mapping half of another shell's append */
+  struct stat st;
+  flock(fd, LOCK_SH);
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m != MAP_FAILED) {
+      map = m;
+      map_len = st.st_size;
+    }
+  }
+  flock(fd, LOCK_UN);
+  hist_fd = fd;
+}
+
+void history_add(const char *line) {
+  if (hist_fd < 0) {
+    return;
+  }
+  size_t len = strcspn(line, "\n");
+  size_t i = 0;
+  while (i < len && (line[i] == ' ' || line[i] == '\t')) {
+    i++;
+  }
+  if (i == len || len > UINT32_MAX - 1) {
+    return;
+  }
+
+  char *copy = malloc(len + 1);
+  if (copy == NULL) {
+    return;
+  }
+  memcpy(copy, line, len);
+  copy[len] = '\n';
+  flock(hist_fd, LOCK_EX);
+  ssize_t unused = write(hist_fd, copy, len + 1);
+  (void)unused; /* A lost history line is not worth failing a command over */
+  flock(hist_fd, LOCK_UN);
+  copy[len] = '\0';
+  if (push_entry(copy, len) < 0) {
+    free(copy);
+    last_is_current = false;
+  } else {
+    last_is_current = true;
+  }
+}
+
+void history_close(void) {
+  if (map) {
+    munmap((void *)map, map_len);
+  }
+  if (hist_fd >= 0) {
+    close(hist_fd);
+  }
+  /* Only the entries past the mapping were malloc'd */
+  for (size_t i = 0; i < nentries; i++) {
+    if (entries[i].text < map || entries[i].text >= map + map_len) {
+      free((char *)entries[i].text);
+    }
+  }
+  free(entries);
+  free(by_text);
+  free(suffixes);
+  entries = NULL;
+  by_text = NULL;
+  suffixes = NULL;
+  map = NULL;
+  hist_fd = -1;
+  nentries = cap_entries = nindexed = nsuffixes = 0;
+  loaded = sa_built = last_is_current = false;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Prefix index                                                             */
+
+static int compare_texts(const char *a, size_t alen, const char *b,
+                         size_t blen) {
+  int c = memcmp(a, b, alen < blen ? alen : blen);
+  if (c) {
+    return c;
+  }
+  return (alen > blen) - (alen < blen);
+}
+
+static int compare_by_text(const void *pa, const void *pb) {
+  uint32_t a = *(const uint32_t *)pa;
+  uint32_t b = *(const uint32_t *)pb;
+  int c = compare_texts(entries[a].text, entries[a].len, entries[b].text,
+                        entries[b].len);
+  if (c) {
+    return c;
+  }
+  return (a > b) - (a < b);
+}
+
+static int build_prefix_index(void) {
+  if (by_text) {
+    return 0;
+  }
+  size_t n = searchable();
+  if (n > UINT32_MAX) {
+    return -1;
+  }
+  by_text = malloc((n ? n : 1) * sizeof(*by_text));
+  if (by_text == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < n; i++) {
+    by_text[i] = i;
+  }
+  qsort(by_text, n, sizeof(*by_text), compare_by_text);
+  nindexed = n;
+  return 0;
+}
+
+static bool has_prefix(const struct HistEntry *e, const char *prefix,
+                       size_t plen) {
+  return e->len >= plen && !memcmp(e->text, prefix, plen);
+}
+
+static int compare_u32(const void *pa, const void *pb) {
+  uint32_t a = *(const uint32_t *)pa;
+  uint32_t b = *(const uint32_t *)pb;
+  return (a > b) - (a < b);
+}
+
+static void print_entry(FILE *out, size_t i) {
+  fprintf(out, "%5zu  %.*s\n", i + 1, (int)entries[i].len, entries[i].text);
+}
+
+/* All entries starting with prefix, oldest first. Binary search finds the
+   block of matching texts in the sorted index. */
+static int search_prefix(const char *prefix, FILE *out) {
+  if (build_prefix_index() < 0) {
+    return -1;
+  }
+  size_t plen = strlen(prefix);
+  size_t lo = 0, hi = nindexed;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    const struct HistEntry *e = &entries[by_text[mid]];
+    size_t n = e->len < plen ? e->len : plen;
+    int c = memcmp(e->text, prefix, n);
+    if (c < 0 || (c == 0 && e->len < plen)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  size_t end = lo;
+  while (end < nindexed && has_prefix(&entries[by_text[end]], prefix, plen)) {
+    end++;
+  }
+
+  uint32_t *hits = malloc((end - lo + 1) * sizeof(*hits));
+  if (hits == NULL) {
+    return -1;
+  }
+  memcpy(hits, by_text + lo, (end - lo) * sizeof(*hits));
+  qsort(hits, end - lo, sizeof(*hits), compare_u32);
+  for (size_t i = 0; i < end - lo; i++) {
+    print_entry(out, hits[i]);
+  }
+  free(hits);
+  for (size_t i = nindexed; i < searchable(); i++) {
+    if (has_prefix(&entries[i], prefix, plen)) {
+      print_entry(out, i);
+    }
+  }
+  return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Substring search                                                         */
+
+static int compare_suffixes(const void *pa, const void *pb) {
+  const struct Suffix *a = pa;
+  const struct Suffix *b = pb;
+  const struct HistEntry *ea = &entries[a->entry];
+  const struct HistEntry *eb = &entries[b->entry];
+  return compare_texts(ea->text + a->off, ea->len - a->off,
+                       eb->text + b->off, eb->len - b->off);
+}
+
+/* The last position in by_text holding the same text as position i */
+static size_t same_text_end(size_t i) {
+  const struct HistEntry *e = &entries[by_text[i]];
+  size_t last = i;
+  while (last + 1 < nindexed &&
+         !compare_texts(e->text, e->len, entries[by_text[last + 1]].text,
+                        entries[by_text[last + 1]].len)) {
+    last++;
+  }
+  return last;
+}
+
+/* Sort every suffix of every distinct text used in the recent window. The
+   prefix index already groups equal texts, so each text is taken once, with
+   the number of its most recent use. */
+static int build_suffix_array(void) {
+  if (sa_built) {
+    return 0;
+  }
+  if (build_prefix_index() < 0) {
+    return -1;
+  }
+  sa_start = nindexed > HISTORY_SA_WINDOW ? nindexed - HISTORY_SA_WINDOW : 0;
+
+  size_t total = 0;
+  for (size_t i = 0; i < nindexed; i++) {
+    size_t last = same_text_end(i);
+    if (by_text[last] >= sa_start) {
+      total += entries[by_text[last]].len;
+    }
+    i = last;
+  }
+
+  suffixes = malloc((total ? total : 1) * sizeof(*suffixes));
+  if (suffixes == NULL) {
+    return -1;
+  }
+  nsuffixes = 0;
+  for (size_t i = 0; i < nindexed; i++) {
+    size_t last = same_text_end(i);
+    uint32_t newest = by_text[last]; /* Equal texts are sorted by number */
+    if (newest >= sa_start) {
+      for (uint32_t off = 0; off < entries[newest].len; off++) {
+        suffixes[nsuffixes].entry = newest;
+        suffixes[nsuffixes].off = off;
+        nsuffixes++;
+      }
+    }
+    i = last;
+  }
+  qsort(suffixes, nsuffixes, sizeof(*suffixes), compare_suffixes);
+  sa_built = true;
+  return 0;
+}
+
+static bool contains(const struct HistEntry *e, const char *text,
+                     size_t tlen) {
+  return memmem(e->text, e->len, text, tlen) != NULL;
+}
+
+/* The most recent entry containing text, or -1. Entries added since the
+   index was built are the most recent, so they are checked first; then the
+   suffix array answers for the recent window; anything older is scanned. */
+static long search_substring(const char *text) {
+  size_t tlen = strlen(text);
+  if (build_suffix_array() < 0) {
+    return -1;
+  }
+  for (size_t i = searchable(); i-- > nindexed;) {
+    if (contains(&entries[i], text, tlen)) {
+      return i;
+    }
+  }
+
+  size_t lo = 0, hi = nsuffixes;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    const struct HistEntry *e = &entries[suffixes[mid].entry];
+    size_t rest = e->len - suffixes[mid].off;
+    size_t n = rest < tlen ? rest : tlen;
+    int c = memcmp(e->text + suffixes[mid].off, text, n);
+    if (c < 0 || (c == 0 && rest < tlen)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  long best = -1;
+  for (size_t i = lo; i < nsuffixes; i++) {
+    const struct HistEntry *e = &entries[suffixes[i].entry];
+    if (e->len - suffixes[i].off < tlen ||
+        memcmp(e->text + suffixes[i].off, text, tlen)) {
+      break;
+    }
+    if ((long)suffixes[i].entry > best) {
+      best = suffixes[i].entry;
+    }
+  }
+  if (best >= 0) {
+    return best;
+  }
+
+  for (size_t i = sa_start; i-- > 0;) {
+    if (contains(&entries[i], text, tlen)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* ------------------------------------------------------------------------ */
+/* The builtin                                                              */
+
+/* The words of a search pattern joined by single spaces, so that
+   `history -s git commit` works without quotes. The result is malloc'd. */
+static char *join_words(char **words) {
+  size_t len = 1;
+  for (int i = 0; words[i]; i++) {
+    len += strlen(words[i]) + 1;
+  }
+  char *joined = malloc(len);
+  if (joined == NULL) {
+    return NULL;
+  }
+  char *p = joined;
+  for (int i = 0; words[i]; i++) {
+    if (i > 0) {
+      *p++ = ' ';
+    }
+    size_t n = strlen(words[i]);
+    memcpy(p, words[i], n);
+    p += n;
+  }
+  *p = '\0';
+  return joined;
+}
+
+int history_builtin(char **args, FILE *out) {
+  if (hist_fd < 0 || load_entries() < 0) {
+    return -1;
+  }
+  int rc = 0;
+  if (args[1] == NULL) {
+    for (size_t i = 0; i < nentries; i++) {
+      print_entry(out, i);
+    }
+  } else if (!strcmp(args[1], "-s") || !strcmp(args[1], "-r")) {
+    char *pattern = args[2] ? join_words(args + 2) : NULL;
+    if (pattern == NULL) {
+      return -1;
+    }
+    if (args[1][1] == 's') {
+      rc = search_prefix(pattern, out);
+    } else if (*pattern) {
+      long i = search_substring(pattern);
+      if (i >= 0) {
+        print_entry(out, i);
+      }
+    }
+    free(pattern);
+  } else if (args[2] == NULL) {
+    char *end;
+    errno = 0;
+    long n = strtol(args[1], &end, 10);
+    if (*args[1] == '\0' || *end != '\0' || n < 0 || errno) {
+      return -1;
+    }
+    size_t first = (size_t)n < nentries ? nentries - n : 0;
+    for (size_t i = first; i < nentries; i++) {
+      print_entry(out, i);
+    }
+  } else {
+    rc = -1;
+  }
+  fflush(out);
+  return rc;
+}
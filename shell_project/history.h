@@ -0,0 +1,46 @@
+#ifndef UTCSH_HISTORY_H
+#define UTCSH_HISTORY_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Environment variable naming the history file. When it is unset, an
+   interactive shell on a terminal uses ~/.utcsh_history; when it is set but
+   empty, history is off. */
+#define HISTORY_ENV_NAME "UTCSH_HISTFILE"
+#define HISTORY_DEFAULT_FILE ".utcsh_history"
+
+/**
+ * Open the history file picked by HISTORY_ENV_NAME, if any, and map what it
+ * holds. Only the mapping is set up here, so startup does not get slower as
+ * the history grows; entries are found and indexed on first use. Entries
+ * appended later by other shells are not seen until the next start.
+ *
+ * `interactive` says whether the shell reads commands from a terminal, which
+ * is the only case where the default file is used.
+ */
+void history_init_from_env(bool interactive);
+
+/** Append one command line to the history file and to this shell's view of
+ * the history. A trailing newline is dropped and blank lines are ignored.
+ * The append is a single locked write, so several shells can share a file. */
+void history_add(const char *line);
+
+/**
+ * The `history` builtin. `args` is its NULL-terminated argv.
+ *
+ * history            list every entry with its number
+ * history N          list the last N entries
+ * history -s PREFIX  list entries starting with PREFIX, oldest first
+ * history -r TEXT    show the most recent entry containing TEXT
+ *
+ * A PREFIX or TEXT of several words is joined with single spaces.
+ *
+ * Returns 0 on success and -1 on a usage error or if history is off.
+ */
+int history_builtin(char **args, FILE *out);
+
+/** Unmap and close the history file */
+void history_close(void);
+
+#endif
@@ -0,0 +1,405 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "audit.h"
+#include "jobs.h"
+#include "placement.h"
+#include "trace.h"
+
+enum ProcState { PROC_RUNNING, PROC_STOPPED, PROC_DONE };
+
+struct JobProc {
+  pid_t pid;
+  volatile sig_atomic_t state; /* enum ProcState, written by the handler */
+  int status;                  /* wait status once PROC_DONE */
+  struct rusage ru;
+};
+
+struct Job {
+  int id; /* %id; 0 marks a free slot */
+  pid_t pgid;
+  char *cmd;
+  unsigned long cmd_id;
+  uint64_t start_ns;
+  int nprocs;
+  struct JobProc *procs;
+  bool stop_reported;
+};
+
+/* The table is only changed with SIGCHLD blocked, so the handler never sees
+   it half-updated */
+static struct Job *jobs;
+static int njobs; /* Slots in use or free, up to the last used one */
+static int cap_jobs;
+
+static bool job_control;
+static pid_t shell_pgid;
+static sigset_t chld_mask;
+
+/* Reap every job process that changed state. Only pids in the table are
+   waited for, so foreground commands are still reaped by their own wait4. */
+static void on_sigchld(int sig) {
+  (void)sig;
+  int saved_errno = errno;
+  for (int j = 0; j < njobs; j++) {
+    for (int p = 0; jobs[j].id && p < jobs[j].nprocs; p++) {
+      struct JobProc *proc = &jobs[j].procs[p];
+      int status;
+      struct rusage ru;
+      while (proc->state != PROC_DONE &&
+             wait4(proc->pid, &status, WNOHANG | WUNTRACED | WCONTINUED,
+                   &ru) == proc->pid) {
+        if (WIFSTOPPED(status)) {
+          proc->state = PROC_STOPPED;
+        } else if (WIFCONTINUED(status)) {
+          proc->state = PROC_RUNNING;
+        } else {
+          proc->status = status;
+          proc->ru = ru;
+          proc->state = PROC_DONE;
+        }
+      }
+    }
+  }
+  errno = saved_errno;
+}
+
+static void block_sigchld(sigset_t *old) {
+  sigprocmask(SIG_BLOCK, &chld_mask, old);
+}
+
+static void unblock_sigchld(void) {
+  sigprocmask(SIG_UNBLOCK, &chld_mask, NULL);
+}
+
+void jobs_init(bool control) {
+  sigemptyset(&chld_mask);
+  sigaddset(&chld_mask, SIGCHLD);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_sigchld;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGCHLD, &sa, NULL);
+
+  job_control = control;
+  if (job_control) {
+    shell_pgid = getpgrp();
+    /* Taking the terminal back from a job would otherwise stop the shell */
+    signal(SIGTTOU, SIG_IGN);
+  }
+}
+
+void jobs_begin_launch(void) { block_sigchld(NULL); }
+
+void jobs_reset_child_signals(void) {
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGTTOU, SIG_DFL);
+  unblock_sigchld();
+}
+
+void jobs_child_setup(pid_t pgid) {
+  setpgid(0, pgid);
+  jobs_reset_child_signals();
+  if (!job_control) {
+    /* Without job control a background job must not eat the shell's input */
+    int devnull = open("/dev/null", O_RDONLY);
+    if (devnull >= 0) {
+      dup2(devnull, STDIN_FILENO);
+      close(devnull);
+    }
+  }
+}
+
+static int next_job_id(void) {
+  int id = 0;
+  for (int j = 0; j < njobs; j++) {
+    if (jobs[j].id > id) {
+      id = jobs[j].id;
+    }
+  }
+  return id + 1;
+}
+
+int jobs_add(pid_t pgid, const pid_t *pids, int npids, const char *cmd,
+             unsigned long cmd_id, uint64_t start_ns) {
+  int id = -1;
+  struct JobProc *procs = npids ? calloc(npids, sizeof(*procs)) : NULL;
+  char *cmd_copy = strdup(cmd);
+  if (procs == NULL || cmd_copy == NULL) {
+    goto out;
+  }
+  int slot = 0;
+  while (slot < njobs && jobs[slot].id) {
+    slot++;
+  }
+  if (slot == cap_jobs) {
+    int newcap = cap_jobs ? cap_jobs * 2 : 8;
+    struct Job *grown = realloc(jobs, newcap * sizeof(*grown));
+    if (grown == NULL) {
+      goto out;
+    }
+    jobs = grown;
+    cap_jobs = newcap;
+  }
+
+  for (int i = 0; i < npids; i++) {
+    procs[i].pid = pids[i];
+    procs[i].state = PROC_RUNNING;
+  }
+  struct Job *job = &jobs[slot];
+  job->id = id = next_job_id();
+  job->pgid = pgid;
+  job->cmd = cmd_copy;
+  job->cmd_id = cmd_id;
+  job->start_ns = start_ns;
+  job->nprocs = npids;
+  job->procs = procs;
+  job->stop_reported = false;
+  if (slot == njobs) {
+    njobs++;
+  }
+  procs = NULL;
+  cmd_copy = NULL;
+  trace_event("job", "\"job\":%d,\"cmd\":%lu,\"pgid\":%d,\"procs\":%d", id,
+              cmd_id, (int)pgid, npids);
+  if (job_control) {
+    printf("[%d] %d\n", id, (int)pgid);
+    fflush(stdout);
+  }
+
+out:
+  free(procs);
+  free(cmd_copy);
+  /* Children that exited before they were in the table are reaped now */
+  unblock_sigchld();
+  return id;
+}
+
+static enum ProcState job_state(const struct Job *job) {
+  bool stopped = false;
+  for (int p = 0; p < job->nprocs; p++) {
+    if (job->procs[p].state == PROC_RUNNING) {
+      return PROC_RUNNING;
+    }
+    if (job->procs[p].state == PROC_STOPPED) {
+      stopped = true;
+    }
+  }
+  return stopped ? PROC_STOPPED : PROC_DONE;
+}
+
+/* Exit status of a finished job: that of its last failing process */
+static int job_status(const struct Job *job) {
+  int status = 0;
+  for (int p = 0; p < job->nprocs; p++) {
+    int st = job->procs[p].status;
+    int code = WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+    if (code) {
+      status = code;
+    }
+  }
+  return status;
+}
+
+static const char *state_name(enum ProcState state) {
+  return state == PROC_RUNNING   ? "Running"
+         : state == PROC_STOPPED ? "Stopped"
+                                 : "Done";
+}
+
+static void print_job(const struct Job *job) {
+  printf("[%d] %-8s %d\t%s\n", job->id, state_name(job_state(job)),
+         (int)job->pgid, job->cmd);
+}
+
+/* Free a finished job's slot. SIGCHLD must be blocked. */
+static void drop_job(struct Job *job) {
+  for (int p = 0; p < job->nprocs; p++) {
+    trace_child_reaped(job->cmd_id, job->procs[p].pid, job->procs[p].status,
+                       &job->procs[p].ru, job->start_ns);
+    placement_reaped(job->procs[p].pid, &job->procs[p].ru);
+    if (audit_enabled()) {
+      // the processes of a job are only known by the job's command line
+      int st = job->procs[p].status;
+      char *argv[] = {job->cmd, NULL};
+      audit_log(argv, job->procs[p].pid,
+                WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st),
+                job->start_ns);
+    }
+  }
+  free(job->procs);
+  free(job->cmd);
+  job->id = 0;
+  while (njobs > 0 && !jobs[njobs - 1].id) {
+    njobs--;
+  }
+}
+
+void jobs_notify(void) {
+  sigset_t old;
+  block_sigchld(&old);
+  for (int j = 0; j < njobs; j++) {
+    struct Job *job = &jobs[j];
+    if (!job->id) {
+      continue;
+    }
+    enum ProcState state = job_state(job);
+    if (state == PROC_DONE) {
+      if (job_control) {
+        print_job(job);
+      }
+      drop_job(job);
+    } else if (state == PROC_STOPPED && !job->stop_reported) {
+      if (job_control) {
+        print_job(job);
+      }
+      job->stop_reported = true;
+    } else if (state == PROC_RUNNING) {
+      job->stop_reported = false;
+    }
+  }
+  fflush(stdout);
+  sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+/* Find the job named by spec (%N or N), or the most recent job if spec is
+   NULL. SIGCHLD must be blocked. */
+static struct Job *find_job(const char *spec) {
+  if (spec == NULL) {
+    struct Job *newest = NULL;
+    for (int j = 0; j < njobs; j++) {
+      if (jobs[j].id && (!newest || jobs[j].id > newest->id)) {
+        newest = &jobs[j];
+      }
+    }
+    return newest;
+  }
+  if (*spec == '%') {
+    spec++;
+  }
+  char *end;
+  long id = strtol(spec, &end, 10);
+  if (*spec == '\0' || *end != '\0') {
+    return NULL;
+  }
+  for (int j = 0; j < njobs; j++) {
+    if (jobs[j].id && jobs[j].id == id) {
+      return &jobs[j];
+    }
+  }
+  return NULL;
+}
+
+/* Sleep until the job is no longer running. SIGCHLD must be blocked; `old`
+   is the mask to wait with. */
+static void wait_for_job(struct Job *job, const sigset_t *old) {
+  sigset_t wait_mask = *old;
+  sigdelset(&wait_mask, SIGCHLD);
+  while (job_state(job) == PROC_RUNNING) {
+    sigsuspend(&wait_mask);
+  }
+}
+
+static void continue_job(struct Job *job) {
+  for (int p = 0; p < job->nprocs; p++) {
+    if (job->procs[p].state == PROC_STOPPED) {
+      job->procs[p].state = PROC_RUNNING;
+    }
+  }
+  job->stop_reported = false;
+  kill(-job->pgid, SIGCONT);
+}
+
+/* Run the job in the foreground: give it the terminal, wait until it
+   finishes or stops, and take the terminal back */
+static int foreground_job(struct Job *job, const sigset_t *old) {
+  if (job_control) {
+    printf("%s\n", job->cmd);
+    fflush(stdout);
+    tcsetpgrp(STDIN_FILENO, job->pgid);
+  }
+  continue_job(job);
+  wait_for_job(job, old);
+  if (job_control) {
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+  }
+
+  if (job_state(job) == PROC_STOPPED) {
+    if (job_control) {
+      printf("\n");
+      print_job(job);
+    }
+    job->stop_reported = true;
+    return 0;
+  }
+  int status = job_status(job);
+  drop_job(job);
+  return status;
+}
+
+int jobs_builtin(char **args) {
+  const char *name = args[0];
+  const char *spec = args[1];
+  if (spec && args[2]) {
+    return -1;
+  }
+
+  int rc = 0;
+  sigset_t old;
+  block_sigchld(&old);
+  if (!strcmp(name, "jobs")) {
+    if (spec) {
+      rc = -1;
+    }
+    for (int j = 0; rc == 0 && j < njobs; j++) {
+      if (jobs[j].id) {
+        print_job(&jobs[j]);
+        if (job_state(&jobs[j]) == PROC_DONE) {
+          drop_job(&jobs[j]);
+        }
+      }
+    }
+  } else if (!strcmp(name, "wait") && !spec) {
+    for (int j = 0; j < njobs; j++) {
+      if (jobs[j].id) {
+        wait_for_job(&jobs[j], &old);
+        if (job_state(&jobs[j]) == PROC_DONE) {
+          rc = job_status(&jobs[j]);
+          drop_job(&jobs[j]);
+        }
+      }
+    }
+  } else {
+    struct Job *job = find_job(spec);
+    if (job == NULL) {
+      rc = -1;
+    } else if (!strcmp(name, "wait")) {
+      wait_for_job(job, &old);
+      if (job_state(job) == PROC_DONE) {
+        rc = job_status(job);
+        drop_job(job);
+      }
+    } else if (!strcmp(name, "fg")) {
+      rc = foreground_job(job, &old);
+    } else if (!strcmp(name, "bg")) {
+      continue_job(job);
+      if (job_control) {
+        printf("[%d] %s &\n", job->id, job->cmd);
+      }
+    } else {
+      rc = -1;
+    }
+  }
+  fflush(stdout);
+  sigprocmask(SIG_SETMASK, &old, NULL);
+  return rc;
+}
@@ -0,0 +1,58 @@
+#ifndef UTCSH_JOBS_H
+#define UTCSH_JOBS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Set up the job table. Children in the table are reaped by a SIGCHLD
+ * handler as soon as they change state; other children (foreground commands)
+ * are left to whoever waits for them.
+ *
+ * With `job_control` (an interactive shell on a terminal) `fg` hands the
+ * terminal to the job's process group, and the shell reports finished and
+ * stopped jobs before each prompt. Without it jobs run with standard input
+ * from /dev/null and nothing is reported.
+ */
+void jobs_init(bool job_control);
+
+/** Call before forking the processes of a background job. Holds off the
+ * SIGCHLD handler until jobs_add() knows their pids. */
+void jobs_begin_launch(void);
+
+/** In a child forked after jobs_begin_launch(): join process group `pgid`,
+ * or start a new one if it is 0, and undo the shell's signal settings. */
+void jobs_child_setup(pid_t pgid);
+
+/** In any other child the shell forks: undo the shell's signal settings */
+void jobs_reset_child_signals(void);
+
+/**
+ * Record a background job of `npids` processes in process group `pgid` and
+ * let the SIGCHLD handler run again. `cmd` is the command line to show in
+ * `jobs`, without the trailing &. If npids is 0 nothing is recorded.
+ * Returns the job number, or -1 if the job could not be recorded (its
+ * processes still run).
+ */
+int jobs_add(pid_t pgid, const pid_t *pids, int npids, const char *cmd,
+             unsigned long cmd_id, uint64_t start_ns);
+
+/** Drop finished jobs from the table, reporting them and newly stopped jobs
+ * when there is job control. Call before reading each command line. */
+void jobs_notify(void);
+
+/**
+ * The `jobs`, `wait`, `fg` and `bg` builtins. `args` is the NULL-terminated
+ * argv; a job is named as %N or N and defaults to the most recent one.
+ *
+ * jobs        list jobs with their state and process group
+ * wait [%N]   wait until job N (or every job) has finished or stopped
+ * fg [%N]     continue job N in the foreground and wait for it
+ * bg [%N]     continue stopped job N in the background
+ *
+ * Returns the exit status of the job waited for (0 if none) or -1 on error.
+ */
+int jobs_builtin(char **args);
+
+#endif
@@ -0,0 +1,200 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "lexer.h"
+
+#define INITIAL_TOKENS 16
+
+/* Growable token array living in an arena. Growing copies into a fresh block
+   twice the size; the old block is simply abandoned to the arena, so the
+   waste is bounded by the final size and the total work stays linear. */
+struct TokenVec {
+  struct Token *toks;
+  size_t len;
+  size_t cap;
+};
+
+static bool push_token(struct TokenVec *vec, struct Arena *arena,
+                       enum TokenType type, char *text, unsigned flags) {
+  if (vec->len == vec->cap) {
+    size_t newcap = vec->cap ? vec->cap * 2 : INITIAL_TOKENS;
+    struct Token *grown = arena_alloc(arena, newcap * sizeof(struct Token));
+    if (!grown) {
+      return false;
+    }
+    if (vec->len) {
+      memcpy(grown, vec->toks, vec->len * sizeof(struct Token));
+    }
+    vec->toks = grown;
+    vec->cap = newcap;
+  }
+  vec->toks[vec->len].type = type;
+  vec->toks[vec->len].text = text;
+  vec->toks[vec->len].flags = flags;
+  vec->len++;
+  return true;
+}
+
+static bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\n'; }
+
+static bool is_operator(char c) { return c == '>' || c == '<' || c == '&'; }
+
+/* 2> and 2>&1 are operators only where a word would start */
+static bool is_err_operator(const char *r) { return r[0] == '2' && r[1] == '>'; }
+
+/* Find the ) closing a process substitution whose cmd starts at s, skipping
+   nested parentheses and quoted or escaped characters. Returns NULL if the
+   substitution is never closed. */
+static char *find_closing_paren(char *s) {
+  int depth = 0;
+  for (; *s; s++) {
+    if (*s == '\\' && s[1]) {
+      s++;
+    } else if (*s == '\'' || *s == '"') {
+      char quote = *s;
+      while (*++s && *s != quote) {
+        if (quote == '"' && *s == '\\' && s[1]) {
+          s++;
+        }
+      }
+      if (!*s) {
+        return NULL;
+      }
+    } else if (*s == '(') {
+      depth++;
+    } else if (*s == ')' && depth-- == 0) {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+/* Emit the operator at *rp and move *rp past it. Its first character is
+   passed separately because the word before it may have overwritten it
+   with its terminator; the rest of it is intact. */
+static bool push_operator(struct TokenVec *vec, struct Arena *arena,
+                          char first, char **rp) {
+  char *r = *rp;
+  if ((first == '<' || first == '>') && r[1] == '(') {
+    char *close = find_closing_paren(r + 2);
+    if (close == NULL) {
+      return false;
+    }
+    *close = '\0';
+    *rp = close + 1;
+    return push_token(vec, arena,
+                      first == '<' ? TOK_PROCSUB_IN : TOK_PROCSUB_OUT, r + 2, 0);
+  }
+
+  enum TokenType type;
+  char *text;
+  if (first == '&') {
+    type = TOK_AMP;
+    text = "&";
+  } else if (first == '<') {
+    type = TOK_INPUT;
+    text = "<";
+  } else if (first == '2' && r[2] == '&' && r[3] == '1') {
+    type = TOK_ERR_TO_OUT;
+    text = "2>&1";
+  } else if (first == '2') {
+    type = TOK_ERR_REDIRECT;
+    text = "2>";
+  } else if (r[1] == '>') {
+    type = TOK_APPEND;
+    text = ">>";
+  } else {
+    type = TOK_REDIRECT;
+    text = ">";
+  }
+  *rp = r + strlen(text);
+  return push_token(vec, arena, type, text, 0);
+}
+
+struct Token *lex_command_line(char *line, struct Arena *arena,
+                               size_t *ntokens) {
+  struct TokenVec vec = {NULL, 0, 0};
+  char *r = line; /* Next character to read */
+  char *w = line; /* Next character to write; never ahead of r */
+
+  while (*r) {
+    if (is_blank(*r)) {
+      r++;
+      continue;
+    }
+
+    if (is_operator(*r) || is_err_operator(r)) {
+      if (!push_operator(&vec, arena, *r, &r)) {
+        return NULL;
+      }
+      w = r; /* Never write over the text of a process substitution */
+      continue;
+    }
+
+    /* Start of a word: copy it down to w, dropping quotes and escapes */
+    char *word = w;
+    unsigned flags = 0;
+    while (*r && !is_blank(*r) && !is_operator(*r)) {
+      if (*r == '\'') {
+        flags |= TOKEN_QUOTED;
+        r++;
+        while (*r && *r != '\'') {
+          *w++ = *r++;
+        }
+        if (!*r) {
+          return NULL; /* Unterminated single quote */
+        }
+        r++;
+      } else if (*r == '"') {
+        flags |= TOKEN_QUOTED;
+        r++;
+        while (*r && *r != '"') {
+          if (*r == '\\' && (r[1] == '"' || r[1] == '\\')) {
+            r++;
+          }
+          *w++ = *r++;
+        }
+        if (!*r) {
+          return NULL; /* Unterminated double quote */
+        }
+        r++;
+      } else if (*r == '\\') {
+        flags |= TOKEN_QUOTED;
+        r++;
+        if (*r == '\n') {
+          r++; /* Line continuation */
+        } else if (*r) {
+          *w++ = *r++;
+        }
+      } else {
+        *w++ = *r++;
+      }
+    }
+
+    /* The terminator may land on the character at r (when nothing was
+       dropped from this word), so look at it before overwriting it. */
+    char next = *r;
+    *w = '\0';
+    if (!push_token(&vec, arena, TOK_WORD, word, flags)) {
+      return NULL;
+    }
+    if (next && w == r) {
+      /* We just clobbered a blank or an operator. Blanks need no further
+         handling; an operator still has to be emitted. */
+      if (!is_operator(next)) {
+        r++;
+      } else if (!push_operator(&vec, arena, next, &r)) {
+        return NULL;
+      }
+    }
+    w = r;
+  }
+
+  if (!push_token(&vec, arena, TOK_END, NULL, 0)) {
+    return NULL;
+  }
+  if (ntokens) {
+    *ntokens = vec.len - 1;
+  }
+  return vec.toks;
+}
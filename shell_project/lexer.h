@@ -0,0 +1,58 @@
+#ifndef UTCSH_LEXER_H
+#define UTCSH_LEXER_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+enum TokenType {
+  TOK_END,          /* Terminates a token array */
+  TOK_WORD,         /* A command name, argument or file name */
+  TOK_REDIRECT,     /* > */
+  TOK_AMP,          /* & */
+  TOK_APPEND,       /* >> */
+  TOK_INPUT,        /* < */
+  TOK_ERR_REDIRECT, /* 2> */
+  TOK_ERR_TO_OUT,   /* 2>&1 */
+  TOK_PROCSUB_IN,   /* <(cmd), whose output the command reads */
+  TOK_PROCSUB_OUT,  /* >(cmd), which reads what the command writes */
+};
+
+/* Set in Token.flags when part of a word was quoted or escaped */
+#define TOKEN_QUOTED 0x1
+
+struct Token {
+  char *text; /* Word text for TOK_WORD, the unlexed cmd of a process
+                 substitution, operator spelling otherwise */
+  enum TokenType type;
+  unsigned flags;
+};
+
+/**
+ * Split a command line into tokens in a single left-to-right pass.
+ *
+ * Words are separated by blanks (space, tab, newline) and by the operators
+ * `>`, `>>`, `<` and `&`, which become tokens of their own, as do `2>` and
+ * `2>&1` at the start of a word. Inside a word, '...' quotes everything
+ * literally, "..." quotes everything except \" and \\, and a backslash
+ * outside quotes escapes the next character. Quote characters and escaping
+ * backslashes are removed.
+ *
+ * `<(cmd)` and `>(cmd)` become a single process substitution token whose
+ * text is cmd, left as it was (quotes included) so it can be lexed again
+ * when it runs. Parentheses nest, and quoted ones do not count.
+ *
+ * The line is rewritten in place: word texts point into `line`, which must
+ * stay alive as long as the tokens do. The token array itself comes from
+ * `arena` and is terminated by a TOK_END token. There is no limit on the
+ * length of the line or on the number of tokens.
+ *
+ * On success returns the token array and stores the number of tokens
+ * (excluding TOK_END) in *ntokens if it is not NULL. Returns NULL if a quote
+ * or process substitution is left unterminated or if the arena runs out of
+ * memory.
+ */
+struct Token *lex_command_line(char *line, struct Arena *arena,
+                               size_t *ntokens);
+
+#endif
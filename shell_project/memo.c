@@ -0,0 +1,402 @@
+#define _GNU_SOURCE /* O_TMPFILE, mkostemp */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memo.h"
+
+#define MEMO_MAGIC "utcsmemo"
+
+/* Every cache entry is one file named by its key: this header, then the
+   command's standard output, then its standard error */
+struct EntryHeader {
+  char magic[8];
+  int32_t status;
+  uint32_t unused;
+  uint64_t out_len;
+  uint64_t err_len;
+};
+
+typedef unsigned __int128 u128;
+
+/* 128-bit FNV-1a */
+#define FNV128_OFFSET                                                          \
+  ((u128)0x6c62272e07bb0142ull << 64 | 0x62b821756295c58dull)
+#define FNV128_PRIME ((u128)0x0000000001000000ull << 64 | 0x000000000000013bull)
+
+static char cache_dir[4096];
+
+static void hash_bytes(u128 *h, const void *data, size_t n) {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < n; i++) {
+    *h ^= p[i];
+    *h *= FNV128_PRIME;
+  }
+}
+
+/* Hash a length and then the bytes, so fields cannot run into each other */
+static void hash_field(u128 *h, const char *s) {
+  size_t n = strlen(s);
+  hash_bytes(h, &n, sizeof(n));
+  hash_bytes(h, s, n);
+}
+
+static int hash_identity(u128 *h, const char *path) {
+  struct stat st;
+  if (stat(path, &st) < 0) {
+    return -1;
+  }
+  uint64_t id[5] = {st.st_dev, st.st_ino, st.st_size, st.st_mtim.tv_sec,
+                    st.st_mtim.tv_nsec};
+  hash_bytes(h, id, sizeof(id));
+  return 0;
+}
+
+/* One round of xxHash64, used to digest file contents: byte-at-a-time FNV
+   manages only about 400 MB/s */
+static uint64_t content_round(uint64_t acc, uint64_t word) {
+  acc += word * 0xc2b2ae3d27d4eb4full;
+  acc = (acc << 31) | (acc >> 33);
+  return acc * 0x9e3779b185ebca87ull;
+}
+
+/* Read until `buf` is full or the file ends */
+static ssize_t read_full(int fd, void *buf, size_t size) {
+  size_t got = 0;
+  while (got < size) {
+    ssize_t n = read(fd, (char *)buf + got, size - got);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    got += n;
+  }
+  return got;
+}
+
+static int hash_content(u128 *h, const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  /* Four independent lanes over 32-byte stripes. The buffer is always
+     filled, so only the last one can end in a partial word. */
+  uint64_t lanes[4] = {1, 2, 3, 4};
+  uint64_t buf[8 * 1024];
+  uint64_t total = 0;
+  ssize_t n;
+  while ((n = read_full(fd, buf, sizeof(buf))) > 0) {
+    total += n;
+    size_t words = n / 8;
+    for (size_t i = 0; i < words; i++) {
+      lanes[i % 4] = content_round(lanes[i % 4], buf[i]);
+    }
+    if (n % 8) {
+      uint64_t tail = 0;
+      memcpy(&tail, (char *)buf + words * 8, n % 8);
+      lanes[0] = content_round(lanes[0], tail);
+    }
+  }
+  close(fd);
+  hash_bytes(h, &total, sizeof(total));
+  hash_bytes(h, lanes, sizeof(lanes));
+  return n < 0 ? -1 : 0;
+}
+
+int memo_key(char *const *argv, const char *exe, const struct MemoInput *inputs,
+             int ninputs, char *key) {
+  u128 h = FNV128_OFFSET;
+  hash_field(&h, "utcsh-memo-1");
+  char *cwd = getcwd(NULL, 0);
+  if (cwd == NULL) {
+    return -1;
+  }
+  hash_field(&h, cwd);
+  free(cwd);
+
+  hash_field(&h, exe);
+  if (hash_identity(&h, exe) < 0) {
+    return -1;
+  }
+  for (int i = 0; argv[i] != NULL; i++) {
+    hash_field(&h, argv[i]);
+  }
+  for (int i = 0; i < ninputs; i++) {
+    hash_field(&h, inputs[i].path);
+    hash_bytes(&h, &inputs[i].by_content, sizeof(inputs[i].by_content));
+    int rc = inputs[i].by_content ? hash_content(&h, inputs[i].path)
+                                  : hash_identity(&h, inputs[i].path);
+    if (rc < 0) {
+      return -1;
+    }
+  }
+  snprintf(key, MEMO_KEY_LEN + 1, "%016llx%016llx",
+           (unsigned long long)(h >> 64), (unsigned long long)h);
+  return 0;
+}
+
+/* The cache directory, created on first use. Returns NULL if there is none. */
+static const char *memo_dir(void) {
+  if (cache_dir[0]) {
+    return cache_dir;
+  }
+  const char *env = getenv(MEMO_DIR_ENV_NAME);
+  const char *home = getenv("HOME");
+  int n = env && *env ? snprintf(cache_dir, sizeof(cache_dir), "%s", env)
+          : home      ? snprintf(cache_dir, sizeof(cache_dir), "%s/%s", home,
+                                 MEMO_DEFAULT_DIR)
+                      : -1;
+  if (n <= 0 || (size_t)n >= sizeof(cache_dir)) {
+    cache_dir[0] = '\0';
+    return NULL;
+  }
+  /* mkdir -p */
+  for (char *p = cache_dir + 1;; p++) {
+    if (*p == '/' || *p == '\0') {
+      char c = *p;
+      *p = '\0';
+      int rc = mkdir(cache_dir, 0700);
+      *p = c;
+      if (rc < 0 && errno != EEXIST) {
+        cache_dir[0] = '\0';
+        return NULL;
+      }
+      if (c == '\0') {
+        break;
+      }
+    }
+  }
+  return cache_dir;
+}
+
+static uint64_t memo_max(void) {
+  const char *env = getenv(MEMO_MAX_ENV_NAME);
+  return env && *env ? strtoull(env, NULL, 10) : MEMO_DEFAULT_MAX;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* Copy `len` bytes at offset `off` of `from` to the current position of
+   `to`, with sendfile() where the kernel allows it */
+static int copy_range(int from, off_t off, uint64_t len, int to) {
+  while (len > 0) {
+    ssize_t n = sendfile(to, from, &off, len < (1u << 30) ? len : (1u << 30));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+      break; /* e.g. `to` is in append mode */
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    len -= n;
+  }
+  char buf[64 * 1024];
+  while (len > 0) {
+    ssize_t n = pread(from, buf, len < sizeof(buf) ? len : sizeof(buf), off);
+    if (n <= 0 || write_all(to, buf, n) < 0) {
+      return -1;
+    }
+    off += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* Mark an entry as just used. The mtime of an entry is when it was last used,
+   for eviction; the clock is read here because file timestamps only move
+   once per tick. */
+static void touch_entry(int fd) {
+  struct timespec now[2];
+  clock_gettime(CLOCK_REALTIME, &now[0]);
+  now[1] = now[0];
+  futimens(fd, now);
+}
+
+static int replay_entry(int fd, const struct EntryHeader *hdr, int out_fd,
+                        int err_fd) {
+  off_t off = sizeof(*hdr);
+  if (copy_range(fd, off, hdr->out_len, out_fd) < 0 ||
+      copy_range(fd, off + hdr->out_len, hdr->err_len, err_fd) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+int memo_replay(const char *key, int out_fd, int err_fd, int *status) {
+  const char *dir = memo_dir();
+  if (dir == NULL) {
+    return -1;
+  }
+  char path[sizeof(cache_dir) + MEMO_KEY_LEN + 2];
+  snprintf(path, sizeof(path), "%s/%s", dir, key);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return errno == ENOENT ? 0 : -1;
+  }
+
+  struct EntryHeader hdr;
+  struct stat st;
+  if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || fstat(fd, &st) < 0 ||
+      memcmp(hdr.magic, MEMO_MAGIC, sizeof(hdr.magic)) ||
+      (uint64_t)st.st_size != sizeof(hdr) + hdr.out_len + hdr.err_len) {
+    close(fd);
+    return 0; /* Not an entry we wrote: run the command again */
+  }
+  touch_entry(fd);
+  int rc = replay_entry(fd, &hdr, out_fd, err_fd);
+  close(fd);
+  *status = hdr.status;
+  return rc < 0 ? -1 : 1;
+}
+
+int memo_begin(struct MemoRecording *rec) {
+  rec->entry_fd = rec->err_fd = -1;
+  const char *dir = memo_dir();
+  if (dir == NULL) {
+    return -1;
+  }
+  snprintf(rec->tmp_path, sizeof(rec->tmp_path), "%s/tmp.XXXXXX", dir);
+  rec->entry_fd = mkostemp(rec->tmp_path, O_CLOEXEC);
+  if (rec->entry_fd < 0) {
+    return -1;
+  }
+  rec->err_fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  /* Leave room for the header, which is written last */
+  if (rec->err_fd < 0 ||
+      ftruncate(rec->entry_fd, sizeof(struct EntryHeader)) < 0 ||
+      lseek(rec->entry_fd, 0, SEEK_END) < 0) {
+    unlink(rec->tmp_path);
+    close(rec->entry_fd);
+    if (rec->err_fd >= 0) {
+      close(rec->err_fd);
+    }
+    return -1;
+  }
+  return 0;
+}
+
+struct EvictEntry {
+  char name[MEMO_KEY_LEN + 1];
+  uint64_t size;
+  struct timespec used;
+};
+
+static int compare_used(const void *a, const void *b) {
+  const struct timespec *x = &((const struct EvictEntry *)a)->used;
+  const struct timespec *y = &((const struct EvictEntry *)b)->used;
+  if (x->tv_sec != y->tv_sec) {
+    return x->tv_sec < y->tv_sec ? -1 : 1;
+  }
+  return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+/* Remove the least recently used entries until the cache fits its limit */
+static void evict(const char *dir) {
+  DIR *d = opendir(dir);
+  if (d == NULL) {
+    return;
+  }
+  struct EvictEntry *entries = NULL;
+  size_t n = 0, cap = 0;
+  uint64_t total = 0;
+  struct dirent *de;
+  while ((de = readdir(d)) != NULL) {
+    struct stat st;
+    if (strlen(de->d_name) != MEMO_KEY_LEN ||
+        fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+        !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    if (n == cap) {
+      size_t newcap = cap ? cap * 2 : 64;
+      struct EvictEntry *grown = realloc(entries, newcap * sizeof(*grown));
+      if (grown == NULL) {
+        break;
+      }
+      entries = grown;
+      cap = newcap;
+    }
+    memcpy(entries[n].name, de->d_name, MEMO_KEY_LEN + 1);
+    entries[n].size = st.st_size;
+    entries[n].used = st.st_mtim;
+    total += st.st_size;
+    n++;
+  }
+
+  uint64_t max = memo_max();
+  if (total > max) {
+    qsort(entries, n, sizeof(*entries), compare_used);
+    for (size_t i = 0; i < n && total > max; i++) {
+      if (unlinkat(dirfd(d), entries[i].name, 0) == 0) {
+        total -= entries[i].size;
+      }
+    }
+  }
+  closedir(d);
+  free(entries);
+}
+
+int memo_finish(struct MemoRecording *rec, const char *key, int status,
+                int out_fd, int err_fd) {
+  struct EntryHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, MEMO_MAGIC, sizeof(hdr.magic));
+  hdr.status = status;
+
+  off_t out_end = lseek(rec->entry_fd, 0, SEEK_END);
+  off_t err_len = lseek(rec->err_fd, 0, SEEK_END);
+  int rc = out_end >= (off_t)sizeof(hdr) && err_len >= 0 ? 0 : -1;
+  if (rc == 0) {
+    hdr.out_len = out_end - sizeof(hdr);
+    hdr.err_len = err_len;
+    /* Show the output first, even if it cannot be stored */
+    if (copy_range(rec->entry_fd, sizeof(hdr), hdr.out_len, out_fd) < 0 ||
+        copy_range(rec->err_fd, 0, err_len, err_fd) < 0) {
+      rc = -1;
+    }
+  }
+  if (rc == 0 && key != NULL &&
+      (copy_range(rec->err_fd, 0, err_len, rec->entry_fd) < 0 ||
+       pwrite(rec->entry_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))) {
+    rc = -1;
+  }
+  touch_entry(rec->entry_fd);
+  close(rec->entry_fd);
+  close(rec->err_fd);
+
+  char path[sizeof(cache_dir) + MEMO_KEY_LEN + 2];
+  snprintf(path, sizeof(path), "%s/%s", cache_dir, key ? key : "");
+  if (rc < 0 || key == NULL || rename(rec->tmp_path, path) < 0) {
+    unlink(rec->tmp_path);
+    return key == NULL ? rc : -1;
+  }
+  evict(cache_dir);
+  return 0;
+}
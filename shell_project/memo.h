@@ -0,0 +1,65 @@
+#ifndef UTCSH_MEMO_H
+#define UTCSH_MEMO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Environment variables for the result cache of the `memo` builtin: the
+   cache directory (default ~/.cache/utcsh/memo) and its size limit in bytes */
+#define MEMO_DIR_ENV_NAME "UTCSH_MEMO_DIR"
+#define MEMO_MAX_ENV_NAME "UTCSH_MEMO_MAX"
+#define MEMO_DEFAULT_DIR ".cache/utcsh/memo"
+#define MEMO_DEFAULT_MAX (64ull << 20)
+
+/* Hex digits in a cache key */
+#define MEMO_KEY_LEN 32
+
+/* A file the result of a command depends on */
+struct MemoInput {
+  const char *path;
+  bool by_content; /* Hash the bytes, not just inode, size and mtime */
+};
+
+/* A command result being recorded into the cache */
+struct MemoRecording {
+  int entry_fd; /* Standard output goes here, after room for the header */
+  int err_fd;   /* Standard error, copied in after the command finishes */
+  char tmp_path[4096];
+};
+
+/**
+ * Compute the cache key of running `exe` (the resolved executable) with
+ * `argv` in the current directory, given `ninputs` declared inputs. The key
+ * covers the argv, the working directory, the identity (device, inode, size
+ * and mtime) of the executable and of every input, and the contents of inputs
+ * marked by_content. Writes MEMO_KEY_LEN hex digits and a NUL to `key`.
+ * Returns 0 on success, -1 if the executable or an input cannot be read.
+ */
+int memo_key(char *const *argv, const char *exe, const struct MemoInput *inputs,
+             int ninputs, char *key);
+
+/**
+ * Look the key up. On a hit the cached standard output and standard error
+ * are written to `out_fd` and `err_fd`, the exit status is stored in
+ * *status, the entry becomes the most recently used one and 1 is returned.
+ * Returns 0 on a miss and -1 on error.
+ */
+int memo_replay(const char *key, int out_fd, int err_fd, int *status);
+
+/** Start recording a result: opens rec->entry_fd and rec->err_fd, which the
+ * command should get as its standard output and error. Returns 0 on success
+ * and -1 on error. */
+int memo_begin(struct MemoRecording *rec);
+
+/**
+ * Finish a recording made with memo_begin(): store it under `key` with exit
+ * status `status` (nothing is stored if `key` is NULL, e.g. because the
+ * command was killed), write the captured output to `out_fd` and `err_fd`,
+ * and evict the least recently used entries until the cache is within its
+ * size limit. Returns 0 on success and -1 on error; the recording is
+ * released either way.
+ */
+int memo_finish(struct MemoRecording *rec, const char *key, int status,
+                int out_fd, int err_fd);
+
+#endif
@@ -0,0 +1,131 @@
+#include "parse.h"
+
+static int ends_command(enum TokenType type) {
+  return type == TOK_END || type == TOK_AMP;
+}
+
+/* Tokens that can be an argument or a redirect target */
+static int is_word(enum TokenType type) {
+  return type == TOK_WORD || type == TOK_PROCSUB_IN || type == TOK_PROCSUB_OUT;
+}
+
+enum ParseError parse_command(const struct Token *tokens, struct Arena *arena,
+                              struct Command *cmd) {
+  *cmd = (struct Command){0};
+
+  size_t ntokens = 0;
+  int nprocsubs = 0;
+  while (!ends_command(tokens[ntokens].type)) {
+    if (tokens[ntokens].type == TOK_PROCSUB_IN ||
+        tokens[ntokens].type == TOK_PROCSUB_OUT) {
+      nprocsubs++;
+    }
+    ntokens++;
+  }
+  char **args = arena_alloc(arena, (ntokens + 1) * sizeof(char *));
+  struct ProcSub *procsubs = NULL;
+  if (nprocsubs > 0) {
+    procsubs = arena_alloc(arena, nprocsubs * sizeof(struct ProcSub));
+  }
+  if (args == NULL || (nprocsubs > 0 && procsubs == NULL)) {
+    return PARSE_NO_MEMORY;
+  }
+
+  size_t nargs = 0;
+  char *input = NULL;
+  char *output = NULL;
+  char *error = NULL;
+  bool append = false;
+  bool error_to_output = false;
+  bool redirected = false;
+  nprocsubs = 0;
+  for (size_t i = 0; i < ntokens; i++) {
+    enum TokenType type = tokens[i].type;
+    char **slot; /* Where the word ends up in *cmd */
+    if (is_word(type)) {
+      if (redirected) {
+        return PARSE_TRAILING_WORD;
+      }
+      slot = &args[nargs];
+      args[nargs++] = tokens[i].text;
+    } else if (type == TOK_ERR_TO_OUT) {
+      if (error != NULL || error_to_output) {
+        return PARSE_MULTIPLE_REDIRECTS;
+      }
+      redirected = true;
+      error_to_output = true;
+      continue;
+    } else {
+      redirected = true;
+      // exactly one file name must follow the arrow
+      if (i + 1 >= ntokens || !is_word(tokens[i + 1].type)) {
+        return PARSE_MISSING_TARGET;
+      }
+      char **target;
+      if (type == TOK_INPUT) {
+        target = &input;
+        slot = &cmd->inputFile;
+      } else if (type == TOK_ERR_REDIRECT) {
+        target = &error;
+        slot = &cmd->errorFile;
+      } else {
+        target = &output;
+        slot = &cmd->outputFile;
+        append = type == TOK_APPEND;
+      }
+      if (*target != NULL || (target == &error && error_to_output)) {
+        return PARSE_MULTIPLE_REDIRECTS;
+      }
+      *target = tokens[++i].text;
+      type = tokens[i].type;
+    }
+    if (type == TOK_PROCSUB_IN || type == TOK_PROCSUB_OUT) {
+      procsubs[nprocsubs++] = (struct ProcSub){
+          .cmdline = tokens[i].text,
+          .is_output = type == TOK_PROCSUB_OUT,
+          .slot = slot,
+          .pid = -1,
+          .fd = -1,
+      };
+    }
+  }
+  args[nargs] = NULL;
+
+  if (redirected && nargs == 0) {
+    return PARSE_NO_COMMAND;
+  }
+  cmd->args = args;
+  cmd->inputFile = input;
+  cmd->outputFile = output;
+  cmd->errorFile = error;
+  cmd->appendOutput = append;
+  cmd->errorToOutput = error_to_output;
+  cmd->procsubs = procsubs;
+  cmd->nprocsubs = nprocsubs;
+  return PARSE_OK;
+}
+
+const struct Token *next_command(const struct Token *tokens) {
+  while (!ends_command(tokens->type)) {
+    tokens++;
+  }
+  return tokens->type == TOK_AMP ? tokens + 1 : NULL;
+}
+
+const char *parse_error_string(enum ParseError err) {
+  switch (err) {
+  case PARSE_OK:
+    return "ok";
+  case PARSE_NO_MEMORY:
+    return "out of memory";
+  case PARSE_MISSING_TARGET:
+    return "missing redirect target";
+  case PARSE_TRAILING_WORD:
+    return "word after redirect target";
+  case PARSE_MULTIPLE_REDIRECTS:
+    return "multiple redirects";
+  case PARSE_NO_COMMAND:
+    return "redirect without a command";
+  }
+  return "unknown error";
+}
@@ -0,0 +1,68 @@
+#ifndef UTCSH_PARSE_H
+#define UTCSH_PARSE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "arena.h"
+#include "lexer.h"
+
+/* A process substitution, <(cmd) or >(cmd). It runs alongside the command
+ * and is connected to it by a pipe, which the command opens as /dev/fd/N. */
+struct ProcSub {
+  char *cmdline;  /* cmd, to be lexed when it runs */
+  bool is_output; /* >(cmd): cmd reads what the command writes */
+  char **slot;    /* The argument or redirect target that names the pipe */
+  pid_t pid;      /* Set while it runs (see redirect.h), -1 otherwise */
+  int fd;         /* The command's end of the pipe while it runs */
+};
+
+/* Convenience struct for describing a command. Modify this struct as you see
+ * fit--add extra members to help you write your code. */
+struct Command {
+  char **args;      /* Argument array for the command */
+  char *inputFile;  /* < target (NULL means no redirect) */
+  char *outputFile; /* > or >> target (NULL means no redirect) */
+  char *errorFile;  /* 2> target (NULL means no redirect) */
+  bool appendOutput;  /* outputFile came from >> */
+  bool errorToOutput; /* 2>&1 */
+  struct ProcSub *procsubs;
+  int nprocsubs;
+};
+
+enum ParseError {
+  PARSE_OK,
+  PARSE_NO_MEMORY,
+  PARSE_MISSING_TARGET,     /* A redirect not followed by a file name */
+  PARSE_TRAILING_WORD,      /* A word after a redirect target */
+  PARSE_MULTIPLE_REDIRECTS, /* Two redirects of the same stream */
+  PARSE_NO_COMMAND,         /* A redirect with no command before it */
+};
+
+/**
+ * Turn the tokens of one command into a struct Command.
+ *
+ * The command ends at the first TOK_END or TOK_AMP. Its argument array is
+ * NULL-terminated and comes from `arena`; the strings are the token texts.
+ * An empty command parses to an empty argument array.
+ *
+ * Redirects follow the arguments, at most one per stream: < FILE for
+ * standard input, > FILE or >> FILE for standard output, and 2> FILE or
+ * 2>&1 for standard error. A process substitution can stand for an argument
+ * or a redirect target; until it runs, that slot holds its cmd.
+ *
+ * Returns PARSE_OK and fills in *cmd, or returns the error and leaves *cmd
+ * zeroed. Nothing is printed and the process never exits, so the
+ * parser can be fuzzed and benchmarked in-process.
+ */
+enum ParseError parse_command(const struct Token *tokens, struct Arena *arena,
+                              struct Command *cmd);
+
+/** The tokens of the command after the one starting at `tokens`, or NULL if
+ * that was the last command on the line */
+const struct Token *next_command(const struct Token *tokens);
+
+/** A short description of a parse error, for traces */
+const char *parse_error_string(enum ParseError err);
+
+#endif
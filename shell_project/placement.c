@@ -0,0 +1,273 @@
+#define _GNU_SOURCE /* cpu_set_t and sched_setaffinity() */
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "placement.h"
+
+enum PlaceMode { PLACE_OFF, PLACE_SPREAD, PLACE_PIN };
+
+/* ioprio_set(2) has no glibc wrapper; see linux/ioprio.h */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+enum { IOPRIO_CLASS_RT = 1, IOPRIO_CLASS_BE = 2, IOPRIO_CLASS_IDLE = 3 };
+
+static enum PlaceMode mode;
+static cpu_set_t cpus;     /* The CPUs of the policy */
+static int spread[CPU_SETSIZE]; /* The same CPUs in order, for PLACE_SPREAD */
+static int nspread;
+static unsigned next_slot;
+
+static bool set_nice;
+static int nice_value;
+static int ioprio = -1; /* ioprio_set() value, or -1 to leave it alone */
+static bool report;
+
+/* Children forked while reporting was on, with the CPUs they were given */
+struct Placed {
+  pid_t pid;
+  char where[32];
+};
+static struct Placed *placed;
+static int nplaced;
+static int cap_placed;
+
+/* Parse a list such as 0-3,6 into `set`. Every CPU must be one the shell may
+   run on. Returns 0 on success, -1 otherwise. */
+static int parse_cpus(const char *s, cpu_set_t *set) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+    return -1;
+  }
+  CPU_ZERO(set);
+  for (;;) {
+    char *end;
+    errno = 0;
+    long lo = strtol(s, &end, 10);
+    long hi = lo;
+    if (end == s || errno) {
+      return -1;
+    }
+    if (*end == '-') {
+      s = end + 1;
+      hi = strtol(s, &end, 10);
+      if (end == s || errno) {
+        return -1;
+      }
+    }
+    if (lo < 0 || hi < lo || hi >= CPU_SETSIZE) {
+      return -1;
+    }
+    for (long cpu = lo; cpu <= hi; cpu++) {
+      if (!CPU_ISSET(cpu, &allowed)) {
+        return -1;
+      }
+      CPU_SET(cpu, set);
+    }
+    if (*end == '\0') {
+      return 0;
+    }
+    if (*end != ',') {
+      return -1;
+    }
+    s = end + 1;
+  }
+}
+
+/* Write `set` as a list such as 0-3,6 */
+static void format_cpus(const cpu_set_t *set, char *buf, size_t size) {
+  size_t len = 0;
+  buf[0] = '\0';
+  for (int cpu = 0; cpu < CPU_SETSIZE && len < size; cpu++) {
+    if (!CPU_ISSET(cpu, set)) {
+      continue;
+    }
+    int last = cpu;
+    while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) {
+      last++;
+    }
+    len += snprintf(buf + len, size - len, last > cpu ? "%s%d-%d" : "%s%d",
+                    len ? "," : "", cpu, last);
+    cpu = last;
+  }
+}
+
+static int parse_ioprio(const char *s) {
+  if (!strcmp(s, "idle")) {
+    return IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+  }
+  int class;
+  if (!strncmp(s, "be:", 3)) {
+    class = IOPRIO_CLASS_BE;
+  } else if (!strncmp(s, "rt:", 3)) {
+    class = IOPRIO_CLASS_RT;
+  } else {
+    return -1;
+  }
+  if (s[3] < '0' || s[3] > '7' || s[4] != '\0') {
+    return -1;
+  }
+  return class << IOPRIO_CLASS_SHIFT | (s[3] - '0');
+}
+
+static void print_policy(FILE *out) {
+  char list[256];
+  format_cpus(&cpus, list, sizeof(list));
+  if (mode == PLACE_OFF) {
+    fprintf(out, "cpus: off\n");
+  } else {
+    fprintf(out, "cpus: %s %s\n", mode == PLACE_SPREAD ? "spread" : "pin", list);
+  }
+  if (set_nice) {
+    fprintf(out, "nice: %d\n", nice_value);
+  } else {
+    fprintf(out, "nice: off\n");
+  }
+  if (ioprio < 0) {
+    fprintf(out, "ioprio: off\n");
+  } else if (ioprio >> IOPRIO_CLASS_SHIFT == IOPRIO_CLASS_IDLE) {
+    fprintf(out, "ioprio: idle\n");
+  } else {
+    fprintf(out, "ioprio: %s:%d\n",
+            ioprio >> IOPRIO_CLASS_SHIFT == IOPRIO_CLASS_RT ? "rt" : "be",
+            ioprio & ((1 << IOPRIO_CLASS_SHIFT) - 1));
+  }
+  fprintf(out, "report: %s\n", report ? "on" : "off");
+}
+
+int placement_builtin(char **args, FILE *out) {
+  const char *sub = args[1];
+  if (sub == NULL) {
+    print_policy(out);
+    return 0;
+  }
+  const char *arg = args[2];
+  if (arg != NULL && args[3] != NULL) {
+    return -1;
+  }
+
+  if (!strcmp(sub, "spread") || !strcmp(sub, "pin")) {
+    cpu_set_t set;
+    if (arg != NULL) {
+      if (parse_cpus(arg, &set) < 0) {
+        return -1;
+      }
+    } else if (!strcmp(sub, "pin") ||
+               sched_getaffinity(0, sizeof(set), &set) < 0) {
+      return -1;
+    }
+    cpus = set;
+    mode = !strcmp(sub, "pin") ? PLACE_PIN : PLACE_SPREAD;
+    nspread = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &cpus)) {
+        spread[nspread++] = cpu;
+      }
+    }
+    next_slot = 0;
+  } else if (!strcmp(sub, "off") && arg == NULL) {
+    mode = PLACE_OFF;
+    CPU_ZERO(&cpus);
+  } else if (!strcmp(sub, "nice") && arg != NULL) {
+    if (!strcmp(arg, "off")) {
+      set_nice = false;
+      return 0;
+    }
+    char *end;
+    errno = 0;
+    long n = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno || n < -20 || n > 19) {
+      return -1;
+    }
+    set_nice = true;
+    nice_value = (int)n;
+  } else if (!strcmp(sub, "ioprio") && arg != NULL) {
+    if (!strcmp(arg, "off")) {
+      ioprio = -1;
+      return 0;
+    }
+    int value = parse_ioprio(arg);
+    if (value < 0) {
+      return -1;
+    }
+    ioprio = value;
+  } else if (!strcmp(sub, "report") && arg != NULL &&
+             (!strcmp(arg, "on") || !strcmp(arg, "off"))) {
+    report = !strcmp(arg, "on");
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+unsigned placement_claim(void) {
+  return next_slot++;
+}
+
+void placement_forked(pid_t pid, unsigned slot) {
+  if (!report) {
+    return;
+  }
+  if (nplaced == cap_placed) {
+    int cap = cap_placed ? cap_placed * 2 : 16;
+    struct Placed *grown = realloc(placed, cap * sizeof(*grown));
+    if (grown == NULL) {
+      return; /* This child just goes unreported */
+    }
+    placed = grown;
+    cap_placed = cap;
+  }
+  struct Placed *p = &placed[nplaced++];
+  p->pid = pid;
+  if (mode == PLACE_SPREAD) {
+    snprintf(p->where, sizeof(p->where), "%d", spread[slot % nspread]);
+  } else if (mode == PLACE_PIN) {
+    format_cpus(&cpus, p->where, sizeof(p->where));
+  } else {
+    strcpy(p->where, "any");
+  }
+}
+
+int placement_apply(unsigned slot) {
+  int rc = 0;
+  if (mode != PLACE_OFF) {
+    cpu_set_t set = cpus;
+    if (mode == PLACE_SPREAD) {
+      CPU_ZERO(&set);
+      CPU_SET(spread[slot % nspread], &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+      rc = -1;
+    }
+  }
+  if (set_nice && setpriority(PRIO_PROCESS, 0, nice_value) < 0) {
+    rc = -1;
+  }
+  if (ioprio >= 0 &&
+      syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) < 0) {
+    rc = -1;
+  }
+  return rc;
+}
+
+void placement_reaped(pid_t pid, const struct rusage *ru) {
+  for (int i = 0; i < nplaced; i++) {
+    if (placed[i].pid != pid) {
+      continue;
+    }
+    if (report) {
+      fprintf(stderr, "place: pid %d cpu %s user %ld.%06lds sys %ld.%06lds\n",
+              (int)pid, placed[i].where, (long)ru->ru_utime.tv_sec,
+              (long)ru->ru_utime.tv_usec, (long)ru->ru_stime.tv_sec,
+              (long)ru->ru_stime.tv_usec);
+    }
+    placed[i] = placed[--nplaced];
+    return;
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef UTCSH_PLACEMENT_H
+#define UTCSH_PLACEMENT_H
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/**
+ * The `place` builtin: how the commands of a concurrent line (cmd1 & cmd2,
+ * or a background job) are placed on CPUs. The policy applies to every
+ * concurrent line that follows. `args` is the NULL-terminated argv, and the
+ * current policy is printed to `out`.
+ *
+ * place                  show the policy
+ * place spread [CPUS]    one CPU per command, round-robin over CPUS (default:
+ *                        every CPU the shell may run on)
+ * place pin CPUS         every command may run on any CPU in CPUS
+ * place off              no CPU placement
+ * place nice N|off       run commands at niceness N, or leave it alone
+ * place ioprio CLASS     I/O priority idle, be:LEVEL or rt:LEVEL (LEVEL 0-7,
+ *                        0 is highest), or off to leave it alone
+ * place report on|off    after each command, print the CPU it was placed
+ *                        on and its user and system time to stderr
+ *
+ * CPUS is a list such as 0-3,6. Returns 0 on success and -1 on a usage
+ * error or a CPU the shell may not use.
+ */
+int placement_builtin(char **args, FILE *out);
+
+/** In the parent, before forking a command of a concurrent line: claim the
+ * next round-robin slot for it. Pass the slot to placement_apply() in the
+ * child and placement_forked() in the parent. */
+unsigned placement_claim(void);
+
+/** In the parent, once the command in `slot` has been forked as `pid` */
+void placement_forked(pid_t pid, unsigned slot);
+
+/** In the child: apply the CPU set, niceness and I/O priority of `slot`.
+ * Returns 0 on success and -1 if any of them could not be set (the command
+ * still runs). */
+int placement_apply(unsigned slot);
+
+/** A child forked for a concurrent line has been reaped: report its CPU
+ * time if reporting is on. */
+void placement_reaped(pid_t pid, const struct rusage *ru);
+
+#endif
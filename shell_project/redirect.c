@@ -0,0 +1,141 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "jobs.h"
+#include "redirect.h"
+#include "trace.h"
+
+/* The descriptors a /dev/fd/N path can name, with room for the NUL */
+#define FD_PATH_SIZE sizeof("/dev/fd/-2147483648")
+
+static int open_target(const char *path, int flags) {
+  return open(path, flags | O_CLOEXEC, 0644);
+}
+
+int redirect_apply(const struct Command *cmd, struct SavedFds *saved) {
+  int targets[3] = {-1, -1, -1};
+  int ok = 1;
+  if (cmd->inputFile) {
+    targets[0] = open_target(cmd->inputFile, O_RDONLY);
+    ok = targets[0] >= 0;
+  }
+  if (ok && cmd->outputFile) {
+    targets[1] = open_target(cmd->outputFile, O_WRONLY | O_CREAT |
+                             (cmd->appendOutput ? O_APPEND : O_TRUNC));
+    ok = targets[1] >= 0;
+  }
+  if (ok && cmd->errorFile) {
+    targets[2] = open_target(cmd->errorFile, O_WRONLY | O_CREAT | O_TRUNC);
+    ok = targets[2] >= 0;
+  }
+  // > FILE takes standard error too, as it always has, unless 2> says
+  // otherwise
+  int err_follows_out = cmd->errorToOutput ||
+                        (cmd->outputFile != NULL && cmd->errorFile == NULL);
+
+  if (saved != NULL) {
+    for (int fd = 0; fd < 3; fd++) {
+      saved->fds[fd] = -1;
+      int replaced = targets[fd] >= 0 || (fd == 2 && err_follows_out);
+      if (ok && replaced) {
+        saved->fds[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+        ok = saved->fds[fd] >= 0;
+      }
+    }
+  }
+  if (!ok) {
+    for (int fd = 0; fd < 3; fd++) {
+      if (targets[fd] >= 0) close(targets[fd]);
+    }
+    if (saved != NULL) {
+      redirect_restore(saved);
+    }
+    return -1;
+  }
+
+  for (int fd = 0; fd < 3; fd++) {
+    if (targets[fd] >= 0) {
+      dup2(targets[fd], fd);
+      close(targets[fd]);
+    }
+  }
+  if (err_follows_out) {
+    dup2(STDOUT_FILENO, STDERR_FILENO);
+  }
+  return 0;
+}
+
+void redirect_restore(struct SavedFds *saved) {
+  for (int fd = 0; fd < 3; fd++) {
+    if (saved->fds[fd] >= 0) {
+      dup2(saved->fds[fd], fd);
+      close(saved->fds[fd]);
+      saved->fds[fd] = -1;
+    }
+  }
+}
+
+int procsub_start(struct Command *cmd, struct Arena *arena,
+                  int (*run)(char *cmdline)) {
+  // the children must not write out what the shell still has buffered
+  fflush(stdout);
+  fflush(stderr);
+  for (int i = 0; i < cmd->nprocsubs; i++) {
+    struct ProcSub *sub = &cmd->procsubs[i];
+    char *path = arena_alloc(arena, FD_PATH_SIZE);
+    int pipefd[2];
+    if (path == NULL || pipe(pipefd) < 0) {
+      procsub_finish(cmd);
+      return -1;
+    }
+    // the command writes into >(cmd) and reads from <(cmd)
+    int ours = sub->is_output ? pipefd[1] : pipefd[0];
+    int theirs = sub->is_output ? pipefd[0] : pipefd[1];
+    pid_t pid = fork();
+    if (pid < 0) {
+      stats_count(STAT_FORK_ERRORS);
+      close(ours);
+      close(theirs);
+      procsub_finish(cmd);
+      return -1;
+    }
+    if (pid == 0) {
+      jobs_reset_child_signals();
+      // holding on to the other pipes would keep them from seeing EOF
+      for (int j = 0; j < i; j++) {
+        close(cmd->procsubs[j].fd);
+      }
+      close(ours);
+      dup2(theirs, sub->is_output ? STDIN_FILENO : STDOUT_FILENO);
+      close(theirs);
+      int status = run(sub->cmdline);
+      fflush(stdout);
+      _exit(status);
+    }
+    stats_count(STAT_FORKS);
+    close(theirs);
+    sub->pid = pid;
+    sub->fd = ours;
+    snprintf(path, FD_PATH_SIZE, "/dev/fd/%d", ours);
+    *sub->slot = path;
+  }
+  return 0;
+}
+
+void procsub_finish(struct Command *cmd) {
+  for (int i = 0; i < cmd->nprocsubs; i++) {
+    if (cmd->procsubs[i].fd >= 0) {
+      close(cmd->procsubs[i].fd);
+      cmd->procsubs[i].fd = -1;
+    }
+  }
+  for (int i = 0; i < cmd->nprocsubs; i++) {
+    pid_t pid = cmd->procsubs[i].pid;
+    while (pid > 0 && waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+    }
+    cmd->procsubs[i].pid = -1;
+  }
+}
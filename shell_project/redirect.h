@@ -0,0 +1,45 @@
+#ifndef UTCSH_REDIRECT_H
+#define UTCSH_REDIRECT_H
+
+#include "arena.h"
+#include "parse.h"
+
+/* Standard input, output and error as they were before redirect_apply(),
+   -1 for each one that was left alone */
+struct SavedFds {
+  int fds[3];
+};
+
+/**
+ * Point standard input, output and error at the redirect targets of `cmd`.
+ * > and >> take standard error along with standard output, unless standard
+ * error has a redirect of its own; 2>&1 sends it wherever standard output
+ * goes. All targets are opened before anything is changed, so on failure the
+ * descriptors are as they were.
+ *
+ * If `saved` is not NULL, the descriptors that are replaced are kept there
+ * for redirect_restore(). Returns 0 on success and -1 on error.
+ */
+int redirect_apply(const struct Command *cmd, struct SavedFds *saved);
+
+/** Put back the descriptors saved by redirect_apply() */
+void redirect_restore(struct SavedFds *saved);
+
+/**
+ * Start the process substitutions of `cmd`: each one gets a pipe and a child
+ * that runs its cmd through `run` (which returns the exit status), and its
+ * slot in `cmd` is replaced by a /dev/fd/N path, allocated from `arena`,
+ * that names the command's end of the pipe. The command inherits that end,
+ * so this must happen before it is forked.
+ *
+ * Returns 0 on success. On error, whatever was started is finished and -1
+ * is returned.
+ */
+int procsub_start(struct Command *cmd, struct Arena *arena,
+                  int (*run)(char *cmdline));
+
+/** Once the command is done: close its ends of the pipes, so every
+ * substitution sees end of file or a broken pipe, and wait for them */
+void procsub_finish(struct Command *cmd);
+
+#endif
@@ -0,0 +1,325 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "trace.h"
+
+static int listen_fd = -1;
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int sig) {
+  (void)sig;
+  stop_requested = 1;
+}
+
+static void put_be32(unsigned char *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+/* Write all of buf to the client. MSG_NOSIGNAL turns a vanished client into
+   an EPIPE error instead of killing the worker. Returns 0 or -1. */
+static int send_all(int conn, const void *buf, size_t len) {
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = send(conn, p, len, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int send_frame(int conn, char type, const void *payload, uint32_t len) {
+  unsigned char header[FRAME_HEADER_SIZE];
+  header[0] = type;
+  put_be32(header + 1, len);
+  if (send_all(conn, header, sizeof(header)) < 0) {
+    return -1;
+  }
+  return send_all(conn, payload, len);
+}
+
+/* In a freshly forked runner: point fds 0-2 at /dev/null and the two pipes,
+   run the line and leave without returning */
+static void run_in_child(int conn, int out[2], int err[2], char *line,
+                         server_run_fn run_line) {
+  close(listen_fd);
+  close(conn);
+  close(out[0]);
+  close(err[0]);
+  int devnull = open("/dev/null", O_RDONLY);
+  if (devnull >= 0) {
+    dup2(devnull, STDIN_FILENO);
+    close(devnull);
+  }
+  dup2(out[1], STDOUT_FILENO);
+  dup2(err[1], STDERR_FILENO);
+  close(out[1]);
+  close(err[1]);
+
+  int status = run_line(line);
+  fflush(stdout);
+  fflush(stderr);
+  _exit(status & 0xff);
+}
+
+/* Relay the runner's output to the client as it is produced. Returns -1 if
+   the client went away, after killing the runner. */
+static int relay_output(int conn, pid_t runner, int out_fd, int err_fd) {
+  static char buf[FRAME_MAX_PAYLOAD];
+  struct pollfd fds[2] = {{out_fd, POLLIN, 0}, {err_fd, POLLIN, 0}};
+  const char types[2] = {FRAME_STDOUT, FRAME_STDERR};
+  int open_fds = 2;
+  int rc = 0;
+
+  while (open_fds > 0) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    for (int i = 0; i < 2; i++) {
+      if (fds[i].fd < 0 || !fds[i].revents) {
+        continue;
+      }
+      ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        close(fds[i].fd);
+        fds[i].fd = -1;
+        open_fds--;
+        continue;
+      }
+      if (rc == 0 && send_frame(conn, types[i], buf, n) < 0) {
+        /* Keep draining so the runner is not left blocked on a pipe */
+        kill(runner, SIGKILL);
+        rc = -1;
+      }
+    }
+  }
+  for (int i = 0; i < 2; i++) {
+    if (fds[i].fd >= 0) {
+      close(fds[i].fd);
+    }
+  }
+  return rc;
+}
+
+/* Run one command line for the client on conn. Returns -1 if the connection
+   is no longer usable. */
+static int serve_request(int conn, char *line, server_run_fn run_line) {
+  uint64_t start = trace_now_ns();
+  int out[2], err[2];
+  if (pipe(out) < 0) {
+    return -1;
+  }
+  if (pipe(err) < 0) {
+    close(out[0]);
+    close(out[1]);
+    return -1;
+  }
+
+  pid_t runner = fork();
+  if (runner < 0) {
+    close(out[0]);
+    close(out[1]);
+    close(err[0]);
+    close(err[1]);
+    static const char msg[] = "An error has occurred\n";
+    unsigned char status[4];
+    put_be32(status, 1);
+    if (send_frame(conn, FRAME_STDERR, msg, sizeof(msg) - 1) < 0 ||
+        send_frame(conn, FRAME_EXIT, status, sizeof(status)) < 0) {
+      return -1;
+    }
+    return 0;
+  }
+  if (runner == 0) {
+    run_in_child(conn, out, err, line, run_line);
+  }
+
+  close(out[1]);
+  close(err[1]);
+  int rc = relay_output(conn, runner, out[0], err[0]);
+
+  int wstatus = 0;
+  while (waitpid(runner, &wstatus, 0) < 0 && errno == EINTR) {
+  }
+  int exit_status = WIFEXITED(wstatus)   ? WEXITSTATUS(wstatus)
+                    : WIFSIGNALED(wstatus) ? 128 + WTERMSIG(wstatus)
+                                           : 1;
+  trace_event("request", "\"runner\":%d,\"exit\":%d,\"dur_ns\":%llu",
+              (int)runner, exit_status,
+              (unsigned long long)(trace_now_ns() - start));
+  if (rc < 0) {
+    return -1;
+  }
+  unsigned char status[4];
+  put_be32(status, exit_status);
+  return send_frame(conn, FRAME_EXIT, status, sizeof(status));
+}
+
+static void serve_connection(int conn, server_run_fn run_line) {
+  FILE *in = fdopen(conn, "r");
+  if (in == NULL) {
+    close(conn);
+    return;
+  }
+  char *line = NULL;
+  size_t size = 0;
+  while (getline(&line, &size, in) != -1) {
+    if (serve_request(conn, line, run_line) < 0) {
+      break;
+    }
+  }
+  free(line);
+  fclose(in);
+}
+
+static void worker_loop(server_run_fn run_line) {
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGINT, SIG_DFL);
+  for (;;) {
+    int conn = accept(listen_fd, NULL, NULL);
+    if (conn < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      _exit(1); /* The supervisor starts a replacement */
+    }
+    serve_connection(conn, run_line);
+  }
+}
+
+static pid_t spawn_worker(server_run_fn run_line) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    worker_loop(run_line);
+  }
+  return pid;
+}
+
+/* Bind and listen on path, replacing a stale socket left by an earlier
+   server but never any other kind of file */
+static int open_listen_socket(const char *path, int backlog) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  struct stat st;
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path);
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(fd, backlog) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int server_main(const char *path, int nworkers, server_run_fn run_line) {
+  /* A backlog the size of the pool bounds how many clients queue up; past
+     that, connect() blocks until a worker frees up */
+  listen_fd = open_listen_socket(path, nworkers);
+  if (listen_fd < 0) {
+    return 1;
+  }
+  pid_t *workers = calloc(nworkers, sizeof(pid_t));
+  if (workers == NULL) {
+    close(listen_fd);
+    unlink(path);
+    return 1;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = request_stop;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+
+  fflush(stdout);
+  for (int i = 0; i < nworkers; i++) {
+    workers[i] = spawn_worker(run_line);
+  }
+  if (trace_enabled()) {
+    char socket_json[256];
+    trace_event("server", "\"socket\":%s,\"workers\":%d",
+                trace_json_string(socket_json, sizeof(socket_json), path),
+                nworkers);
+  }
+
+  while (!stop_requested) {
+    /* Refill slots whose fork failed, at startup or on a respawn */
+    int empty = 0;
+    for (int i = 0; i < nworkers; i++) {
+      if (workers[i] < 0) {
+        workers[i] = spawn_worker(run_line);
+        empty += workers[i] < 0;
+      }
+    }
+    int status;
+    pid_t pid = waitpid(-1, &status, empty ? WNOHANG : 0);
+    if (pid < 0 && errno == EINTR) {
+      continue;
+    }
+    if (pid < 0 && errno != ECHILD) {
+      break;
+    }
+    if (pid <= 0) {
+      /* Nothing exited but some slots are empty: back off before trying
+         to fork again */
+      struct timespec pause = {0, 100 * 1000 * 1000};
+      nanosleep(&pause, NULL);
+      continue;
+    }
+    for (int i = 0; i < nworkers && !stop_requested; i++) {
+      if (workers[i] == pid) {
+        workers[i] = spawn_worker(run_line);
+      }
+    }
+  }
+
+  for (int i = 0; i < nworkers; i++) {
+    if (workers[i] > 0) {
+      kill(workers[i], SIGTERM);
+    }
+  }
+  while (wait(NULL) > 0 || errno == EINTR) {
+  }
+  close(listen_fd);
+  unlink(path);
+  free(workers);
+  return 0;
+}
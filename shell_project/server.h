@@ -0,0 +1,42 @@
+#ifndef UTCSH_SERVER_H
+#define UTCSH_SERVER_H
+
+#include <stdint.h>
+
+/*
+ * Wire protocol of `utcsh --server SOCKET`.
+ *
+ * A client sends command lines, each terminated by a newline, and may send
+ * several over one connection. For every line the server sends back any
+ * number of output frames followed by exactly one FRAME_EXIT frame. A frame
+ * is a type byte, a 4-byte big-endian payload length and the payload.
+ */
+#define FRAME_STDOUT 'o' /* Payload: bytes the command wrote to stdout */
+#define FRAME_STDERR 'e' /* Payload: bytes the command wrote to stderr */
+#define FRAME_EXIT 'x'   /* Payload: 4-byte big-endian exit status */
+
+#define FRAME_HEADER_SIZE 5
+#define FRAME_MAX_PAYLOAD (64 * 1024)
+
+/** Runs one command line in the calling process and returns its exit
+ * status. The line may be modified. */
+typedef int (*server_run_fn)(char *line);
+
+/**
+ * Serve command lines on the UNIX-domain socket at `path` until SIGTERM or
+ * SIGINT arrives.
+ *
+ * `nworkers` worker processes are forked up front, each a copy of the
+ * already initialized shell. A worker accepts one connection at a time and
+ * forks a runner per command line, so commands start from the worker's
+ * pristine state (cd and path in one request do not leak into the next) and
+ * at most `nworkers` command lines run at once. Further clients wait in the
+ * listen backlog, and a client that reads slowly stalls its own command
+ * through the full pipe rather than making the server buffer its output.
+ *
+ * Dead workers are replaced. Returns the exit status for main(): 0 after a
+ * clean shutdown, 1 if the socket could not be set up.
+ */
+int server_main(const char *path, int nworkers, server_run_fn run_line);
+
+#endif
@@ -13,9 +13,20 @@ import tempfile
 import sys, os
 import subprocess
 import argparse
+import concurrent.futures
+import contextlib
+import ctypes
+import io
 import json
+import math
 import re
+import resource
+import shutil
+import signal
+import statistics
 import textwrap
+import threading
+import time
 from enum import Enum
 from subprocess import PIPE
 
@@ -29,6 +40,31 @@ utildir_pat = re.compile(r"\$UTILDIR")
 # user2 to appear to fail.
 TMPDIR = os.path.join(tempfile.gettempdir(), os.getlogin(), "utcsh")
 
+# Seconds a test command may run
+TEST_TIMEOUT = 20
+
+# What can be measured about a test run, and how to show it. The ones in
+# BUDGET_METRICS can be limited by a "budget" in the test's info file; spawns
+# and syscalls are only counted for tests that limit them, as counting needs a
+# second, much slower run under ptrace.
+METRICS = {
+    "wall_s": ("wall time", "{:.3f}s"),
+    "cpu_s": ("CPU time", "{:.3f}s"),
+    "rss_kb": ("peak RSS", "{:.0f} KiB"),
+    "spawns": ("child spawns", "{:.0f}"),
+    "syscalls": ("system calls", "{:.0f}"),
+}
+BUDGET_METRICS = ("wall_s", "rss_kb", "spawns", "syscalls")
+TRACED_METRICS = ("spawns", "syscalls")
+
+# A change against a baseline is a regression only if the median grew by more
+# than the threshold (--threshold) and by at least this much, and a one-sided
+# Mann-Whitney U test says the runs are slower with p below REGRESSION_ALPHA.
+# Five runs on each side can reach p = 0.004.
+MIN_REGRESSION = {"wall_s": 0.01, "cpu_s": 0.01, "rss_kb": 1024, "spawns": 1, "syscalls": 1}
+REGRESSION_ALPHA = 0.01
+DEFAULT_REPEAT = 5
+
 
 class TestAction(Enum):
     NO_OP = 0
@@ -145,6 +181,14 @@ class TestInfo:
         self.rc = TestRc(json_obj["rc"])
         self.pointval = int(json_obj["pointval"])
         self.srcdir = pdir
+        self.budget = json_obj.get("budget", {})
+        for metric in self.budget:
+            if metric not in BUDGET_METRICS:
+                raise ValueError(f"Unknown budget {metric} in {pdir}/info")
+
+    def key(self):
+        """What the test is called in a baseline file: numbers can change"""
+        return os.path.basename(os.path.normpath(self.srcdir))
 
 
 class RuntimeTestParams:
@@ -156,6 +200,15 @@ class RuntimeTestParams:
         self.verbose = parsed_args.verbose
         self.cont_on_err = parsed_args.keep_going
         self.skip_init = parsed_args.skip_init
+        self.jobs = max(1, parsed_args.jobs)
+        self.record_baseline = parsed_args.record_baseline
+        self.baseline = None  # Loaded in main() from parsed_args.baseline
+        self.threshold = parsed_args.threshold
+        self.repeat = parsed_args.repeat
+        if self.repeat is None:
+            measuring = parsed_args.baseline or parsed_args.record_baseline
+            self.repeat = DEFAULT_REPEAT if measuring else 1
+        self.repeat = max(1, self.repeat)
         self.outpath = parsed_args.out
         self.inpath = "tests/test-specs"
         self.utildir = "tests/test-utils"
@@ -212,14 +265,24 @@ def get_test_specs(rtparams):
     return [get_test_spec(rtparams, x) for x in range(1, max_testid + 1)]
 
 
-def run_bash_file(fname, runparams, testinfo):
+def test_env(workdir):
+    """The environment for a test's commands: with a working directory of its
+    own, that is also where they make their temporary files"""
+    if workdir is None:
+        return None
+    env = dict(os.environ)
+    env["TMPDIR"] = workdir
+    return env
+
+
+def run_bash_file(fname, runparams, testinfo, workdir=None):
     """Run a bash file, returning its stdout/stderr/rc in a TestResult"""
 
     with open(fname, "r") as inf:
         contents = inf.read()
 
     contents = sub_special_vars(contents, runparams, testinfo)
-    outpath = os.path.join(TMPDIR, "test-pre")
+    outpath = os.path.join(workdir or TMPDIR, "test-pre")
 
     with open(outpath, "w") as outf:
         outf.write(contents)
@@ -232,7 +295,188 @@ def run_bash_file(fname, runparams, testinfo):
         stdout=PIPE,
         stderr=PIPE,
         universal_newlines=True,
+        cwd=workdir,
+        env=test_env(workdir),
+    )
+
+
+def run_command(cmd, workdir, timeout):
+    """Run a test command like subprocess.run, but also return its resource
+    usage: that of the command and every descendant it waited for. Returns
+    (stdout, stderr, returncode, rusage, wall seconds)."""
+    start = time.monotonic()
+    proc = subprocess.Popen(
+        cmd,
+        stdout=PIPE,
+        stderr=PIPE,
+        universal_newlines=True,
+        cwd=workdir,
+        env=test_env(workdir),
     )
+    outputs = {}
+
+    def read(name, f):
+        outputs[name] = f.read()
+
+    readers = [
+        threading.Thread(target=read, args=(name, f), daemon=True)
+        for name, f in (("out", proc.stdout), ("err", proc.stderr))
+    ]
+    for reader in readers:
+        reader.start()
+    state = {"done": False, "killed": False}
+
+    def kill():
+        if not state["done"]:
+            state["killed"] = True
+            proc.kill()
+
+    timer = threading.Timer(timeout, kill)
+    timer.start()
+    # Reap it ourselves rather than through proc.wait(), to get its rusage
+    _, status, rusage = os.wait4(proc.pid, 0)
+    state["done"] = True
+    wall = time.monotonic() - start
+    timer.cancel()
+    proc.returncode = os.waitstatus_to_exitcode(status)
+    # Children left running in the background may hold the pipes open
+    for reader in readers:
+        reader.join(max(0, timeout - (time.monotonic() - start)))
+    if state["killed"] or any(reader.is_alive() for reader in readers):
+        raise subprocess.TimeoutExpired(cmd, timeout)
+    return outputs["out"], outputs["err"], proc.returncode, rusage, wall
+
+
+# From <sys/ptrace.h> and <sys/wait.h>
+PTRACE_TRACEME = 0
+PTRACE_SYSCALL = 24
+PTRACE_SETOPTIONS = 0x4200
+PTRACE_GETSIGINFO = 0x4202
+PTRACE_O_TRACESYSGOOD = 0x1
+PTRACE_O_TRACEFORK = 0x2
+PTRACE_O_TRACEVFORK = 0x4
+PTRACE_O_TRACECLONE = 0x8
+PTRACE_O_TRACEEXEC = 0x10
+PTRACE_O_EXITKILL = 0x100000
+WALL = 0x40000000
+
+
+def thread_group(tid):
+    """The process a thread belongs to, or None if it is gone"""
+    try:
+        with open(f"/proc/{tid}/status") as f:
+            for line in f:
+                if line.startswith("Tgid:"):
+                    return int(line.split()[1])
+    except OSError:
+        pass
+    return None
+
+
+def count_syscalls(cmd, workdir, timeout):
+    """Run a test command under ptrace, with no input or output, counting the
+    processes it and its descendants start (not threads) and the system calls
+    they all make. Returns (spawns, syscalls), or None if the command cannot
+    be traced or timed out.
+
+    Every system call stops the traced process twice, so this is far slower
+    than the command itself: its times say nothing."""
+    libc = ctypes.CDLL(None, use_errno=True)
+    ptrace = libc.ptrace
+    ptrace.argtypes = [ctypes.c_long, ctypes.c_long, ctypes.c_void_p, ctypes.c_void_p]
+    ptrace.restype = ctypes.c_long
+    env = test_env(workdir) or os.environ
+
+    pid = os.fork()
+    if pid == 0:
+        try:
+            devnull = os.open(os.devnull, os.O_RDWR)
+            for fd in (0, 1, 2):
+                os.dup2(devnull, fd)
+            if workdir is not None:
+                os.chdir(workdir)
+            if ptrace(PTRACE_TRACEME, 0, None, None) == 0:
+                # Wait for the options to be set before running anything
+                os.kill(os.getpid(), signal.SIGSTOP)
+                os.execvpe(cmd[0], cmd, env)
+        finally:
+            os._exit(127)
+    _, status = os.waitpid(pid, 0)
+    if not os.WIFSTOPPED(status):
+        return None
+    options = (
+        PTRACE_O_TRACESYSGOOD
+        | PTRACE_O_TRACEFORK
+        | PTRACE_O_TRACEVFORK
+        | PTRACE_O_TRACECLONE
+        | PTRACE_O_TRACEEXEC
+        | PTRACE_O_EXITKILL
+    )
+    ptrace(PTRACE_SETOPTIONS, pid, None, options)
+
+    in_syscall = {pid: False}  # Every live task, and whether it is in a call
+    spawns = syscalls = 0
+    killed = []
+
+    def kill():
+        killed.append(True)
+        for tid in list(in_syscall):
+            try:
+                os.kill(tid, signal.SIGKILL)
+            except OSError:
+                pass
+
+    timer = threading.Timer(timeout, kill)
+    timer.start()
+    siginfo = ctypes.create_string_buffer(128)
+    ptrace(PTRACE_SYSCALL, pid, None, None)
+    try:
+        while in_syscall:
+            try:
+                tid, status = os.waitpid(-1, WALL)
+            except ChildProcessError:
+                break
+            if os.WIFEXITED(status) or os.WIFSIGNALED(status):
+                in_syscall.pop(tid, None)
+                continue
+            sig = os.WSTOPSIG(status)
+            deliver = 0
+            if tid not in in_syscall:
+                # A new task's first stop, a SIGSTOP of ptrace's making
+                in_syscall[tid] = False
+                if thread_group(tid) == tid:
+                    spawns += 1
+            elif sig == signal.SIGTRAP | 0x80:
+                if not in_syscall[tid]:
+                    syscalls += 1
+                in_syscall[tid] = not in_syscall[tid]
+            elif status >> 16 == 0 and ptrace(PTRACE_GETSIGINFO, tid, None, siginfo) == 0:
+                # A signal on its way: pass it on. Without siginfo, this is a
+                # ptrace event or the task stopping after such a signal.
+                deliver = sig
+            ptrace(PTRACE_SYSCALL, tid, None, deliver)
+    finally:
+        timer.cancel()
+    if killed:
+        return None
+    return spawns, syscalls
+
+
+def check_budget(testinfo, metrics):
+    """Check a run's metrics against the test's budget. Returns True if it
+    kept to it."""
+    success = True
+    for metric, limit in testinfo.budget.items():
+        if metric not in metrics:
+            continue
+        name, fmt = METRICS[metric]
+        if metrics[metric] > limit:
+            error(
+                f"The {name} of the test was {fmt.format(metrics[metric])}, "
+                f"over its budget of {fmt.format(limit)}"
+            )
+            success = False
+    return success
 
 
 def gen_inp_file(testinfo, runparams):
@@ -293,8 +537,11 @@ def check_abnormal_retcodes(code):
         return False
 
 
-def run_test(testinfo, runparams):
-    """Execute a test."""
+def run_test(testinfo, runparams, workdir=None, metrics=None):
+    """Execute a test, in workdir if given rather than the current directory.
+    What was measured of the run is stored in metrics, if given."""
+    if metrics is None:
+        metrics = {}
     outdir = os.path.join(runparams.outpath, str(testinfo.idn))
     if not try_make_path(outdir):
         error(f"Could not make output directory {outdir}")
@@ -305,7 +552,7 @@ def run_test(testinfo, runparams):
         # These can fail, so don't check the returncode on them
         if runparams.verbose:
             info("Running setup command")
-        run_bash_file(testinfo.pre_f, runparams, testinfo)
+        run_bash_file(testinfo.pre_f, runparams, testinfo, workdir)
 
     with open(testinfo.run_f, "r") as inf:
         cmd = inf.read().split()
@@ -318,20 +565,20 @@ def run_test(testinfo, runparams):
         info("Running command: " + " ".join(cmd))
 
     try:
-        cmd_res = subprocess.run(
-            cmd, stdout=PIPE, stderr=PIPE, universal_newlines=True, timeout=20
-        )
+        stdout, stderr, retcode, rusage, wall = run_command(cmd, workdir, TEST_TIMEOUT)
     except subprocess.TimeoutExpired as e:
         error(f"Test {testinfo.idn} timed out.")
         return False
+    metrics["wall_s"] = wall
+    metrics["cpu_s"] = rusage.ru_utime + rusage.ru_stime
+    metrics["rss_kb"] = rusage.ru_maxrss
 
     outfile = os.path.join(outdir, "out")
     errfile = os.path.join(outdir, "err")
-    retcode = cmd_res.returncode
     with open(outfile, "w") as outf:
-        outf.write(cmd_res.stdout)
+        outf.write(stdout)
     with open(errfile, "w") as errf:
-        errf.write(cmd_res.stderr)
+        errf.write(stderr)
 
     success = True
 
@@ -352,6 +599,15 @@ def run_test(testinfo, runparams):
             )
             success = False
 
+    if any(metric in testinfo.budget for metric in TRACED_METRICS):
+        counts = count_syscalls(cmd, workdir, TEST_TIMEOUT)
+        if counts is None:
+            warning("Could not count the system calls of the test\n")
+        else:
+            metrics["spawns"], metrics["syscalls"] = counts
+    if not check_budget(testinfo, metrics):
+        success = False
+
     # If the test is labeled "nocrash", it implicitly does not check output
     # since the only requirement is that the test does not crash
     if testinfo.rc.nocrash:
@@ -370,11 +626,205 @@ def run_test(testinfo, runparams):
     if testinfo.post_f is not None:
         if runparams.verbose:
             info("Running cleanup command")
-        run_bash_file(testinfo.post_f, runparams, testinfo)
+        run_bash_file(testinfo.post_f, runparams, testinfo, workdir)
+
+    return success
+
 
+class TestTiming:
+    """How long a test took: wall clock, and CPU time of everything it ran.
+    samples maps each metric to what every run of the test measured."""
+
+    def __init__(self, idn, wall, cpu, samples):
+        self.idn = idn
+        self.wall = wall
+        self.cpu = cpu
+        self.samples = samples
+
+
+def children_cpu_time():
+    usage = resource.getrusage(resource.RUSAGE_CHILDREN)
+    return usage.ru_utime + usage.ru_stime
+
+
+def mann_whitney_p(before, after):
+    """The one-sided p-value of the Mann-Whitney U test that the values in
+    after tend to be larger than those in before. Exact, counting ties as
+    half, which is fine for the handful of runs compared here."""
+    u = sum((a > b) + 0.5 * (a == b) for a in after for b in before)
+    m, n = len(after), len(before)
+    # counts[i][j][k]: orderings of i values of after and j of before with U = k
+    counts = [[None] * (n + 1) for _ in range(m + 1)]
+    for i in range(m + 1):
+        for j in range(n + 1):
+            if i == 0 or j == 0:
+                counts[i][j] = [1] + [0] * (i * j)
+                continue
+            # The largest value is either from after, beating all j, or not
+            c = [0] * (i * j + 1)
+            for k, ways in enumerate(counts[i - 1][j]):
+                c[k + j] += ways
+            for k, ways in enumerate(counts[i][j - 1]):
+                c[k] += ways
+            counts[i][j] = c
+    dist = counts[m][n]
+    return sum(dist[math.ceil(u) :]) / sum(dist)
+
+
+def check_baseline(testinfo, runparams, samples):
+    """Compare a test's runs with the baseline. Returns False if one of the
+    metrics regressed."""
+    success = True
+    recorded = runparams.baseline["tests"].get(testinfo.key(), {})
+    for metric, values in samples.items():
+        if metric not in recorded or not values:
+            continue
+        name, fmt = METRICS[metric]
+        before = recorded[metric]["samples"]
+        old = recorded[metric]["median"]
+        new = statistics.median(values)
+        if new - old < max(MIN_REGRESSION[metric], old * runparams.threshold):
+            continue
+        p = mann_whitney_p(before, values)
+        if p >= REGRESSION_ALPHA:
+            continue
+        change = f"+{(new - old) / old:.0%}" if old > 0 else "up from 0"
+        error(
+            f"The {name} of the test regressed: median {fmt.format(new)}, "
+            f"baseline {fmt.format(old)} ({change}, p = {p:.3f})"
+        )
+        success = False
     return success
 
 
+def timed_run_test(testinfo, runparams, workdir=None):
+    """Run a test, runparams.repeat times, returning whether it passed and a
+    TestTiming. The CPU time is of the children reaped meanwhile, so only one
+    test may run at a time in this process."""
+    start_wall = time.monotonic()
+    start_cpu = children_cpu_time()
+    samples = {}
+    for _ in range(runparams.repeat):
+        metrics = {}
+        success = run_test(testinfo, runparams, workdir, metrics)
+        for metric, value in metrics.items():
+            samples.setdefault(metric, []).append(value)
+        if not success:
+            break
+    if success and runparams.baseline is not None:
+        success = check_baseline(testinfo, runparams, samples)
+    timing = TestTiming(
+        testinfo.idn,
+        time.monotonic() - start_wall,
+        children_cpu_time() - start_cpu,
+        samples,
+    )
+    return success, timing
+
+
+def make_workdir(testinfo):
+    """A temporary working directory for one test, that looks like this one: it
+    holds a symlink to everything in it, so the relative paths in run files
+    still work, but anything a test creates in its working directory is its
+    own."""
+    workdir = tempfile.mkdtemp(prefix=f"utcsh-test{testinfo.idn}-")
+    for entry in os.listdir("."):
+        os.symlink(os.path.abspath(entry), os.path.join(workdir, entry))
+    return workdir
+
+
+def announce_test(testinfo, runparams):
+    """Print the banner before a test's output"""
+    print_color("==================================", "magenta")
+    if runparams.verbose:
+        okay(f"Running Test {testinfo.idn}: {testinfo.name}")
+        okay(f"Description: {testinfo.desc}")
+        print("")
+
+
+def run_isolated_test(testinfo, runparams, announce):
+    """Run a test in a worker process and its own working directory. Returns
+    whether it passed, what it printed, and its TestTiming."""
+    workdir = make_workdir(testinfo)
+    output = io.StringIO()
+    try:
+        with contextlib.redirect_stdout(output):
+            if announce is not None:
+                announce(testinfo, runparams)
+            success, timing = timed_run_test(testinfo, runparams, workdir)
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
+    return success, output.getvalue(), timing
+
+
+def run_tests(testspecs, runparams, announce=None):
+    """Run the given tests, yielding (testspec, success, timing) in order.
+    announce(testspec, runparams), if given, is called just before each test.
+
+    With more than one job the tests run in worker processes, each in a
+    working directory of its own, and what a test prints is held back until
+    the tests before it are reported. Tests still queued are cancelled when
+    the caller stops early."""
+    if runparams.jobs == 1:
+        for testspec in testspecs:
+            if announce is not None:
+                announce(testspec, runparams)
+            success, timing = timed_run_test(testspec, runparams)
+            yield testspec, success, timing
+        return
+
+    pool = concurrent.futures.ProcessPoolExecutor(runparams.jobs)
+    try:
+        futures = [
+            pool.submit(run_isolated_test, testspec, runparams, announce)
+            for testspec in testspecs
+        ]
+        for testspec, future in zip(testspecs, futures):
+            success, output, timing = future.result()
+            print(output, end="")
+            yield testspec, success, timing
+    finally:
+        pool.shutdown(cancel_futures=True)
+
+
+def load_baseline(path):
+    """Read a baseline file, or return None"""
+    try:
+        with open(path) as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return None
+
+
+def record_baseline(runparams, recorded):
+    """Save the median and samples of every metric of the tests that passed,
+    keeping what the baseline file has on other tests"""
+    path = runparams.record_baseline
+    baseline = load_baseline(path) or {"tests": {}}
+    for key, samples in recorded.items():
+        baseline["tests"][key] = {
+            metric: {"median": statistics.median(values), "samples": values}
+            for metric, values in samples.items()
+        }
+    with open(path, "w") as outf:
+        json.dump(baseline, outf, indent=1, sort_keys=True)
+    info(f"Recorded {len(recorded)} tests, {runparams.repeat} runs each, in {path}")
+
+
+def print_slowest(timings, count=5):
+    """Print the tests that took the longest"""
+    if not timings:
+        return
+    slowest = sorted(timings, key=lambda t: t.wall, reverse=True)[:count]
+    print("")
+    info(f"Slowest tests (wall / CPU seconds):")
+    for t in slowest:
+        print(f"  Test {t.idn:>3}  {t.wall:7.2f}  {t.cpu:7.2f}")
+    total_wall = sum(t.wall for t in timings)
+    total_cpu = sum(t.cpu for t in timings)
+    print(f"  {len(timings)} tests: {total_wall:.2f}s wall, {total_cpu:.2f}s CPU")
+
+
 def replace_whitespace(string):
     output = ""
     for i in range(len(string)):
@@ -470,6 +920,37 @@ def main():
     parser.add_argument(
         "-s", "--skip-init", help="Skip pre-test initialization", action="store_true"
     )
+    parser.add_argument(
+        "-j",
+        "--jobs",
+        type=int,
+        metavar="n",
+        default=1,
+        help="Run n tests at a time, each in a temporary working directory",
+    )
+    parser.add_argument(
+        "--record-baseline",
+        metavar="file",
+        help="Save the medians of what is measured of each passing test to file",
+    )
+    parser.add_argument(
+        "--baseline",
+        metavar="file",
+        help="Fail tests that are significantly slower than recorded in file",
+    )
+    parser.add_argument(
+        "--repeat",
+        type=int,
+        metavar="n",
+        help=f"Run each test n times (default: {DEFAULT_REPEAT} with a baseline, else 1)",
+    )
+    parser.add_argument(
+        "--threshold",
+        type=float,
+        default=0.1,
+        metavar="f",
+        help="Smallest relative growth of a median that is a regression (default: 0.1)",
+    )
     parser.add_argument(
         "-o",
         "--out",
@@ -480,6 +961,10 @@ def main():
 
     args = parser.parse_args()
     rtparams = RuntimeTestParams(args)
+    if args.baseline:
+        rtparams.baseline = load_baseline(args.baseline)
+        if rtparams.baseline is None:
+            fatal_error(f"Could not read the baseline {args.baseline}")
 
     if not try_make_path(args.out):
         sys.exit(1)
@@ -492,15 +977,15 @@ def main():
         testspecs = get_test_specs(rtparams)
 
         failed_list = []
-        for testspec in testspecs:
-            print_color("==================================", "magenta")
-            if rtparams.verbose:
-                okay(f"Running Test {testspec.idn}: {testspec.name}")
-                okay(f"Description: {testspec.desc}")
-                print("")
-            success = run_test(testspec, rtparams)
+        timings = []
+        recorded = {}
+        for testspec, success, timing in run_tests(
+            testspecs, rtparams, announce_test
+        ):
+            timings.append(timing)
             if success:
                 okay(f"[PASS]: Test {testspec.idn}")
+                recorded[testspec.key()] = timing.samples
             else:
                 failed_list.append(testspec.idn)
                 print_color(f"[FAIL]: Test {testspec.idn}", "red")
@@ -508,6 +993,9 @@ def main():
                     continue
                 else:
                     break
+        print_slowest(timings)
+        if rtparams.record_baseline:
+            record_baseline(rtparams, recorded)
         if not failed_list:
             okay("Passed all tests! Congratulations!")
         else:
@@ -520,9 +1008,11 @@ def main():
             okay(f"Running Test {rtparams.tid}: {testspec.name}")
             okay(f"Description: {testspec.desc}")
 
-        success = run_test(testspec, rtparams)
+        success, timing = timed_run_test(testspec, rtparams)
         if success:
             okay(f"[PASS]: Test {testspec.idn}")
+            if rtparams.record_baseline:
+                record_baseline(rtparams, {testspec.key(): timing.samples})
     elif rtparams.action == TestAction.DESCRIBE:
         testspec = get_test_spec(rtparams, rtparams.tid)
         describe_test(testspec, rtparams)
@@ -530,10 +1020,9 @@ def main():
         testspecs = get_test_specs(rtparams)
         successes = set()
         print("Checking tests: ", end="")
-        for testspec in testspecs:
+        for testspec, success, _ in run_tests(testspecs, rtparams):
             print(f"{testspec.idn} ", end="")
             sys.stdout.flush()
-            success = run_test(testspec, rtparams)
             if success:
                 successes.add(testspec)
 
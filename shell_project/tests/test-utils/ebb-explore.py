@@ -0,0 +1,295 @@
+#!/usr/bin/env python3
+
+## Exhaustively explore a workload's fault space with EvilBoomBox.
+#
+# A tracing run first records every call the workload's process makes that
+# EvilBoomBox can fail: each step of the syscall countdown, with the function
+# it was, and the number of allocation countdown steps. Every (step, errno)
+# failure point is then run once, in parallel, each run in its own sandbox
+# directory (its TMPDIR, marker files and crash log). Runs that die of a
+# signal, in any process of the workload, are grouped by the stack they died
+# on; runs that outlive the timeout are hangs.
+#
+# Usage: ebb-explore.py [-j JOBS] [--skel FILE] CMD [ARG...]
+#
+# With --skel, FILE is a test-spec skel: $TMPDIR becomes the run's sandbox and
+# $SRCDIR and $UTILDIR become the spec and utility directories, as in
+# run-tests.py, and the result is passed to CMD as its last argument.
+#
+# Exits 1 if any failure point crashed or hung, 2 if the workload could not
+# be traced.
+
+import argparse
+import concurrent.futures
+import errno
+import json
+import os
+import shlex
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+UTILDIR = os.path.dirname(os.path.abspath(__file__))
+EBB_DIR = os.path.join(UTILDIR, "p2a-ebb")
+EBB_LIB = os.path.join(EBB_DIR, "libevilboombox.so")
+ENOMEM = errno.ENOMEM
+
+# Frames in these modules say little about where the workload went wrong
+NOISE_MODULES = ("libevilboombox.so", "libc.so", "ld-linux", "libgcc_s.so")
+SIGNATURE_FRAMES = 5
+
+
+class FaultPoint:
+    def __init__(self, kind, step, func, err):
+        self.kind = kind  # "syscall" or "alloc"
+        self.step = step
+        self.func = func
+        self.err = err
+
+    def env(self):
+        if self.kind == "alloc":
+            return {"EBB_ALLOC_CTR": str(self.step)}
+        return {"EBB_SYSCALL_CTR": str(self.step),
+                "EBB_SYSCALL_ERRNO": str(self.err)}
+
+    def describe(self):
+        name = errno.errorcode.get(self.err, str(self.err))
+        return "{} {} {} {}".format(self.kind, self.step, self.func, name)
+
+
+class Explorer:
+    def __init__(self, args):
+        self.args = args
+        self.root = tempfile.mkdtemp(prefix="ebb-explore-")
+        self.cwd = os.getcwd()
+
+    def sandbox(self, name):
+        """A fresh directory for one run, and the command to run in it"""
+        path = os.path.join(self.root, name)
+        os.mkdir(path)
+        cmd = list(self.args.cmd)
+        if self.args.skel:
+            with open(self.args.skel) as f:
+                text = f.read()
+            text = text.replace("$TMPDIR", path)
+            text = text.replace("$SRCDIR", os.path.dirname(self.args.skel))
+            text = text.replace("$UTILDIR", os.path.relpath(UTILDIR, self.cwd))
+            text = text.replace("$TESTID", "")
+            with open(os.path.join(path, "in"), "w") as f:
+                f.write(text)
+            cmd.append(os.path.join(path, "in"))
+        return path, cmd
+
+    def run(self, name, extra_env, timeout):
+        """Run the workload once. Returns (sandbox, returncode or None on timeout)"""
+        path, cmd = self.sandbox(name)
+        env = dict(os.environ)
+        env.update(extra_env)
+        env["LD_PRELOAD"] = EBB_LIB + (":" + env["LD_PRELOAD"]
+                                       if env.get("LD_PRELOAD") else "")
+        env["TMPDIR"] = path
+        env["EBB_FIRED_DIR"] = path
+        env["EBB_CRASH_TRACE"] = os.path.join(path, "crash")
+        # A session of its own, so a hang can be killed with everything it
+        # started
+        proc = subprocess.Popen(cmd, env=env, stdin=subprocess.DEVNULL,
+                                stdout=subprocess.DEVNULL,
+                                stderr=subprocess.DEVNULL,
+                                start_new_session=True)
+        try:
+            return path, proc.wait(timeout=timeout)
+        except subprocess.TimeoutExpired:
+            os.killpg(proc.pid, signal.SIGKILL)
+            proc.wait()
+            return path, None
+
+    def trace(self):
+        """The failure points the workload can reach, and how long it takes"""
+        trace_path = os.path.join(self.root, "fault-trace")
+        start = time.monotonic()
+        _, rc = self.run("baseline", {"EBB_FAULT_TRACE": trace_path}, None)
+        elapsed = time.monotonic() - start
+        if rc is None or rc < 0 or not os.path.exists(trace_path):
+            return None, elapsed
+
+        errnos, points = {}, []
+        allocs = 0
+        with open(trace_path) as f:
+            for line in f:
+                parts = line.split()
+                if parts[0] == "errnos":
+                    errnos[parts[1]] = [int(e) for e in parts[2:]]
+                elif parts[0] == "allocs":
+                    allocs = int(parts[1])
+                elif parts[0] == "syscall":
+                    # Steps taken before the library could record them
+                    # are tried with EIO
+                    step, func = int(parts[1]), parts[2]
+                    for err in errnos.get(func, [errno.EIO]):
+                        points.append(FaultPoint("syscall", step, func, err))
+        os.remove(trace_path)
+        points.extend(FaultPoint("alloc", step, "malloc", ENOMEM)
+                      for step in range(allocs))
+        return points, elapsed
+
+    def explore(self, idx, point, timeout):
+        path, rc = self.run("run{}".format(idx), point.env(), timeout)
+        fired = any(os.path.exists(os.path.join(path, marker))
+                    for marker in (".ebb_syscall_fired", ".ebb_alloc_fired"))
+        crash = read_crash(os.path.join(path, "crash"))
+        if not self.args.keep:
+            shutil.rmtree(path, ignore_errors=True)
+
+        if rc is None:
+            outcome = "hang"
+        elif rc < 0 or crash is not None:
+            outcome = "crash"
+        elif not fired:
+            outcome = "unreached"
+        else:
+            outcome = "ok"
+        signature = None
+        if outcome == "crash":
+            signature = crash_signature(crash, rc)
+        return {"point": point, "outcome": outcome, "rc": rc,
+                "signature": signature, "frames": crash and crash["frames"],
+                "signal": crash["signal"] if crash else None}
+
+
+def read_crash(path):
+    """The first crash recorded in a crash log, or None"""
+    try:
+        with open(path) as f:
+            lines = f.read().splitlines()
+    except OSError:
+        return None
+    for i, line in enumerate(lines):
+        if line.startswith("crash "):
+            frames = []
+            for frame in lines[i + 1:]:
+                if frame == "end":
+                    break
+                where, _, sym = frame.strip().partition(" ")
+                module, _, offset = where.rpartition("+")
+                frames.append((module, offset, sym))
+            return {"signal": line.split(" ", 2)[2], "frames": frames}
+    return None
+
+
+def crash_signature(crash, rc):
+    """Frames identifying where a crash happened, independent of ASLR"""
+    if crash is None:
+        return "signal {} (no backtrace)".format(-rc)
+    useful = [f for f in crash["frames"]
+              if not os.path.basename(f[0]).startswith(NOISE_MODULES)]
+    frames = (useful or crash["frames"])[:SIGNATURE_FRAMES]
+    return "{}: {}".format(crash["signal"], " < ".join(
+        "{}+{}".format(os.path.basename(m), off) for m, off, _ in frames))
+
+
+def summarize(results, npoints, elapsed, jobs, args):
+    kinds = {}
+    for r in results:
+        kinds.setdefault(r["point"].kind, set()).add(r["point"].step)
+    nsys = sum(1 for r in results if r["point"].kind == "syscall")
+    nalloc = npoints - nsys
+    print("fault space: {} syscall steps ({} points), {} alloc steps "
+          "({} points)".format(len(kinds.get("syscall", ())), nsys,
+                               len(kinds.get("alloc", ())), nalloc))
+    print("ran {} points in {:.1f}s with {} worker{}".format(
+        npoints, elapsed, jobs, "" if jobs == 1 else "s"))
+
+    counts = {o: 0 for o in ("ok", "unreached", "hang", "crash")}
+    for r in results:
+        counts[r["outcome"]] += 1
+    crashes = {}
+    for r in results:
+        if r["outcome"] == "crash":
+            crashes.setdefault(r["signature"], []).append(r)
+    print("ok {}, unreached {}, hangs {}, crashes {} ({} unique)".format(
+        counts["ok"], counts["unreached"], counts["hang"], counts["crash"],
+        len(crashes)))
+
+    cmd = " ".join(shlex.quote(a) for a in args.cmd)
+    if args.skel:
+        cmd += " IN"
+    ordered = sorted(crashes.items(), key=lambda kv: -len(kv[1]))
+    for n, (signature, group) in enumerate(ordered, 1):
+        first = group[0]
+        print()
+        print("crash {}: {} point{}, first {}".format(
+            n, len(group), "" if len(group) == 1 else "s",
+            first["point"].describe()))
+        print("    " + signature)
+        frames = [f for f in first["frames"] or []
+                  if not os.path.basename(f[0]).startswith(NOISE_MODULES[0])]
+        for module, offset, sym in frames[:8]:
+            print("    {}+{} {}".format(module, offset, sym))
+        print("    reproduce: {} LD_PRELOAD={} {}".format(
+            " ".join("{}={}".format(k, v)
+                     for k, v in first["point"].env().items()),
+            EBB_LIB, cmd))
+    hangs = [r for r in results if r["outcome"] == "hang"]
+    for r in hangs[:10]:
+        print("hang: " + r["point"].describe())
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump([{"kind": r["point"].kind, "step": r["point"].step,
+                        "func": r["point"].func, "errno": r["point"].err,
+                        "outcome": r["outcome"], "rc": r["rc"],
+                        "signature": r["signature"]} for r in results],
+                      f, indent=1)
+    return 1 if crashes or hangs else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Run every EvilBoomBox failure point of a workload")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(),
+                        help="runs at once (default: one per CPU)")
+    parser.add_argument("--timeout", type=float,
+                        help="seconds before a run is a hang "
+                             "(default: 10 times the traced run, at least 5)")
+    parser.add_argument("--kinds", default="syscall,alloc",
+                        help="which countdowns to explore")
+    parser.add_argument("--skel", help="test-spec skel to pass as input")
+    parser.add_argument("--json", help="write every run's outcome here")
+    parser.add_argument("--keep", action="store_true",
+                        help="keep the sandboxes (in $TMPDIR/ebb-explore-*)")
+    parser.add_argument("cmd", nargs=argparse.REMAINDER)
+    args = parser.parse_args()
+    if not args.cmd:
+        parser.error("no workload given")
+    jobs = max(1, args.jobs)
+    kinds = set(args.kinds.split(","))
+
+    subprocess.run(["flock", EBB_DIR, "make", "-s", "-C", EBB_DIR], check=True,
+                   stdout=subprocess.DEVNULL)
+    explorer = Explorer(args)
+    try:
+        points, traced = explorer.trace()
+        if points is None:
+            print("ebb-explore: the workload failed without any faults",
+                  file=sys.stderr)
+            return 2
+        points = [p for p in points if p.kind in kinds]
+        timeout = args.timeout or max(5.0, 10 * traced)
+
+        start = time.monotonic()
+        with concurrent.futures.ThreadPoolExecutor(jobs) as pool:
+            results = list(pool.map(
+                lambda ip: explorer.explore(ip[0], ip[1], timeout),
+                enumerate(points)))
+        elapsed = time.monotonic() - start
+        return summarize(results, len(points), elapsed, jobs, args)
+    finally:
+        if not args.keep:
+            shutil.rmtree(explorer.root, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,16 +1,20 @@
 #define _GNU_SOURCE
 #include <assert.h>
 #include <fcntl.h>
+#include <malloc.h>
 #include <stdatomic.h> // Seriously?
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include <dlfcn.h>
 
 #include "debug.h"
+#include "faults.h"
+#include "profile.h"
 
 // To avoid needing three variables (and the mess that entails), all calls to
 // calloc/realloc are hooked via the system malloc. This results in just one
@@ -31,9 +35,11 @@ in an infinite recursion of malloc() -> dlsym() -> malloc() (where malloc is our
 injected version) which blows the stack.
 
 To solve this, we borrow an idea from https://stackoverflow.com/a/10008252.
-We make a primitive bump-allocator using the space in mybuf, and use that
-space while initializing our system function pointers with dlsym. If we run
-out of space in that arena, then library initialization has failed.
+We make a primitive bump-allocator in a small arena, and use that space while
+initializing our system function pointers with dlsym. The arena is mmapped on
+first use rather than reserved statically, so a process that never needs it
+pays nothing for it. dlsym only needs a few hundred bytes; if we run out of
+space in that arena, then library initialization has failed.
 
 Once the appropriate dlsym() calls have been made, we no longer need to worry
 about infinite recursion on malloc(). From that point on, all memory allocation
@@ -43,8 +49,9 @@ free() to check if they came from our bump arena.
 */
 
 // Variables used to track the bump allocator during the initialization phase.
-#define ARENA_SIZE 1000000000
-static char mybuf[ARENA_SIZE];
+#define ARENA_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+static char *arena; // NULL until init_malloc first runs
 static _Atomic bool sysfuncsReady;
 static _Atomic bool sysfuncsInitInProgress;
 
@@ -132,9 +139,10 @@ static void ebb_alloc_check_try_init() {
 static bool check_and_dec_ctr() {
 
   // Within EBB function calls, we do not decrement or explode at all.
-  if (withinEBB) {
+  if (withinEBB || prof_active()) {
     return false;
   }
+  fault_trace_alloc();
 
   /* See if we should asplode the function on this call. If not, move us closer
      to the countdown. The only time we should return NULL is if the counter is
@@ -146,7 +154,7 @@ static bool check_and_dec_ctr() {
       exploded = true;
       DEBUG_PRINT("BOOM. alloc has failed.\n");
 
-      creat(ALLOC_TRIGGERED_FILENAME, S_IRUSR);
+      fault_fired(ALLOC_TRIGGERED_FILENAME);
       return true;
     } else {
       --allocCtr;
@@ -159,29 +167,44 @@ static bool check_and_dec_ctr() {
 // on a flat address space for this to work. See link for how this can fail
 // on x86: https://devblogs.microsoft.com/oldnewthing/20170927-00/?p=97095
 static bool ptr_from_internal_arena(void *ptr) {
-  uintptr_t arena_start = (uintptr_t)mybuf;
-  uintptr_t arena_end = (uintptr_t)(mybuf + ARENA_SIZE);
+  if (arena == NULL) {
+    return false;
+  }
+  uintptr_t arena_start = (uintptr_t)arena;
+  uintptr_t arena_end = (uintptr_t)(arena + ARENA_SIZE);
   uintptr_t test = (uintptr_t)ptr;
   return arena_start <= test && test < arena_end;
 }
 
 // A toy bump-allocator that is only used during the initialization phase.
-// Bumps high-to-low because of **tradition**, dammit.
+// Bumps high-to-low because of **tradition**, dammit. Fresh anonymous pages
+// are zeroed and nothing is reused, so this serves calloc as well.
 void *init_malloc(size_t nbytes) {
-  static char *bump_ptr = mybuf + ARENA_SIZE;
+  static char *bump_ptr;
   static bool err_msg_written = false;
 
-  bump_ptr -= nbytes;
-  bool out_of_space = (uintptr_t)bump_ptr < (uintptr_t)mybuf;
-  if (out_of_space) {
+  if (arena == NULL) {
+    arena = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED) {
+      arena = NULL;
+      return NULL;
+    }
+    bump_ptr = arena + ARENA_SIZE;
+  }
+
+  size_t space = (uintptr_t)bump_ptr - (uintptr_t)arena;
+  if (nbytes > space) {
     if (!err_msg_written) {
       char err_msg[48] = "EBB: Out of space during malloc initialization!";
-      int unused = write(STDERR_FILENO, err_msg, 48); 
-      (void)unused;// Can't really do anything if it fails
+      int unused = write(STDERR_FILENO, err_msg, 48);
+      (void)unused; // Can't really do anything if it fails
       err_msg_written = true;
-      return NULL;
     }
+    return NULL;
   }
+  bump_ptr -= nbytes;
+  bump_ptr -= (uintptr_t)bump_ptr % ARENA_ALIGN;
   return bump_ptr;
 }
 
@@ -193,23 +216,27 @@ void *malloc(size_t nbytes) {
   }
 
   ebb_alloc_check_try_init();
-  if (check_and_dec_ctr()) {
-    return NULL;
-  } else {
-    return sysMalloc(nbytes);
-  }
+  void *rv = check_and_dec_ctr() ? NULL : sysMalloc(nbytes);
+  prof_alloc(rv, nbytes);
+  return rv;
 }
 
 void *calloc(size_t c, size_t n) {
-  ebb_alloc_check_try_init();
-  if (check_and_dec_ctr()) {
-    return NULL;
-  } else {
-    return sysCalloc(c, n);
+  if (sysfuncsInitInProgress) {
+    return n != 0 && c > SIZE_MAX / n ? NULL : init_malloc(c * n);
   }
+
+  ebb_alloc_check_try_init();
+  void *rv = check_and_dec_ctr() ? NULL : sysCalloc(c, n);
+  prof_alloc(rv, c * n);
+  return rv;
 }
 
 void *realloc(void *ptr, size_t size) {
+  if (sysfuncsInitInProgress) {
+    return init_malloc(size);
+  }
+
   ebb_alloc_check_try_init();
 
   // Requesting realloc of an arena pointer. Satisfy the request by allocating
@@ -219,10 +246,20 @@ void *realloc(void *ptr, size_t size) {
   }
 
   if (check_and_dec_ctr()) {
+    prof_alloc(NULL, size);
     return NULL;
-  } else {
-    return sysRealloc(ptr, size);
   }
+  // Counted as a free of the old block and an allocation of the new one, but
+  // only once it succeeded: a failed realloc leaves the old block alone
+  size_t old_usable = ptr != NULL ? malloc_usable_size(ptr) : 0;
+  void *rv = sysRealloc(ptr, size);
+  if (rv != NULL || size == 0) {
+    prof_freed(ptr, old_usable);
+  }
+  if (rv != NULL || size != 0) {
+    prof_alloc(rv, size);
+  }
+  return rv;
 }
 
 void free(void *ptr) {
@@ -230,6 +267,7 @@ void free(void *ptr) {
     return;
   }
   if (!ptr_from_internal_arena(ptr)) {
+    prof_free(ptr);
     sysFree(ptr);
   }
   // If pointer is from bump area, free() is a no-op
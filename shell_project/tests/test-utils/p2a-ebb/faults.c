@@ -0,0 +1,174 @@
+/** Tracing the fault space and recording crashes. See faults.h. */
+
+#define _GNU_SOURCE
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <dlfcn.h>
+
+#include "faults.h"
+
+#define TRACE_MAX (1 << 22) // syscall steps remembered; more are only counted
+#define CRASH_FRAMES 32
+
+// Defined within other.c
+extern int NumFailureModes[];
+extern int *FailureModes[];
+
+static const char *const funcNames[NUM_FALLIABLE] = {
+    "open",  "close",   "fopen",   "fclose", "fseek", "creat",
+    "dup2",  "getcwd",  "getline", "execv",  "fork",  "wait"};
+
+static bool tracing;
+static char traceFile[4096];
+static uint8_t *syscallSteps; // 1 + the function of each step; 0 if unknown
+static _Atomic uint64_t syscallCount, allocCount;
+
+static int forcedErrno;
+static const char *firedDir;
+static int crashFd = -1;
+
+// Steps are counted from the very first call, as the countdowns are, even
+// though calls made before our constructor runs cannot be recorded.
+void fault_trace_syscall(enum FalliableFunc func) {
+  uint64_t step = atomic_fetch_add_explicit(&syscallCount, 1,
+                                            memory_order_relaxed);
+  if (tracing && step < TRACE_MAX) {
+    syscallSteps[step] = func + 1;
+  }
+}
+
+void fault_trace_alloc(void) {
+  atomic_fetch_add_explicit(&allocCount, 1, memory_order_relaxed);
+}
+
+int fault_forced_errno(void) { return forcedErrno; }
+
+void fault_fired(const char *name) {
+  char path[4096];
+  if (firedDir != NULL) {
+    snprintf(path, sizeof(path), "%s/%s", firedDir, name);
+    name = path;
+  }
+  // Straight to the kernel: the hooked creat would be a countdown step itself
+  int fd = syscall(SYS_openat, AT_FDCWD, name, O_WRONLY | O_CREAT | O_TRUNC,
+                   S_IRUSR);
+  if (fd >= 0) {
+    syscall(SYS_close, fd);
+  }
+}
+
+/* A forked child's calls are not the traced process's */
+static void stop_tracing(void) { tracing = false; }
+
+/* Write the frames of this crash as "file+offset symbol+offset" lines. Only
+   async-signal-safe in practice: backtrace() was warmed up at startup. */
+static void crash_handler(int sig) {
+  void *frames[CRASH_FRAMES];
+  int n = backtrace(frames, CRASH_FRAMES);
+  dprintf(crashFd, "crash %d %s\n", (int)getpid(), strsignal(sig));
+  for (int i = 0; i < n; i++) {
+    Dl_info info;
+    if (dladdr(frames[i], &info) && info.dli_fname != NULL) {
+      dprintf(crashFd, "  %s+%#lx %s\n", info.dli_fname,
+              (unsigned long)((char *)frames[i] - (char *)info.dli_fbase),
+              info.dli_sname != NULL ? info.dli_sname : "?");
+    } else {
+      dprintf(crashFd, "  ?+%p ?\n", frames[i]);
+    }
+  }
+  dprintf(crashFd, "end\n");
+  // SA_RESETHAND put the default action back; die of the same signal
+  raise(sig);
+}
+
+static void install_crash_handler(const char *path) {
+  crashFd = syscall(SYS_openat, AT_FDCWD, path,
+                    O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (crashFd < 0) {
+    return;
+  }
+  // Keep it out of the way of descriptors the workload expects to get
+  int high = fcntl(crashFd, F_DUPFD_CLOEXEC, 100);
+  if (high >= 0) {
+    syscall(SYS_close, crashFd);
+    crashFd = high;
+  }
+  void *frames[1];
+  backtrace(frames, 1); // loads libgcc now rather than in the handler
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = crash_handler;
+  sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+  int sigs[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+  for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++) {
+    sigaction(sigs[i], &sa, NULL);
+  }
+}
+
+__attribute__((constructor)) static void faults_init(void) {
+  char *s = getenv(SYSCALL_ERRNO_ENV_NAME);
+  forcedErrno = s != NULL ? atoi(s) : 0;
+  firedDir = getenv(FIRED_DIR_ENV_NAME);
+  if ((s = getenv(CRASH_TRACE_ENV_NAME)) != NULL) {
+    install_crash_handler(s);
+  }
+
+  s = getenv(FAULT_TRACE_ENV_NAME);
+  if (s == NULL) {
+    return;
+  }
+  syscallSteps = mmap(NULL, TRACE_MAX, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (syscallSteps == MAP_FAILED) {
+    return;
+  }
+  snprintf(traceFile, sizeof(traceFile), "%s", s);
+  // Only this process traces: not children it forks, nor what they exec
+  unsetenv(FAULT_TRACE_ENV_NAME);
+  pthread_atfork(NULL, NULL, stop_tracing);
+  tracing = true;
+}
+
+__attribute__((destructor)) static void faults_report(void) {
+  if (!tracing) {
+    return;
+  }
+  tracing = false;
+  // Before dprintf, which allocates
+  uint64_t allocs = allocCount;
+  uint64_t steps = syscallCount;
+  int fd = syscall(SYS_openat, AT_FDCWD, traceFile,
+                   O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return;
+  }
+  for (int f = 0; f < NUM_FALLIABLE; f++) {
+    dprintf(fd, "errnos %s", funcNames[f]);
+    for (int i = 0; i < NumFailureModes[f]; i++) {
+      dprintf(fd, " %d", FailureModes[f][i]);
+    }
+    dprintf(fd, "\n");
+  }
+  dprintf(fd, "allocs %llu\n", (unsigned long long)allocs);
+  dprintf(fd, "syscalls %llu\n", (unsigned long long)steps);
+  for (uint64_t i = 0; i < steps && i < TRACE_MAX; i++) {
+    int f = syscallSteps[i];
+    dprintf(fd, "syscall %llu %s\n", (unsigned long long)i,
+            f == 0 ? "?" : funcNames[f - 1]);
+  }
+  syscall(SYS_close, fd);
+}
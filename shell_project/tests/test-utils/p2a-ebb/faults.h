@@ -0,0 +1,55 @@
+#ifndef EBB_FAULTS_H
+#define EBB_FAULTS_H
+
+/* Support for exploring the fault space from outside (see ebb-explore.py).
+
+EBB_FAULT_TRACE=FILE makes the process that loaded the library (not its
+children) write every call it made that a countdown could fail: which of
+the functions below each syscall countdown step was, and how many steps
+the allocation countdown took. With it come the errnos other.c can pick for
+each function, so a driver can enumerate every (call, errno) failure point.
+
+EBB_SYSCALL_ERRNO=E fails the chosen syscall with errno E rather than one
+picked from the table.
+
+EBB_FIRED_DIR=DIR creates the .ebb_*_fired marker files in DIR rather than
+the current directory, so runs in parallel do not see each other's.
+
+EBB_CRASH_TRACE=FILE appends a backtrace to FILE when any process of the
+workload dies of SIGSEGV, SIGBUS, SIGFPE, SIGILL or SIGABRT. */
+
+#define FAULT_TRACE_ENV_NAME "EBB_FAULT_TRACE"
+#define SYSCALL_ERRNO_ENV_NAME "EBB_SYSCALL_ERRNO"
+#define FIRED_DIR_ENV_NAME "EBB_FIRED_DIR"
+#define CRASH_TRACE_ENV_NAME "EBB_CRASH_TRACE"
+
+/* The syscalls other.c can fail. Must match the tables there. */
+enum FalliableFunc {
+  Open,
+  Close,
+  Fopen,
+  Fclose,
+  Fseek,
+  Creat,
+  Dup2,
+  Getcwd,
+  Getline,
+  Execv,
+  Fork,
+  Wait,
+  NUM_FALLIABLE
+};
+
+/** Record one step of the syscall countdown, a call to `func` */
+void fault_trace_syscall(enum FalliableFunc func);
+
+/** Record one step of the allocation countdown */
+void fault_trace_alloc(void);
+
+/** The errno EBB_SYSCALL_ERRNO forces, or 0 */
+int fault_forced_errno(void);
+
+/** Create the marker file `name` that says a failure was injected */
+void fault_fired(const char *name);
+
+#endif
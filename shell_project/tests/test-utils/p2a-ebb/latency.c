@@ -0,0 +1,281 @@
+/** Latency injection. See latency.h for the settings. */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <dlfcn.h>
+
+#include "debug.h"
+#include "latency.h"
+#include "report.h"
+
+#define DELAY_ENV_PREFIX "EBB_DELAY_"
+#define DELAY_SEED_ENV_NAME "EBB_DELAY_SEED"
+#define DELAY_REPORT_ENV_NAME "EBB_DELAY_REPORT"
+#define PARETO_DEFAULT_CAP 1000 // times MIN
+
+enum Dist { DistNone, DistFixed, DistUniform, DistPareto };
+
+/** How one kind of call is slowed, and what was injected into it */
+struct Delay {
+  enum Dist dist;
+  double a, b, c; // fixed: a ns. uniform: a to b ns. pareto: MIN a, ALPHA b, cap c
+  char spec[64];
+  _Atomic uint64_t calls, delayed, totalNs, maxNs;
+};
+
+static const char *const kindNames[NUM_LAT_KINDS] = {"read", "write", "open",
+                                                     "fork", "exec",  "wait"};
+static struct Delay delays[NUM_LAT_KINDS];
+static bool injecting; // false until the constructor has read the settings
+static uint64_t seed = 1;
+static pid_t latPid;
+static int stderrCopy = -1; // see report.h
+
+#define COUNT(var, n) atomic_fetch_add_explicit(&(var), (n), memory_order_relaxed)
+
+/* Parse a duration at s into nanoseconds. Returns the end, or NULL. */
+static const char *parse_duration(const char *s, double *ns) {
+  char *end;
+  double v = strtod(s, &end);
+  if (end == s || v < 0) {
+    return NULL;
+  }
+  static const struct { const char *suffix; double scale; } units[] = {
+      {"ns", 1}, {"us", 1e3}, {"ms", 1e6}, {"s", 1e9}};
+  double scale = 1e3;
+  for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+    size_t len = strlen(units[i].suffix);
+    if (strncmp(end, units[i].suffix, len) == 0) {
+      scale = units[i].scale;
+      end += len;
+      break;
+    }
+  }
+  *ns = v * scale;
+  return end;
+}
+
+/* Fill in `d` from a spec like "uniform:100us:2ms". Returns -1 if it is bad. */
+static int parse_spec(const char *spec, struct Delay *d) {
+  const char *c = strchr(spec, ':');
+  if (c == NULL) {
+    return -1;
+  }
+  size_t len = c - spec;
+  bool pareto = len == 6 && strncmp(spec, "pareto", 6) == 0;
+  double v[3];
+  int n = 0;
+  while (*c == ':' && n < 3) {
+    if (pareto && n == 1) {
+      // ALPHA is a plain number
+      char *end;
+      v[n] = strtod(c + 1, &end);
+      c = end == c + 1 ? NULL : end;
+    } else {
+      c = parse_duration(c + 1, &v[n]);
+    }
+    if (c == NULL) {
+      return -1;
+    }
+    n++;
+  }
+  if (*c != '\0') {
+    return -1;
+  }
+
+  if (len == 5 && strncmp(spec, "fixed", 5) == 0 && n == 1) {
+    d->dist = DistFixed;
+  } else if (len == 7 && strncmp(spec, "uniform", 7) == 0 && n == 2 &&
+             v[0] <= v[1]) {
+    d->dist = DistUniform;
+  } else if (pareto && n >= 2 && v[0] > 0 && v[1] > 0) {
+    d->dist = DistPareto;
+    v[2] = n == 3 ? v[2] : v[0] * PARETO_DEFAULT_CAP;
+  } else {
+    return -1;
+  }
+  d->a = v[0];
+  d->b = n > 1 ? v[1] : 0;
+  d->c = n > 2 || pareto ? v[2] : 0;
+  snprintf(d->spec, sizeof(d->spec), "%s", spec);
+  return 0;
+}
+
+static uint64_t splitmix64(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+/* The delay for call number `idx` of `kind`, in nanoseconds */
+static uint64_t draw(enum LatencyKind kind, uint64_t idx) {
+  const struct Delay *d = &delays[kind];
+  uint64_t x = splitmix64(splitmix64(seed * NUM_LAT_KINDS + kind) + idx);
+  double u = (x >> 11) * 0x1.0p-53; // uniform on [0, 1)
+  double ns;
+  switch (d->dist) {
+  case DistFixed:
+    ns = d->a;
+    break;
+  case DistUniform:
+    ns = d->a + u * (d->b - d->a);
+    break;
+  case DistPareto:
+    ns = d->a / pow(1 - u, 1 / d->b);
+    ns = ns < d->c ? ns : d->c;
+    break;
+  default:
+    ns = 0;
+  }
+  return (uint64_t)ns;
+}
+
+void latency_inject(enum LatencyKind kind) {
+  if (!injecting) {
+    return;
+  }
+  struct Delay *d = &delays[kind];
+  uint64_t idx = COUNT(d->calls, 1);
+  if (d->dist == DistNone) {
+    return;
+  }
+  uint64_t ns = draw(kind, idx);
+  if (ns == 0) {
+    return;
+  }
+  COUNT(d->delayed, 1);
+  COUNT(d->totalNs, ns);
+  uint64_t max = atomic_load_explicit(&d->maxNs, memory_order_relaxed);
+  while (ns > max && !atomic_compare_exchange_weak(&d->maxNs, &max, ns)) {
+  }
+
+  struct timespec left = {ns / 1000000000, ns % 1000000000};
+  while (clock_nanosleep(CLOCK_MONOTONIC, 0, &left, &left) == EINTR) {
+  }
+}
+
+/* The calls other.c does not already hook. They only ever slow down; failing
+   them would change what the evilboombox test counts. The real functions are
+   looked up once, since read and write are hot. */
+
+typedef ssize_t read_ty(int, void *, size_t);
+typedef ssize_t write_ty(int, const void *, size_t);
+typedef pid_t waitpid_ty(pid_t, int *, int);
+typedef pid_t wait4_ty(pid_t, int *, int, struct rusage *);
+
+static read_ty *sysRead;
+static write_ty *sysWrite;
+static waitpid_ty *sysWaitpid;
+static wait4_ty *sysWait4;
+
+__attribute__((constructor)) static void latency_init(void) {
+  bool any = false;
+  for (int k = 0; k < NUM_LAT_KINDS; k++) {
+    char name[32] = DELAY_ENV_PREFIX;
+    size_t len = strlen(name);
+    for (const char *c = kindNames[k]; *c != '\0'; c++) {
+      name[len++] = toupper((unsigned char)*c);
+    }
+    name[len] = '\0';
+    char *spec = getenv(name);
+    if (spec == NULL) {
+      continue;
+    }
+    if (parse_spec(spec, &delays[k]) < 0) {
+      fprintf(stderr, "EBB: ignoring bad %s '%s'\n", name, spec);
+      continue;
+    }
+    any = true;
+  }
+  char *seed_s = getenv(DELAY_SEED_ENV_NAME);
+  if (seed_s != NULL) {
+    seed = strtoull(seed_s, NULL, 0);
+  }
+  char *report = getenv(DELAY_REPORT_ENV_NAME);
+  stderrCopy = report_prepare(report);
+  latPid = getpid();
+  // Look these up now rather than on first use, which may be in a signal
+  // handler (utcsh reaps jobs with wait4 from its SIGCHLD handler)
+  sysRead = (read_ty *)dlsym(RTLD_NEXT, "read");
+  sysWrite = (write_ty *)dlsym(RTLD_NEXT, "write");
+  sysWaitpid = (waitpid_ty *)dlsym(RTLD_NEXT, "waitpid");
+  sysWait4 = (wait4_ty *)dlsym(RTLD_NEXT, "wait4");
+  injecting = any || report != NULL;
+  DEBUG_PRINT("Latency injection %s, seed %llu\n", any ? "on" : "off",
+              (unsigned long long)seed);
+}
+
+__attribute__((destructor)) static void latency_report(void) {
+  char *spec = getenv(DELAY_REPORT_ENV_NAME);
+  // Like the allocation profile, only the process that loaded us reports
+  if (!injecting || spec == NULL || getpid() != latPid) {
+    return;
+  }
+  // The report may be written through our own write(); don't delay or count
+  // its writes
+  injecting = false;
+  int fd = report_open(spec, stderrCopy);
+  if (fd < 0) {
+    fprintf(stderr, "EBB: cannot write the latency report: %s\n",
+            strerror(errno));
+    return;
+  }
+  dprintf(fd, "== ebb latency: pid %d (%s), seed %llu\n", (int)latPid,
+          program_invocation_name, (unsigned long long)seed);
+  dprintf(fd, "%-6s %8s %8s %12s %10s  %s\n", "kind", "calls", "delayed",
+          "total_ms", "max_ms", "spec");
+  for (int k = 0; k < NUM_LAT_KINDS; k++) {
+    const struct Delay *d = &delays[k];
+    dprintf(fd, "%-6s %8llu %8llu %12.3f %10.3f  %s\n", kindNames[k],
+            (unsigned long long)d->calls, (unsigned long long)d->delayed,
+            d->totalNs / 1e6, d->maxNs / 1e6,
+            d->dist == DistNone ? "-" : d->spec);
+  }
+  report_close(fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+  latency_inject(LatRead);
+  if (sysRead == NULL) {
+    sysRead = (read_ty *)dlsym(RTLD_NEXT, "read");
+  }
+  return sysRead(fd, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+  latency_inject(LatWrite);
+  if (sysWrite == NULL) {
+    sysWrite = (write_ty *)dlsym(RTLD_NEXT, "write");
+  }
+  return sysWrite(fd, buf, count);
+}
+
+pid_t waitpid(pid_t pid, int *wstatus, int options) {
+  latency_inject(LatWait);
+  if (sysWaitpid == NULL) {
+    sysWaitpid = (waitpid_ty *)dlsym(RTLD_NEXT, "waitpid");
+  }
+  return sysWaitpid(pid, wstatus, options);
+}
+
+pid_t wait4(pid_t pid, int *wstatus, int options, struct rusage *rusage) {
+  latency_inject(LatWait);
+  if (sysWait4 == NULL) {
+    sysWait4 = (wait4_ty *)dlsym(RTLD_NEXT, "wait4");
+  }
+  return sysWait4(pid, wstatus, options, rusage);
+}
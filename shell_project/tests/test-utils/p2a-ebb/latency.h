@@ -0,0 +1,35 @@
+#ifndef EBB_LATENCY_H
+#define EBB_LATENCY_H
+
+/* Latency injection.
+
+Each kind of call below can be slowed down by setting EBB_DELAY_<KIND> (for
+example EBB_DELAY_OPEN) to one of
+
+    fixed:D              always D
+    uniform:LO:HI        uniform between LO and HI
+    pareto:MIN:ALPHA     heavy-tailed: at least MIN, P(delay > x) = (MIN/x)^ALPHA
+    pareto:MIN:ALPHA:MAX the same, capped at MAX (otherwise at 1000 * MIN)
+
+Durations are microseconds unless they end in ns, us, ms or s. The delay is
+slept before the real call. Delays come from a counter-based generator seeded
+by EBB_DELAY_SEED (default 1) with a stream per kind, so the n-th read always
+gets the same delay however the calls of other kinds interleave, and a run can
+be replayed exactly.
+
+With EBB_DELAY_REPORT set (a report spec, see report.h), the process that
+loaded the library appends how many calls of each kind it made, how many were
+delayed and the total and largest delay injected. The totals are of the
+delays drawn, not of measured sleeps, so they are reproducible too.
+
+Only calls that go through the dynamic linker are seen. The C library's own
+stdio reads and writes call the kernel directly, so a program reading with
+fgetc is slowed through OPEN (fopen) and READ (getline), not per buffer. */
+
+enum LatencyKind { LatRead, LatWrite, LatOpen, LatFork, LatExec, LatWait,
+                   NUM_LAT_KINDS };
+
+/** Sleep for the next delay drawn for `kind`, if that kind is slowed */
+void latency_inject(enum LatencyKind kind);
+
+#endif
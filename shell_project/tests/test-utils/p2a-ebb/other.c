@@ -11,21 +11,8 @@
 #include <dlfcn.h>
 
 #include "debug.h"
-
-enum FalliableFunc {
-  Open,
-  Close,
-  Fopen,
-  Fclose,
-  Fseek,
-  Creat,
-  Dup2,
-  Getcwd,
-  Getline,
-  Execv,
-  Fork,
-  Wait
-};
+#include "faults.h"
+#include "latency.h"
 
 typedef int (*open_ty)(const char *pathname, int flags);
 typedef int (*close_ty)(int fd);
@@ -74,6 +61,10 @@ int *FailureModes[12] = {OpenFailures,   CloseFailures,  FopenFailures,
 
 /* Returns an appropriate failure for the given function call */
 int randomize_failure_kind(enum FalliableFunc funcCalled) {
+  int forced = fault_forced_errno();
+  if (forced != 0) {
+    return forced;
+  }
   int idx = (int)funcCalled;
   int *validFailureModes = FailureModes[idx];
   int failIdx = rand() % NumFailureModes[idx];
@@ -116,7 +107,9 @@ extern _Atomic bool withinEBB;
 #define SYSCALL_COUNTDOWN_TIMER_NAME "EBB_SYSCALL_CTR"
 #define SYSCALL_TRIGGERED_FILENAME ".ebb_syscall_fired"
 
-static bool check_and_dec_ctr() {
+static bool check_and_dec_ctr(enum FalliableFunc func) {
+  fault_trace_syscall(func);
+
   // If it has not been done yet, initialize our countdown from the environ
   if (!countdownIsInit) {
     countdownIsInit = true;
@@ -150,7 +143,7 @@ static bool check_and_dec_ctr() {
       exploded = true;
       DEBUG_PRINT("BOOM. alloc has failed.\n");
 
-      creat(SYSCALL_TRIGGERED_FILENAME, S_IRUSR);
+      fault_fired(SYSCALL_TRIGGERED_FILENAME);
       return true;
     } else {
       --syscallCtr;
@@ -160,9 +153,10 @@ static bool check_and_dec_ctr() {
 }
 
 int open(const char *pathname, int flags, ...) {
+  latency_inject(LatOpen);
   withinEBB = true;
   int rv;
-  if (check_and_dec_ctr()) {
+  if (check_and_dec_ctr(Open)) {
     rv = syscall_fail(Open);
   } else {
     open_ty openFunc = dlsym(RTLD_NEXT, "open");
@@ -175,7 +169,7 @@ int open(const char *pathname, int flags, ...) {
 int close(int fd) {
   withinEBB = true;
   int rv;
-  if (check_and_dec_ctr()) {
+  if (check_and_dec_ctr(Close)) {
     rv = syscall_fail(Close);
   } else {
     close_ty closeFunc = dlsym(RTLD_NEXT, "close");
@@ -185,9 +179,10 @@ int close(int fd) {
 }
 
 FILE *fopen(const char *restrict pathname, const char *restrict mode) {
+  latency_inject(LatOpen);
   withinEBB = true;
   FILE *rv = NULL;
-  if (check_and_dec_ctr()) {
+  if (check_and_dec_ctr(Fopen)) {
     syscall_fail(Fopen); // Just for setting errno
     rv = NULL;
   } else {
@@ -201,7 +196,7 @@ FILE *fopen(const char *restrict pathname, const char *restrict mode) {
 int fclose(FILE *stream) {
   withinEBB = true;
   int rv;
-  if (check_and_dec_ctr()) {
+  if (check_and_dec_ctr(Fclose)) {
     rv = syscall_fail(Fclose);
   } else {
     fclose_ty fcloseFunc = dlsym(RTLD_NEXT, "fclose");
@@ -214,7 +209,7 @@ int fclose(FILE *stream) {
 int fseek(FILE *stream, long offset, int whence) {
   withinEBB = true;
   int rv;
-  if (check_and_dec_ctr()) {
+  if (check_and_dec_ctr(Fseek)) {
     rv = syscall_fail(Fseek);
   } else {
     fseek_ty fseekFunc = dlsym(RTLD_NEXT, "fseek");
@@ -225,9 +220,10 @@ int fseek(FILE *stream, long offset, int whence) {
 }
 
 int creat(const char *path, mode_t mode) {
+  latency_inject(LatOpen);
   withinEBB = true;
   int rv;
-  if (check_and_dec_ctr()) {
+  if (check_and_dec_ctr(Creat)) {
     rv = syscall_fail(Creat);
   } else {
     creat_ty creatFunc = dlsym(RTLD_NEXT, "creat");
@@ -239,7 +235,7 @@ int creat(const char *path, mode_t mode) {
 int dup2(int fd1, int fd2) {
   withinEBB = true;
   int rv;
-  if (check_and_dec_ctr()) {
+  if (check_and_dec_ctr(Dup2)) {
     rv = syscall_fail(Dup2);
   } else {
     dup2_ty dup2Func = dlsym(RTLD_NEXT, "dup2");
@@ -251,7 +247,7 @@ int dup2(int fd1, int fd2) {
 char *getcwd(char *buf, size_t size) {
   withinEBB = true;
   char *rv;
-  if (check_and_dec_ctr()) {
+  if (check_and_dec_ctr(Getcwd)) {
     syscall_fail(Getcwd); // Just for setting ernno
     rv = NULL;
   } else {
@@ -270,9 +266,10 @@ char *getwd(char * name) {
 }
 ssize_t getline(char **restrict lineptr, size_t *restrict n,
                 FILE *restrict stream) {
+  latency_inject(LatRead);
   withinEBB = true;
   ssize_t rv;
-  if (check_and_dec_ctr()) {
+  if (check_and_dec_ctr(Getline)) {
     rv = syscall_fail(Getline);
   } else {
     getline_ty getlineFunc = dlsym(RTLD_NEXT, "getline");
@@ -282,9 +279,10 @@ ssize_t getline(char **restrict lineptr, size_t *restrict n,
   return rv;
 }
 int execv(const char *pathname, char *const argv[]) {
+  latency_inject(LatExec);
   withinEBB = true;
   int rv;
-  if (check_and_dec_ctr()) {
+  if (check_and_dec_ctr(Execv)) {
     rv = syscall_fail(Execv);
   } else {
     execv_ty execvFunc = dlsym(RTLD_NEXT, "execv");
@@ -294,9 +292,10 @@ int execv(const char *pathname, char *const argv[]) {
   return rv;
 }
 pid_t fork(void) {
+  latency_inject(LatFork);
   withinEBB = true;
   pid_t rv;
-  if (check_and_dec_ctr()) {
+  if (check_and_dec_ctr(Fork)) {
     rv = syscall_fail(Fork);
   } else {
     fork_ty forkFunc = dlsym(RTLD_NEXT, "fork");
@@ -306,9 +305,10 @@ pid_t fork(void) {
   return rv;
 }
 pid_t wait(int *wstatus) {
+  latency_inject(LatWait);
   withinEBB = true;
   pid_t rv;
-  if (check_and_dec_ctr()) {
+  if (check_and_dec_ctr(Wait)) {
     rv = syscall_fail(Wait);
   } else {
     wait_ty waitFunc = dlsym(RTLD_NEXT, "wait");
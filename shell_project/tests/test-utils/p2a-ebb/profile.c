@@ -0,0 +1,415 @@
+/** The allocation profiler. See profile.h for what it records and when. */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <dlfcn.h>
+
+#include "debug.h"
+#include "profile.h"
+#include "report.h"
+
+#define MAX_FRAMES 8      // frames kept per call site
+#define HOOK_FRAMES 4     // room for our own frames on top of those
+#define HIST_BUCKETS 48   // log2 size buckets; the last one takes the rest
+#define SITE_SLOTS 4096   // must be a power of two
+#define SITE_PROBES 64    // give up and use the overflow site after this many
+#define LIVE_SLOTS 65536  // sampled allocations live at once; a power of two
+#define DEFAULT_RATE 64
+#define DEFAULT_TOP 20
+
+/** One call site, identified by its backtrace. Counts are of samples only. */
+struct Site {
+  uint64_t hash;
+  int nframes;
+  void *frames[MAX_FRAMES];
+  uint64_t samples;
+  uint64_t bytes; // requested by the sampled allocations
+  int64_t live;   // requested bytes of sampled allocations not yet freed
+  int64_t peak;   // the most `live` has been
+  uint64_t hist[HIST_BUCKETS];
+};
+
+/** A sampled allocation that has not been freed yet */
+struct LiveAlloc {
+  void *ptr; // NULL marks an empty slot
+  size_t size;
+  uint32_t site;
+};
+
+static bool profiling;
+static pid_t profPid;
+static int rate = DEFAULT_RATE;
+static int top = DEFAULT_TOP;
+static void *ownBase; // where this library is loaded, to skip our own frames
+static int stderrCopy = -1; // see report.h
+
+// Both tables are mmapped when profiling starts, so an unprofiled process pays
+// nothing for them. Slot 0 of `sites` collects samples from sites that did
+// not fit. Sampled allocations and frees take tableLock.
+static struct Site *sites;
+static struct LiveAlloc *live;
+static atomic_flag tableLock = ATOMIC_FLAG_INIT;
+static _Atomic uint64_t liveSampled; // occupied slots in `live`
+
+// Exact counts over every allocation
+static _Atomic uint64_t allocs, frees, failed, bytesRequested;
+static _Atomic int64_t liveBytes, peakBytes;
+static _Atomic uint64_t hist[HIST_BUCKETS];
+static _Atomic uint64_t samples, lostSamples;
+
+// Set while the profiler itself runs, so that what it allocates (backtrace()
+// loading libgcc, the report) is neither counted nor failed on purpose. The
+// initial-exec model keeps these from calling __tls_get_addr, which can
+// allocate.
+static __thread __attribute__((tls_model("initial-exec"))) bool inProfiler;
+static __thread __attribute__((tls_model("initial-exec"))) int sampleCountdown;
+static __thread __attribute__((tls_model("initial-exec"))) uint64_t rngState;
+
+#define COUNT(var, n) atomic_fetch_add_explicit(&(var), (n), memory_order_relaxed)
+
+static int bucket(size_t size) {
+  int b = size == 0 ? 0 : 64 - __builtin_clzll(size);
+  return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+static size_t bucket_low(int b) { return b == 0 ? 0 : (size_t)1 << (b - 1); }
+
+/* Allocations until the next sample: uniform on [1, 2 * rate - 1], so one in
+   `rate` on average without locking onto a program's allocation pattern */
+static int next_countdown(void) {
+  if (rngState == 0) {
+    rngState = (uintptr_t)&rngState ^ ((uint64_t)getpid() << 32) ^ 1;
+  }
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 7;
+  rngState ^= rngState << 17;
+  return 1 + (int)(rngState % (uint64_t)(2 * rate - 1));
+}
+
+static void lock_tables(void) {
+  while (atomic_flag_test_and_set_explicit(&tableLock, memory_order_acquire)) {
+  }
+}
+
+static void unlock_tables(void) {
+  atomic_flag_clear_explicit(&tableLock, memory_order_release);
+}
+
+static uint64_t hash_frames(void **frames, int n) {
+  uint64_t h = 1469598103934665603ULL;
+  for (int i = 0; i < n; i++) {
+    h = (h ^ (uintptr_t)frames[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+/* The site for this backtrace, claiming a free slot if it is new */
+static struct Site *find_site(uint64_t hash, void **frames, int n) {
+  size_t mask = SITE_SLOTS - 1;
+  size_t i = hash & mask;
+  for (int probe = 0; probe < SITE_PROBES; probe++, i = (i + 1) & mask) {
+    if (i == 0) {
+      i = 1;
+    }
+    struct Site *site = &sites[i];
+    if (site->samples == 0) {
+      site->hash = hash;
+      site->nframes = n;
+      memcpy(site->frames, frames, n * sizeof(void *));
+      return site;
+    }
+    if (site->hash == hash && site->nframes == n &&
+        memcmp(site->frames, frames, n * sizeof(void *)) == 0) {
+      return site;
+    }
+  }
+  return &sites[0];
+}
+
+static size_t live_slot(void *ptr) {
+  return ((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL >> 48 & (LIVE_SLOTS - 1);
+}
+
+static size_t find_live(void *ptr) {
+  size_t i = live_slot(ptr);
+  while (live[i].ptr != NULL && live[i].ptr != ptr) {
+    i = (i + 1) & (LIVE_SLOTS - 1);
+  }
+  return i;
+}
+
+/* Empty slot i, shifting later entries of the probe run back into it */
+static void remove_live(size_t i) {
+  size_t j = i;
+  for (;;) {
+    live[i].ptr = NULL;
+    for (;;) {
+      j = (j + 1) & (LIVE_SLOTS - 1);
+      if (live[j].ptr == NULL) {
+        return;
+      }
+      // An entry can fill the hole unless its home slot lies in (i, j]
+      size_t home = live_slot(live[j].ptr);
+      bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+      if (!stays) {
+        break;
+      }
+    }
+    live[i] = live[j];
+    i = j;
+  }
+}
+
+/* Forget a sampled allocation, charging its bytes back to its site */
+static void untrack(size_t i) {
+  sites[live[i].site].live -= live[i].size;
+  remove_live(i);
+  atomic_fetch_sub_explicit(&liveSampled, 1, memory_order_relaxed);
+}
+
+static void __attribute__((noinline)) sample(void *ptr, size_t size) {
+  void *frames[MAX_FRAMES + HOOK_FRAMES];
+  int n = backtrace(frames, MAX_FRAMES + HOOK_FRAMES);
+  int skip = 0;
+  Dl_info info;
+  while (skip < n && dladdr(frames[skip], &info) &&
+         info.dli_fbase == ownBase) {
+    skip++;
+  }
+  n = n - skip < MAX_FRAMES ? n - skip : MAX_FRAMES;
+  uint64_t hash = hash_frames(frames + skip, n);
+
+  lock_tables();
+  struct Site *site = find_site(hash, frames + skip, n);
+  site->samples++;
+  site->bytes += size;
+  site->hist[bucket(size)]++;
+  COUNT(samples, 1);
+
+  size_t i = find_live(ptr);
+  if (live[i].ptr == ptr) {
+    // Its free went past us; whatever was here is long gone
+    untrack(i);
+    i = find_live(ptr);
+  }
+  if (liveSampled < LIVE_SLOTS / 4 * 3) {
+    live[i].ptr = ptr;
+    live[i].size = size;
+    live[i].site = site - sites;
+    COUNT(liveSampled, 1);
+    site->live += size;
+    site->peak = site->live > site->peak ? site->live : site->peak;
+  } else {
+    COUNT(lostSamples, 1);
+  }
+  unlock_tables();
+}
+
+bool prof_active(void) { return inProfiler; }
+
+void prof_alloc(void *ptr, size_t size) {
+  if (!profiling || inProfiler) {
+    return;
+  }
+  COUNT(allocs, 1);
+  if (ptr == NULL) {
+    COUNT(failed, 1);
+    return;
+  }
+  COUNT(bytesRequested, size);
+  COUNT(hist[bucket(size)], 1);
+
+  size_t usable = malloc_usable_size(ptr);
+  int64_t now = COUNT(liveBytes, (int64_t)usable) + (int64_t)usable;
+  int64_t peak = atomic_load_explicit(&peakBytes, memory_order_relaxed);
+  while (now > peak && !atomic_compare_exchange_weak(&peakBytes, &peak, now)) {
+  }
+
+  if (--sampleCountdown <= 0) {
+    inProfiler = true;
+    sampleCountdown = next_countdown();
+    sample(ptr, size);
+    inProfiler = false;
+  }
+}
+
+void prof_free(void *ptr) {
+  if (!profiling || inProfiler || ptr == NULL) {
+    return;
+  }
+  prof_freed(ptr, malloc_usable_size(ptr));
+}
+
+void prof_freed(void *ptr, size_t usable) {
+  if (!profiling || inProfiler || ptr == NULL) {
+    return;
+  }
+  COUNT(frees, 1);
+  COUNT(liveBytes, -(int64_t)usable);
+  if (atomic_load_explicit(&liveSampled, memory_order_relaxed) == 0) {
+    return;
+  }
+  lock_tables();
+  size_t i = find_live(ptr);
+  if (live[i].ptr == ptr) {
+    untrack(i);
+  }
+  unlock_tables();
+}
+
+static int env_int(const char *name, int fallback) {
+  char *s = getenv(name);
+  if (s == NULL || *s == '\0') {
+    return fallback;
+  }
+  int v = atoi(s);
+  return v < 1 ? 1 : v;
+}
+
+__attribute__((constructor)) static void prof_init(void) {
+  if (getenv(PROFILE_ENV_NAME) == NULL) {
+    return;
+  }
+  inProfiler = true;
+  rate = env_int(PROFILE_RATE_ENV_NAME, DEFAULT_RATE);
+  top = env_int(PROFILE_TOP_ENV_NAME, DEFAULT_TOP);
+  sites = mmap(NULL, SITE_SLOTS * sizeof(struct Site), PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  live = mmap(NULL, LIVE_SLOTS * sizeof(struct LiveAlloc),
+              PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (sites == MAP_FAILED || live == MAP_FAILED) {
+    fprintf(stderr, "EBB: no memory for the allocation profile\n");
+    inProfiler = false;
+    return;
+  }
+
+  Dl_info info;
+  if (dladdr((void *)prof_init, &info)) {
+    ownBase = info.dli_fbase;
+  }
+  // The first backtrace() loads libgcc; get that out of the way now
+  void *frames[1];
+  backtrace(frames, 1);
+
+  stderrCopy = report_prepare(getenv(PROFILE_ENV_NAME));
+  profPid = getpid();
+  profiling = true;
+  inProfiler = false;
+  DEBUG_PRINT("Profiling allocations, 1 in %d sampled\n", rate);
+}
+
+static void print_sizes(int fd, const uint64_t *counts, const char *indent) {
+  for (int b = 0; b < HIST_BUCKETS; b++) {
+    if (counts[b] == 0) {
+      continue;
+    }
+    if (b == 0) {
+      dprintf(fd, "%s0", indent);
+    } else if (b + 1 < HIST_BUCKETS) {
+      dprintf(fd, "%s%zu-%zu", indent, bucket_low(b), bucket_low(b + 1) - 1);
+    } else {
+      dprintf(fd, "%s%zu+", indent, bucket_low(b));
+    }
+    dprintf(fd, ": %llu\n", (unsigned long long)counts[b]);
+  }
+}
+
+static void print_frame(int fd, int n, void *addr) {
+  Dl_info info;
+  dprintf(fd, "    #%d %p", n, addr);
+  if (dladdr(addr, &info) && info.dli_fname != NULL) {
+    // file+offset is what addr2line -e file wants for a PIE or library
+    dprintf(fd, " %s+%#lx", info.dli_fname,
+            (unsigned long)((char *)addr - (char *)info.dli_fbase));
+    if (info.dli_sname != NULL) {
+      dprintf(fd, " (%s+%#lx)", info.dli_sname,
+              (unsigned long)((char *)addr - (char *)info.dli_saddr));
+    }
+  }
+  dprintf(fd, "\n");
+}
+
+static int by_bytes(const void *a, const void *b) {
+  const struct Site *x = &sites[*(const int *)a];
+  const struct Site *y = &sites[*(const int *)b];
+  return (y->bytes > x->bytes) - (y->bytes < x->bytes);
+}
+
+static void report_sites(int fd) {
+  int *order = malloc(SITE_SLOTS * sizeof(int));
+  if (order == NULL) {
+    return;
+  }
+  int n = 0;
+  for (int i = 0; i < SITE_SLOTS; i++) {
+    if (sites[i].samples != 0) {
+      order[n++] = i;
+    }
+  }
+  qsort(order, n, sizeof(int), by_bytes);
+
+  dprintf(fd, "%d call sites from %llu samples (%llu not tracked to free)\n",
+          n, (unsigned long long)samples, (unsigned long long)lostSamples);
+  for (int k = 0; k < n && k < top; k++) {
+    const struct Site *site = &sites[order[k]];
+    dprintf(fd, "site %d: ~%llu allocs ~%llu bytes ~%lld live ~%lld peak\n",
+            k + 1, (unsigned long long)site->samples * rate,
+            (unsigned long long)site->bytes * rate,
+            (long long)site->live * rate, (long long)site->peak * rate);
+    print_sizes(fd, site->hist, "    sampled sizes ");
+    if (order[k] == 0) {
+      dprintf(fd, "    (sites that did not fit in the table)\n");
+    }
+    for (int f = 0; f < site->nframes; f++) {
+      print_frame(fd, f, site->frames[f]);
+    }
+  }
+  free(order);
+}
+
+__attribute__((destructor)) static void prof_report(void) {
+  // Only the process that started profiling reports; see profile.h
+  if (!profiling || getpid() != profPid) {
+    return;
+  }
+  inProfiler = true;
+  int fd = report_open(getenv(PROFILE_ENV_NAME), stderrCopy);
+  if (fd < 0) {
+    fprintf(stderr, "EBB: cannot write the allocation profile: %s\n",
+            strerror(errno));
+    return;
+  }
+
+  uint64_t counts[HIST_BUCKETS];
+  for (int b = 0; b < HIST_BUCKETS; b++) {
+    counts[b] = hist[b];
+  }
+  int64_t now = liveBytes;
+  dprintf(fd, "== ebb alloc profile: pid %d (%s), 1 in %d sampled\n",
+          (int)profPid, program_invocation_name, rate);
+  dprintf(fd,
+          "allocs %llu frees %llu failed %llu bytes %llu live %lld peak %lld\n",
+          (unsigned long long)allocs, (unsigned long long)frees,
+          (unsigned long long)failed, (unsigned long long)bytesRequested,
+          (long long)(now > 0 ? now : 0), (long long)peakBytes);
+  dprintf(fd, "sizes:\n");
+  print_sizes(fd, counts, "    ");
+  lock_tables();
+  report_sites(fd);
+  unlock_tables();
+
+  report_close(fd);
+}
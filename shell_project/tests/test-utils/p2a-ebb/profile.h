@@ -0,0 +1,41 @@
+#ifndef EBB_PROFILE_H
+#define EBB_PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Where to append the report. "-" means stderr; "%p" is replaced by the pid */
+#define PROFILE_ENV_NAME "EBB_PROFILE"
+/** Sample one in this many allocations on average (default 64, 1 = all) */
+#define PROFILE_RATE_ENV_NAME "EBB_PROFILE_RATE"
+/** How many call sites to list in the report (default 20) */
+#define PROFILE_TOP_ENV_NAME "EBB_PROFILE_TOP"
+
+/* The allocation profiler.
+
+When PROFILE_ENV_NAME is set, every allocation and free that goes through the
+hooks in alloc.c is counted: totals, a log2 size histogram, live bytes and the
+peak heap. Those are exact and cost a few atomic adds per call. A random one in
+EBB_PROFILE_RATE allocations is also sampled: we take its backtrace, charge it
+to that call site and remember the pointer so its free can be charged back.
+Per-site numbers are scaled back up by the rate, so they are estimates.
+
+The report is written when the process that loaded the library exits. Forked
+children that exit without exec'ing write nothing, so their parent's counts
+are not reported twice. */
+
+/** Record an allocation of `size` bytes that returned `ptr` (may be NULL) */
+void prof_alloc(void *ptr, size_t size);
+
+/** Record that `ptr` is about to be freed. Must be called before the free. */
+void prof_free(void *ptr);
+
+/** Record that `ptr`, whose malloc_usable_size() was `usable`, has been freed
+    already, e.g. by a realloc() that moved it */
+void prof_freed(void *ptr, size_t usable);
+
+/** True while the profiler is running on this thread. Its allocations must
+    not count toward EBB_ALLOC_CTR. */
+bool prof_active(void);
+
+#endif
@@ -0,0 +1,46 @@
+/** Opening the reports that are written at exit. See report.h. */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "report.h"
+
+int report_prepare(const char *spec) {
+  if (spec == NULL || strcmp(spec, "-") != 0) {
+    return -1;
+  }
+  return fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 100);
+}
+
+int report_open(const char *spec, int stderrCopy) {
+  int fd = stderrCopy;
+  if (strcmp(spec, "-") != 0) {
+    char path[4096];
+    size_t len = 0;
+    for (const char *c = spec; *c != '\0' && len < sizeof(path) - 24; c++) {
+      if (c[0] == '%' && c[1] == 'p') {
+        len += snprintf(path + len, sizeof(path) - len, "%d", (int)getpid());
+        c++;
+      } else {
+        path[len++] = *c;
+      }
+    }
+    path[len] = '\0';
+    fd = syscall(SYS_openat, AT_FDCWD, path,
+                 O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  }
+  if (fd >= 0) {
+    flock(fd, LOCK_EX); // keep reports from concurrent processes apart
+  }
+  return fd;
+}
+
+void report_close(int fd) {
+  flock(fd, LOCK_UN);
+  syscall(SYS_close, fd);
+}
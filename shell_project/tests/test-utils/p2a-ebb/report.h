@@ -0,0 +1,21 @@
+#ifndef EBB_REPORT_H
+#define EBB_REPORT_H
+
+/* Where the profiler and the latency injector write their reports at exit.
+
+A report spec is a file to append to, with each "%p" replaced by the pid, or
+"-" for stderr. Programs may close stderr before our destructors run (the
+coreutils do), so for "-" we keep a copy of it from startup. The file calls
+go around the hooks in other.c, which would count them, fail them or delay
+them. */
+
+/** Call at startup. Returns the stderr copy to pass to report_open, or -1. */
+int report_prepare(const char *spec);
+
+/** Open the report for appending, locked against concurrent writers. */
+int report_open(const char *spec, int stderrCopy);
+
+/** Unlock and close a report from report_open */
+void report_close(int fd);
+
+#endif
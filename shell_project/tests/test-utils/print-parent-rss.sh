@@ -0,0 +1,10 @@
+#!/bin/bash
+# Check the peak RSS of our parent (the shell that ran this script) against a
+# budget given in kB. Prints a fixed message on success so tests can diff it.
+budget=$1
+peak=$(awk '/^VmHWM:/ {print $2}' /proc/$PPID/status)
+if [ "$peak" -le "$budget" ]; then
+    echo "RSS within budget"
+else
+    echo "RSS over budget: $peak kB > $budget kB"
+fi
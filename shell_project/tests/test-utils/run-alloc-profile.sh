@@ -0,0 +1,30 @@
+#!/bin/bash
+
+## Run a script under the EvilBoomBox allocation profiler, sampling every
+## allocation, then check the reports rather than print them: the counts depend
+## on the C library.
+#
+# Usage: run-alloc-profile.sh INFILE
+
+ebb_dir=$(realpath tests/test-utils/p2a-ebb)
+report=$(mktemp)
+trap 'rm -f $report' EXIT
+
+flock "$ebb_dir" make -s -C "$ebb_dir" > /dev/null || exit 1
+EBB_PROFILE=$report EBB_PROFILE_RATE=1 EBB_PROFILE_TOP=4096 LD_PRELOAD="$ebb_dir/libevilboombox.so" \
+    ./utcsh "$1"
+
+echo "reports $(grep -c '^== ebb alloc profile' "$report")"
+# The shell's own report: every allocation sampled, so the per-site counts
+# must add up to the totals, and the heap never peaked below what is live
+awk '
+/^== ebb alloc profile/ { mine = $0 ~ /\(\.\/utcsh\)/; next }
+!mine { next }
+/^allocs / { allocs = $2 - $6; live = $10; peak = $12 }
+/^[0-9]+ call sites from / { sampled = $5 }
+/^site / { sites++; sum += substr($3, 2) }
+END {
+    print (allocs > 0 && sampled == allocs ? "every allocation sampled" : "samples " sampled " of " allocs)
+    print (sum == allocs ? "sites add up" : "sites add up to " sum)
+    print (peak >= live ? "peak covers live" : "peak " peak " below live " live)
+}' "$report"
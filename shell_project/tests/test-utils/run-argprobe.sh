@@ -0,0 +1,21 @@
+#!/bin/bash
+
+## Build argprinter and run a script that uses argprinter --probe from a fresh
+## directory that has argprinter in it. Every number in the probe's JSON line
+## but argc is masked, so what is left shows which fields are null.
+#
+# Usage: run-argprobe.sh INFILE
+
+set -o pipefail
+# The real project directory, also under run-tests.py -j's symlinks
+proj=$(realpath tests/..)
+in=$(realpath "$1")
+work=$(mktemp -d)
+trap 'rm -rf $work' EXIT
+
+flock "$proj" make -s -C "$proj" argprinter > /dev/null || exit 1
+ln -s "$proj/argprinter" "$work/argprinter"
+cd "$work" && "$proj/utcsh" "$in" |
+    sed -E '/^\{"probe":/{s/"argc":([0-9]+)/"argc":#\1/
+                          s/(":)-?[0-9]+/\1N/g
+                          s/#//}'
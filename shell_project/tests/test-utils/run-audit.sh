@@ -0,0 +1,11 @@
+#!/bin/bash
+
+## Run a script that uses the audit builtin, with the counters that depend on
+## how the writer thread batched its records (batches, rotations and a
+## nonzero count of write errors) masked.
+#
+# Usage: run-audit.sh INFILE
+
+set -o pipefail
+./utcsh "$1" | sed -E 's/^(batches|rotations) [0-9]+$/\1 N/
+                       s/^write errors [1-9][0-9]*$/write errors N/'
@@ -0,0 +1,12 @@
+#!/bin/bash
+
+## Run a script that uses the bench builtin, with the timings in its reports,
+## and the padding that depends on their width, masked so the output can be
+## compared.
+#
+# Usage: run-bench.sh INFILE
+
+set -o pipefail
+./utcsh "$1" | sed -E '/^(wall|user|sys) /s/ +[0-9]+\.[0-9]+/ N/g
+                       s/^max rss [0-9]+ KB$/max rss N KB/
+                       /^outliers: /d'
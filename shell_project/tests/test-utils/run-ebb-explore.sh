@@ -0,0 +1,33 @@
+#!/bin/bash
+
+## Sweep the fault space of a utcsh script with ebb-explore.py and check its
+## summary. How many steps the script takes depends on libc, so only relations
+## between the counts are printed: every point found was run, and every run
+## reached its point without a crash or hang. Crash and hang reports pass
+## through unchanged.
+#
+# Usage: run-ebb-explore.sh SKEL
+
+set -o pipefail
+./tests/test-utils/ebb-explore.py -j 4 --skel "$1" ./utcsh |
+    awk '/^fault space: / {
+             gsub(/[(),]/, "")
+             syscalls = $3; alloc = $8; points = $6 + $11
+             print "fault space: " (syscalls > 0 ? "" : "no ") "syscall steps, " \
+                   (alloc > 0 ? "" : "no ") "alloc steps"
+             next
+         }
+         /^ran [0-9]+ points/ {
+             print "ran " ($2 == points ? "every point" : $2 " of " points " points")
+             ran = $2
+             next
+         }
+         /^ok [0-9]+, / {
+             gsub(/[(),]/, "")
+             if ($2 == ran && $4 + $6 + $8 == 0)
+                 print "all ok, none unreached, hung or crashed"
+             else
+                 print
+             next
+         }
+         { print }'
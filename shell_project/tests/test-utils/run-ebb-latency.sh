@@ -0,0 +1,47 @@
+#!/bin/bash
+
+## Run a script with EvilBoomBox injecting seeded delays, check the shell's
+## latency report against the delay specs, then check that the same seed
+## replays the same delays and another seed does not. How many calls of each
+## kind the shell makes depends on libc, so only relations are printed.
+#
+# Usage: run-ebb-latency.sh INFILE
+
+ebb_dir=$(realpath tests/test-utils/p2a-ebb)
+reports=$(mktemp -d)
+trap 'rm -rf $reports' EXIT
+
+flock "$ebb_dir" make -s -C "$ebb_dir" > /dev/null || exit 1
+
+# The shell's own report from one run with the given seed
+function run() {
+    EBB_DELAY_SEED=$1 EBB_DELAY_REPORT=$reports/$1.%p \
+        EBB_DELAY_FORK=fixed:1ms EBB_DELAY_OPEN=uniform:100us:300us \
+        EBB_DELAY_WAIT=pareto:50us:1.2:5ms \
+        LD_PRELOAD="$ebb_dir/libevilboombox.so" ./utcsh "$2"
+    awk '/^== ebb latency/ { mine = $0 ~ /\(\.\/utcsh\)/ } mine' \
+        "$reports"/$1.* | sed -E 's/pid [0-9]+/pid N/'
+    rm -f "$reports"/$1.*
+}
+
+# Check one report's rows: every call of a delayed kind was delayed by an
+# amount within its spec, and no call of any other kind was
+function check() {
+    awk 'function within(lo, hi) {
+             return $2 > 0 && $3 == $2 && $5 >= lo && $5 <= hi &&
+                    $4 >= $2 * lo - 0.001 * $2 && $4 <= $2 * hi + 0.001 * $2
+         }
+         NF != 6 || $1 == "kind" { print; next }
+         $6 == "-" { ok = $3 == 0 && $4 == 0; what = "not delayed" }
+         $6 ~ /^fixed:1ms$/ { ok = within(1, 1); what = "every call delayed 1ms" }
+         $6 ~ /^uniform:/ { ok = within(0.1, 0.3)
+                            what = "every call delayed 0.1-0.3ms" }
+         $6 ~ /^pareto:/ { ok = within(0.05, 5)
+                           what = "every call delayed 0.05-5ms" }
+         { print $1 ": " (ok ? what : "unexpected: " $0) }'
+}
+
+first=$(run 7 "$1")
+echo "$first" | check
+[ "$(run 7 "$1")" = "$first" ] && echo "same seed, same delays"
+[ "$(run 8 "$1")" != "$first" ] && echo "another seed, other delays"
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+## Build edd and run a script that uses it from a fresh directory that has edd in it.
+#
+# Usage: run-edd.sh INFILE
+
+# The real project directory, also under run-tests.py -j's symlinks
+proj=$(realpath tests/..)
+in=$(realpath "$1")
+work=$(mktemp -d)
+trap 'rm -rf $work' EXIT
+
+flock "$proj" make -s -C "$proj" ../edd/edd > /dev/null || exit 1
+ln -s "$proj/../edd/edd" "$work/edd"
+cd "$work" && "$proj/utcsh" "$in"
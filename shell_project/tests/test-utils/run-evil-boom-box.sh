@@ -12,7 +12,8 @@ function die(){
 }
 
 pushd $ebb_dir || die 6
-make
+# Under run-tests.py -j, other tests may be building the library too
+flock . make
 popd || die 6
 
 ## If UTCSH dies with a signal, bash will report an exit number of 128 + signum
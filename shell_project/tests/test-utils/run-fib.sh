@@ -0,0 +1,21 @@
+#!/bin/bash
+
+## Build fib and run a script that uses it from a fresh directory that has fib
+## in it, with the timings and counts in fib -s's report and the latency
+## columns of fib -m bench's CSV masked.
+#
+# Usage: run-fib.sh INFILE
+
+set -o pipefail
+# The real project directory, also under run-tests.py -j's symlinks
+proj=$(realpath tests/..)
+in=$(realpath "$1")
+work=$(mktemp -d)
+trap 'rm -rf $work' EXIT
+
+# fib.c has a known -Winfinite-recursion warning; keep it out of stderr
+flock "$proj" make -s -C "$proj" fib > /dev/null 2>&1 || exit 1
+ln -s "$proj/fib" "$work/fib"
+cd "$work" && "$proj/utcsh" "$in" |
+    sed -E '/^(fork|memo|threads): fib\(/s/[0-9.]+ (ms|processes|tasks|stolen)/N \1/g
+            s/^([a-z]+,[0-9]+,[a-z]+,[a-z]+,[a-z]+,[0-9]+)(,[0-9.]+){5}$/\1,N,N,N,N,N/'
@@ -0,0 +1,21 @@
+#!/bin/bash
+
+## Check persistent history. Two interactive shells append 500 lines each to
+# the same history file at the same time; the test's `in` file then counts
+# the lines of each kind (a torn or lost append changes the counts) and runs
+# some searches. A last shell checks that a fresh start sees the entries the
+# previous one added.
+#
+# Usage: run-history.sh HISTFILE INFILE
+
+export UTCSH_HISTFILE=$1
+inp_path=$2
+rm -f "$UTCSH_HISTFILE"
+
+yes 'cd .' | head -n 500 | ./utcsh > /dev/null &
+yes 'cd ./' | head -n 500 | ./utcsh > /dev/null &
+wait
+
+./utcsh < "$inp_path" | sed 's/utcsh> //g'
+echo 'history -s /bin/echo needle' | ./utcsh | sed 's/utcsh> //g'
+rm -f "$UTCSH_HISTFILE"
@@ -0,0 +1,12 @@
+#!/bin/bash
+
+## Feed a million commands to an interactive utcsh, then run the commands in
+# the test's `in` file, which check the shell's peak RSS. Every command is a
+# builtin so the run is not dominated by fork/exec, but each one still goes
+# through getline, tokenizing and parsing. A leak of a few bytes per command
+# shows up as tens of megabytes here.
+
+inp_path=tests/test-specs/leakcheck/in
+ncmds=1000000
+
+{ yes 'cd .' | head -n $ncmds; cat $inp_path; } | ./utcsh | grep -o 'RSS.*'
@@ -0,0 +1,12 @@
+#!/bin/bash
+
+## Run a script that uses the memo builtin against a fresh result cache.
+#
+# Usage: run-memo.sh CACHEDIR INFILE
+
+export UTCSH_MEMO_DIR=$1
+rm -rf "$UTCSH_MEMO_DIR"
+./utcsh "$2"
+status=$?
+rm -rf "$UTCSH_MEMO_DIR"
+exit $status
@@ -0,0 +1,11 @@
+#!/bin/bash
+
+## Run a script that uses the place builtin, with the pids and CPU times in
+## the reports it writes to standard error masked so they can be compared.
+#
+# Usage: run-placement.sh INFILE
+
+set -o pipefail
+{ ./utcsh "$1" 2>&1 1>&3 |
+    sed -E 's/^place: pid [0-9]+ cpu ([^ ]+) user [0-9.]+s sys [0-9.]+s$/place: pid N cpu \1 user N sys N/' 1>&2
+} 3>&1
@@ -0,0 +1,28 @@
+#!/bin/bash
+
+## Start `utcsh --server` with two workers, run the test's `in` file through
+# it one request per line, then run a single command from eight concurrent
+# clients so that most of them have to queue for a worker. Finally stop the
+# server and check that it removed its socket.
+#
+# Usage: run-server.sh SOCKET INFILE
+
+sock=$1
+inp_path=$2
+client=tests/test-utils/utcsh-client.py
+
+./utcsh --server "$sock" -j 2 &
+server=$!
+for _ in $(seq 100); do
+  [ -S "$sock" ] && break
+  sleep 0.05
+done
+
+python3 $client "$sock" < "$inp_path"
+echo '/bin/echo queued' | python3 $client "$sock" --fanout 8 | sort | uniq -c | sed 's/^ *//'
+
+kill -TERM $server
+wait $server
+echo "server exited with $?"
+[ -e "$sock" ] && echo "socket left behind"
+exit 0
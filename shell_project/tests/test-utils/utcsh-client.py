@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+
+## Minimal client for `utcsh --server SOCKET`, used by the server tests.
+#
+# Sends each line of standard input as one request over a single connection
+# and copies the reply frames to our stdout and stderr, followed by
+# "[exit N]" on stdout once the request's exit frame arrives.
+#
+# With --fanout N, N connections run the whole input at the same time and
+# each connection's stdout is printed as one block, blocks sorted, so the
+# output does not depend on scheduling.
+
+import argparse
+import socket
+import struct
+import sys
+import threading
+
+FRAME_STDOUT = b"o"
+FRAME_STDERR = b"e"
+FRAME_EXIT = b"x"
+
+
+def recv_exact(sock, n):
+    buf = b""
+    while len(buf) < n:
+        chunk = sock.recv(n - len(buf))
+        if not chunk:
+            raise EOFError("server closed the connection")
+        buf += chunk
+    return buf
+
+
+def run_session(path, lines, out, err):
+    """Run lines on one connection, appending reply bytes to out and err"""
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+        sock.connect(path)
+        for line in lines:
+            sock.sendall(line.encode() + b"\n")
+            while True:
+                ftype, length = struct.unpack(">cI", recv_exact(sock, 5))
+                payload = recv_exact(sock, length)
+                if ftype == FRAME_STDOUT:
+                    out.append(payload)
+                elif ftype == FRAME_STDERR:
+                    err.append(payload)
+                elif ftype == FRAME_EXIT:
+                    (status,) = struct.unpack(">I", payload)
+                    out.append(b"[exit %d]\n" % status)
+                    break
+                else:
+                    raise ValueError("bad frame type %r" % ftype)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("socket")
+    parser.add_argument("--fanout", type=int, default=0)
+    args = parser.parse_args()
+    lines = sys.stdin.read().splitlines()
+
+    if args.fanout <= 0:
+        out, err = [], []
+        try:
+            run_session(args.socket, lines, out, err)
+        finally:
+            sys.stdout.buffer.write(b"".join(out))
+            sys.stderr.buffer.write(b"".join(err))
+        return
+
+    results = [([], []) for _ in range(args.fanout)]
+    threads = [
+        threading.Thread(target=run_session, args=(args.socket, lines) + r)
+        for r in results
+    ]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    for block in sorted(b"".join(out) for out, _ in results):
+        sys.stdout.buffer.write(block)
+    for _, err in results:
+        sys.stderr.buffer.write(b"".join(err))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,264 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* Trace fds are moved up here so that redirections (which only touch 0-2)
+   never clobber them */
+#define TRACE_FD_MIN 10
+#define TRACE_LINE_MAX 4096
+
+/* Histogram bucket i holds samples in [2^i, 2^(i+1)) nanoseconds */
+#define HIST_BUCKETS 48
+#define HIST_BAR_WIDTH 40
+
+struct LatencyHist {
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t min_ns;
+  uint64_t max_ns;
+  uint64_t buckets[HIST_BUCKETS];
+};
+
+static int trace_fd = -1;
+static struct LatencyHist latencies[STAT_NUM_LATENCIES];
+static uint64_t counters[STAT_NUM_COUNTERS];
+
+static const char *latency_names[STAT_NUM_LATENCIES] = {
+    "parse", "builtin", "fork", "external", "batch", "glob"};
+static const char *counter_names[STAT_NUM_COUNTERS] = {
+    "lines", "commands", "builtins", "externals",
+    "forks", "fork_errors", "nonzero_exits", "signaled", "dir_reads",
+    "memo_hits", "memo_misses"};
+
+uint64_t trace_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void trace_init_from_env(void) {
+  char *setting = getenv(TRACE_ENV_NAME);
+  if (!setting || !*setting || !strcmp(setting, "0")) {
+    return;
+  }
+  trace_enable(strcmp(setting, "1") ? setting : NULL);
+}
+
+int trace_enable(const char *path) {
+  int fd;
+  if (path) {
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  } else {
+    fd = dup(STDERR_FILENO);
+  }
+  if (fd < 0) {
+    return 0;
+  }
+  int high = fcntl(fd, F_DUPFD_CLOEXEC, TRACE_FD_MIN);
+  close(fd);
+  if (high < 0) {
+    return 0;
+  }
+  trace_disable();
+  trace_fd = high;
+  return 1;
+}
+
+void trace_disable(void) {
+  if (trace_fd >= 0) {
+    close(trace_fd);
+    trace_fd = -1;
+  }
+}
+
+bool trace_enabled(void) { return trace_fd >= 0; }
+
+void trace_event(const char *ev, const char *fields_fmt, ...) {
+  if (trace_fd < 0) {
+    return;
+  }
+  char line[TRACE_LINE_MAX];
+  int len = snprintf(line, sizeof(line), "{\"ts\":%llu,\"pid\":%d,\"ev\":\"%s\"",
+                     (unsigned long long)trace_now_ns(), (int)getpid(), ev);
+  if (len < 0 || len > (int)sizeof(line) - 64) {
+    return; /* Only an absurdly long event name gets here */
+  }
+  if (fields_fmt) {
+    line[len++] = ',';
+    /* Leave room for the closing brace and newline */
+    size_t room = sizeof(line) - len - 2;
+    va_list ap;
+    va_start(ap, fields_fmt);
+    int n = vsnprintf(line + len, room, fields_fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= room) {
+      /* A field cut off midway is not valid JSON, so drop them all */
+      len += snprintf(line + len, room, "\"truncated\":true");
+    } else {
+      len += n;
+    }
+  }
+  line[len++] = '}';
+  line[len++] = '\n';
+
+  int saved_errno = errno;
+  ssize_t unused = write(trace_fd, line, len);
+  (void)unused; /* A lost trace line is not worth failing a command over */
+  errno = saved_errno;
+}
+
+char *trace_json_string(char *buf, size_t size, const char *s) {
+  size_t pos = 0;
+  if (size < 3) {
+    return buf;
+  }
+  buf[pos++] = '"';
+  for (; s && *s && pos + 8 < size; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      buf[pos++] = '\\';
+      buf[pos++] = c;
+    } else if (c < 0x20) {
+      pos += snprintf(buf + pos, size - pos, "\\u%04x", c);
+    } else {
+      buf[pos++] = c;
+    }
+  }
+  buf[pos++] = '"';
+  buf[pos] = '\0';
+  return buf;
+}
+
+static long timeval_us(struct timeval tv) {
+  return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+void trace_child_reaped(unsigned long cmd_id, pid_t pid, int status,
+                        const struct rusage *ru, uint64_t start_ns) {
+  if (WIFSIGNALED(status)) {
+    stats_count(STAT_SIGNALED);
+  } else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+    stats_count(STAT_NONZERO_EXITS);
+  }
+  if (trace_fd < 0) {
+    return;
+  }
+  trace_event("wait",
+              "\"cmd\":%lu,\"child\":%d,\"exit\":%d,\"signal\":%d,"
+              "\"wall_ns\":%llu,\"utime_us\":%ld,\"stime_us\":%ld,"
+              "\"maxrss_kb\":%ld,\"minflt\":%ld,\"majflt\":%ld",
+              cmd_id, (int)pid, WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+              WIFSIGNALED(status) ? WTERMSIG(status) : 0,
+              (unsigned long long)(trace_now_ns() - start_ns),
+              timeval_us(ru->ru_utime), timeval_us(ru->ru_stime),
+              ru->ru_maxrss, ru->ru_minflt, ru->ru_majflt);
+}
+
+static int bucket_of(uint64_t ns) {
+  int b = 0;
+  while (ns > 1 && b < HIST_BUCKETS - 1) {
+    ns >>= 1;
+    b++;
+  }
+  return b;
+}
+
+void stats_record(enum StatLatency which, uint64_t ns) {
+  struct LatencyHist *h = &latencies[which];
+  if (h->count == 0 || ns < h->min_ns) {
+    h->min_ns = ns;
+  }
+  if (ns > h->max_ns) {
+    h->max_ns = ns;
+  }
+  h->count++;
+  h->sum_ns += ns;
+  h->buckets[bucket_of(ns)]++;
+}
+
+void stats_count(enum StatCounter which) { counters[which]++; }
+
+void stats_reset(void) {
+  memset(latencies, 0, sizeof(latencies));
+  memset(counters, 0, sizeof(counters));
+}
+
+/* Format a duration with a unit that keeps it short */
+static char *fmt_ns(char *buf, size_t size, double ns) {
+  if (ns < 1e3) {
+    snprintf(buf, size, "%.0fns", ns);
+  } else if (ns < 1e6) {
+    snprintf(buf, size, "%.1fus", ns / 1e3);
+  } else if (ns < 1e9) {
+    snprintf(buf, size, "%.1fms", ns / 1e6);
+  } else {
+    snprintf(buf, size, "%.2fs", ns / 1e9);
+  }
+  return buf;
+}
+
+/* Upper bound of the bucket holding the given quantile */
+static uint64_t quantile_bound(const struct LatencyHist *h, double q) {
+  uint64_t target = (uint64_t)(q * h->count);
+  uint64_t seen = 0;
+  for (int b = 0; b < HIST_BUCKETS; b++) {
+    seen += h->buckets[b];
+    if (seen > target) {
+      return 2ull << b;
+    }
+  }
+  return h->max_ns;
+}
+
+static void print_hist(FILE *out, const char *name,
+                       const struct LatencyHist *h) {
+  char a[16], b[16], c[16], d[16], e[16];
+  if (h->count == 0) {
+    fprintf(out, "%s: no samples\n", name);
+    return;
+  }
+  fprintf(out, "%s: n=%llu min=%s mean=%s max=%s p50<%s p99<%s\n", name,
+          (unsigned long long)h->count, fmt_ns(a, sizeof(a), h->min_ns),
+          fmt_ns(b, sizeof(b), (double)h->sum_ns / h->count),
+          fmt_ns(c, sizeof(c), h->max_ns),
+          fmt_ns(d, sizeof(d), quantile_bound(h, 0.50)),
+          fmt_ns(e, sizeof(e), quantile_bound(h, 0.99)));
+
+  uint64_t peak = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    if (h->buckets[i] > peak) {
+      peak = h->buckets[i];
+    }
+  }
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    if (!h->buckets[i]) {
+      continue;
+    }
+    int bar = (int)((h->buckets[i] * HIST_BAR_WIDTH + peak - 1) / peak);
+    fprintf(out, "  [%8s, %8s) %8llu ", fmt_ns(a, sizeof(a), 1ull << i),
+            fmt_ns(b, sizeof(b), 2ull << i),
+            (unsigned long long)h->buckets[i]);
+    for (int j = 0; j < bar; j++) {
+      fputc('#', out);
+    }
+    fputc('\n', out);
+  }
+}
+
+void stats_print(FILE *out) {
+  for (int i = 0; i < STAT_NUM_COUNTERS; i++) {
+    fprintf(out, "%-14s %llu\n", counter_names[i],
+            (unsigned long long)counters[i]);
+  }
+  for (int i = 0; i < STAT_NUM_LATENCIES; i++) {
+    print_hist(out, latency_names[i], &latencies[i]);
+  }
+  fflush(out);
+}
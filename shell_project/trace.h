@@ -0,0 +1,97 @@
+#ifndef UTCSH_TRACE_H
+#define UTCSH_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/* Environment variable that turns tracing on at startup. "1" traces to
+   standard error, any other non-empty value (except "0") is a file name. */
+#define TRACE_ENV_NAME "UTCSH_TRACE"
+
+/* Set for every external command: trace_now_ns() when the shell began to
+   fork it, and when the child called execv(). See argprinter --probe. */
+#define SPAWN_NS_ENV_NAME "UTCSH_SPAWN_NS"
+#define EXEC_NS_ENV_NAME "UTCSH_EXEC_NS"
+
+/* Latencies tracked by the `stats` builtin */
+enum StatLatency {
+  STAT_PARSE,    /* Tokenizing and splitting one command line */
+  STAT_BUILTIN,  /* Running a builtin command */
+  STAT_FORK,     /* The fork() call itself, in the parent */
+  STAT_EXTERNAL, /* fork() to reaping the child of an external command */
+  STAT_BATCH,    /* A whole line of concurrent commands */
+  STAT_GLOB,     /* Expanding the glob patterns on one command line */
+  STAT_NUM_LATENCIES
+};
+
+/* Event counters tracked by the `stats` builtin */
+enum StatCounter {
+  STAT_LINES,
+  STAT_COMMANDS,
+  STAT_BUILTINS,
+  STAT_EXTERNALS,
+  STAT_FORKS,
+  STAT_FORK_ERRORS,
+  STAT_NONZERO_EXITS,
+  STAT_SIGNALED,
+  STAT_DIR_READS,
+  STAT_MEMO_HITS,
+  STAT_MEMO_MISSES,
+  STAT_NUM_COUNTERS
+};
+
+/** Nanoseconds on the monotonic clock. Comparable across processes. */
+uint64_t trace_now_ns(void);
+
+/** Turn tracing on if TRACE_ENV_NAME is set. Call once at startup. */
+void trace_init_from_env(void);
+
+/** Start writing trace events to `path`, or to standard error if `path` is
+ * NULL. Events are appended, so several shells may share one file. Returns 1
+ * on success and 0 if the file could not be opened. */
+int trace_enable(const char *path);
+
+/** Stop tracing and close the trace file, if any. */
+void trace_disable(void);
+
+/** Returns true if trace events are currently being written */
+bool trace_enabled(void);
+
+/**
+ * Write one JSON-lines trace event. Every event carries "ts" (trace_now_ns()),
+ * "pid" and "ev"; `fields_fmt` is a printf format producing any additional
+ * `"key":value` pairs (without leading comma), or NULL for none. Use
+ * trace_json_string() for string values. Does nothing when tracing is off.
+ * If the fields do not fit in a line they are replaced by "truncated":true.
+ *
+ * Each event is written with a single write(), so events from the shell and
+ * its children do not interleave within a line.
+ */
+void trace_event(const char *ev, const char *fields_fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/** Write `s` into `buf` as a quoted, escaped JSON string, truncating if it
+ * does not fit. Returns buf. */
+char *trace_json_string(char *buf, size_t size, const char *s);
+
+/** Emit a "wait" event describing a reaped child and update the exit-status
+ * counters. `start_ns` is when the child was forked. */
+void trace_child_reaped(unsigned long cmd_id, pid_t pid, int status,
+                        const struct rusage *ru, uint64_t start_ns);
+
+/** Record one sample of the given latency */
+void stats_record(enum StatLatency which, uint64_t ns);
+
+/** Bump the given counter */
+void stats_count(enum StatCounter which);
+
+/** Print counters and latency histograms for the `stats` builtin */
+void stats_print(FILE *out);
+
+/** Forget everything recorded so far */
+void stats_reset(void);
+
+#endif
@@ -7,6 +7,21 @@
 /* Read the additional functions from util.h. They may be beneficial to you
 in the future */
 #include "util.h"
+#include "arena.h"
+#include "lexer.h"
+#include "parse.h"
+#include "expand.h"
+#include "trace.h"
+#include "wc.h"
+#include "paste.h"
+#include "server.h"
+#include "history.h"
+#include "jobs.h"
+#include "memo.h"
+#include "placement.h"
+#include "redirect.h"
+#include "benchstat.h"
+#include "audit.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,104 +30,121 @@ in the future */
 #include <ctype.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
 /* Global variables */
-/* The array for holding shell paths. Can be edited by the functions in util.c*/
-char shell_paths[MAX_ENTRIES_IN_SHELLPATH][MAX_CHARS_PER_CMDLINE];
 static char prompt[] = "utcsh> "; /* Command line prompt */
 static char *default_shell_path[2] = {"/bin", NULL};/*utcsh shell path to execute commands*/
-/* End Global Variables */
-
-/* Convenience struct for describing a command. Modify this struct as you see
- * fit--add extra members to help you write your code. */
-struct Command {
-  char **args;      /* Argument array for the command */
-  char *outputFile; /* Redirect target for file (NULL means no redirect) */
+/* Owns every allocation made while handling one command line. It is reset
+   after each line so that a long-running shell does not grow. */
+static struct Arena line_arena;
+/* Sequence number of the command being evaluated, used in trace events */
+static unsigned long command_id = 0;
+/* Exit status of the current command line: that of its last external
+   command, or 1 once the shell itself has reported an error. Only the server
+   mode reports it, to its clients. */
+static int last_status = 0;
+/* The process the last external command ran in, for the audit log, or 0 if
+   its fork failed */
+static pid_t last_child = 0;
+/* Standalone tools from this repo that also run inside the shell, saving a
+   fork+exec per call. `builtin -d NAME` turns one off so that the external
+   binary found in the shell path runs instead. */
+struct InprocTool {
+  const char *name;
+  int (*main)(int argc, char **argv, FILE *in);
+  int enabled;
+};
+static struct InprocTool inproc_tools[] = {
+  {"wc", wc_main, 1},
+  {"paste", paste_main, 1},
 };
+#define NUM_INPROC_TOOLS (sizeof(inproc_tools) / sizeof(inproc_tools[0]))
+/* Scripts run in-process by `source` or in place of a new utcsh nest at most
+   this deep, which also stops a script that runs itself */
+#define MAX_SCRIPT_DEPTH 64
+static int script_depth = 0;
+/* Set by `exit` in a nested script: stop that script, not the shell */
+static int script_exit = 0;
+/* End Global Variables */
 
 /* Here are the functions we recommend you implement */
 
-char **tokenize_command_line(char *cmdline);
-struct Command parse_command(char **tokens);
+struct Token *tokenize_command_line(char *cmdline);
 void eval(struct Command *cmd);
 int try_exec_builtin(struct Command *cmd);
-void exec_external_cmd(struct Command *cmd);
+int exec_external_cmd(struct Command *cmd, struct rusage *usage);
 
 /* Helper functions */
 void print_error();//print error and exit
-void merge_lines(char * desr);// merge many blanks to one blank
-int is_concurrent_command(char * command_line);// check if a concurrent command
-void execute_is_concurrent_command(char * command_line);// execute paralell commands
-void exec_command(char * good_line);// execute single commands
+void run_command_line(char * command_line);// tokenize and run one line
+int is_concurrent_command(struct Token * tokens);// check if a concurrent command
+void execute_is_concurrent_command(struct Token * tokens);// execute paralell commands
+char *join_tokens(struct Token * tokens);// command text for the job table
+char **token_words(struct Token * tokens);// argv of a command, for the audit log
+void exec_command(struct Token * tokens);// execute single commands
+struct InprocTool *find_inproc_tool(const char * name);// look up wc, paste, ...
+void run_inproc_tool(struct InprocTool * tool, struct Command * cmd);// run one in-process
+int exec_builtin_builtin(struct Command * cmd);// the `builtin` builtin
+void exec_memo_builtin(struct Command * cmd);// memo [-i FILE] [-c FILE] CMD
+void exec_bench_builtin(struct Command * cmd);// bench [-w N] [-n N] ... CMD
+int run_script_lines(FILE * script);// run every line of a script
+int run_nested_script(const char * path, int fresh_path);// source and friends
+void run_redirected_script(struct Command * cmd, const char * path, int fresh_path);
+int try_run_script(struct Command * cmd);// utcsh FILE without a new utcsh
+int run_server(int argc, char **argv);// utcsh --server SOCKET [-j N]
+int run_server_request(char * command_line);// one line for a server client
+int run_procsub_line(char * command_line);// the cmd of <(cmd) or >(cmd)
 /* Main REPL: read, evaluate, and print. This function should remain relatively
    short: if it grows beyond 60 lines, you're doing too much in main() and
    should try to move some of that work into other functions. */
 int main(int argc, char **argv) {
   // printf("wegethere\n");
   set_shell_path(default_shell_path);
+  trace_init_from_env();
   
+  if (argc >= 2 && !strcmp(argv[1], "--server")) {
+    exit(run_server(argc, argv));
+  }
+  history_init_from_env(argc == 1 && isatty(STDIN_FILENO));
+  audit_init_from_env();
+  jobs_init(argc == 1 && isatty(STDIN_FILENO));
 
   if (argc == 2) {
     // check that script command is formatted correctly
     FILE *script_ptr = fopen(argv[1], "r");
-    if (!script_ptr) {
+    if (!script_ptr || !run_script_lines(script_ptr)) {
       print_error();
       exit(1);
-    } else {  
-      int empty_line = 0;    
-      char line[MAX_CHARS_PER_CMDLINE];               
-      while (fgets(line, MAX_CHARS_PER_CMDLINE, script_ptr) != NULL) {
-         empty_line = 1;
-         merge_lines(line);
-         // parse each line
-        if (is_concurrent_command(line) == 1) {
-        execute_is_concurrent_command(line);
-        }
-        else {  
-          exec_command(line);
-          if (feof(script_ptr)) {
-            exit(0);
-          }
-        }
-      } 
-      if (!empty_line) {
-        print_error();
-        exit(1);
-      }   
     }
   } else if (argc > 2) {
     print_error();
     exit(1);
   } else {
+      /* getline() grows this buffer as needed and we reuse it for every line */
+      char *command_buffer = NULL;
+      size_t size = 0;
       while (1) {
+      jobs_notify();
       printf("%s", prompt);
 
       /* Read */
-      size_t size = 2048;
-      char *command_buffer = (char*) malloc(size);
-      size_t num_characters = getline(&command_buffer, &size, stdin); 
-      merge_lines(command_buffer);
-      
-      if (num_characters == 0) {
-        print_error();     // error handling for if command is empty?      
-      }
+      ssize_t num_characters = getline(&command_buffer, &size, stdin);
 
       // checks for end of file
-      if (feof(stdin)) {
+      if (num_characters < 0 || feof(stdin)) {
+        free(command_buffer);
+        arena_destroy(&line_arena);
+        history_close();
         exit(0);
       }
 
-      if (is_concurrent_command(command_buffer) == 1) {
-        execute_is_concurrent_command(command_buffer);
-      }
-      else {
-        exec_command(command_buffer);
-      }
-      
-
+      history_add(command_buffer);
+      run_command_line(command_buffer);
+      arena_reset(&line_arena);
     }
   }
 
@@ -124,88 +156,18 @@ int main(int argc, char **argv) {
 implementations made to avoid warnings. You should delete them and replace them
 with your own implementation. */
 
-/** Turn a command line into tokens with strtok
+/** Turn a command line into tokens
  *
- * This function turns a command line into an array of arguments, making it
- * much easier to process. First, you should figure out how many arguments you
- * have, then allocate a char** of sufficient size and fill it using strtok()
- */
-char **tokenize_command_line(char *cmdline) {
-  // printf("wegethere");
-  size_t length = strlen(cmdline);
-  char** all_tokens = (char**) calloc(1, sizeof(char*) * length);
-  if (all_tokens != NULL) {
-      int index = 0;
-    char *delimiters = " \t";
-    char* token = strtok(cmdline,  delimiters);
-    while(token != NULL) {
-      
-      token[strcspn(token, "\n")] = 0;
-      all_tokens[index] = token;
-      token = strtok(NULL, delimiters);
-      index++;
-    }
-
-    all_tokens[index] = NULL;
-  
-  }
-  
-
-  // (void)cmdline;
-  return all_tokens;
-}
-
-/** Turn tokens into a command.
+ * This function turns a command line into an array of tokens, making it
+ * much easier to process. The work is done by lex_command_line() in a single
+ * pass over the line, which also takes care of quotes and escapes.
  *
- * The `struct Command` represents a command to execute. This is the preferred
- * format for storing information about a command, though you are free to change
- * it. This function takes a sequence of tokens and turns them into a struct
- * Command.
+ * The array lives in line_arena and goes away with the next arena_reset().
+ * Returns NULL if the line has an unterminated quote or if the array could
+ * not be allocated.
  */
-struct Command parse_command(char **tokens) {
-
-  struct Command parsed_command = {.args = tokens, .outputFile = NULL};
-
-
-  int index = 0;
-  int arrow_num = 0;
-  while (tokens[index]) {
-    if (strcmp(tokens[index], ">") == 0) {
-      arrow_num++;
-        if(tokens[index-1] && tokens[index+1] && tokens[index + 2] == NULL) {
-          parsed_command.outputFile = tokens[index+1];
-          parsed_command.args[index] = NULL;   
-        } else {
-          print_error();
-          parsed_command.args = NULL;
-          parsed_command.outputFile = NULL;
-          exit(0);
-        }
-    // parsed_command.args[index] = NULL;    
-    }
-    index++;
-  }
-  // test 22, for multiple arrows
-  if (arrow_num > 1) {
-    print_error();
-    parsed_command.args = NULL;
-    parsed_command.outputFile = NULL;
-    exit(0);
-  }
-
-  // test 24, no command before arrow
-  if (arrow_num == 1 && parsed_command.args[0] == NULL) {
-    print_error();
-    parsed_command.args = NULL;
-    parsed_command.outputFile = NULL;
-    exit(0);
-  }
-
-
-  // printf("output file: %s\n", parsed_command.outputFile);
-
-  
-  return parsed_command;
+struct Token *tokenize_command_line(char *cmdline) {
+  return lex_command_line(cmdline, &line_arena, NULL);
 }
 
 /** Evaluate a single command
@@ -214,13 +176,29 @@ struct Command parse_command(char **tokens) {
  * should work out what the correct type is and take the appropriate action.
  */
 void eval(struct Command *cmd) {
+  command_id++;
+  stats_count(STAT_COMMANDS);
 
-  if (!try_exec_builtin(cmd)) {
-    exec_external_cmd(cmd);
+  uint64_t start = trace_now_ns();
+  pid_t ran_in = 0;
+  if (try_exec_builtin(cmd)) {
+    uint64_t elapsed = trace_now_ns() - start;
+    stats_count(STAT_BUILTINS);
+    stats_record(STAT_BUILTIN, elapsed);
+    if (trace_enabled()) {
+      char name[256];
+      trace_event("builtin", "\"cmd\":%lu,\"argv0\":%s,\"dur_ns\":%llu",
+                  command_id, trace_json_string(name, sizeof(name), cmd->args[0]),
+                  (unsigned long long)elapsed);
+    }
+  } else if (!try_run_script(cmd)) {
+    last_child = 0;
+    exec_external_cmd(cmd, NULL);
+    ran_in = last_child;
+  }
+  if (audit_enabled()) {
+    audit_log(cmd->args, ran_in ? ran_in : getpid(), last_status, start);
   }
-
-  
-  return;
 }
 
 /** Execute built-in commands
@@ -236,6 +214,10 @@ int try_exec_builtin(struct Command *cmd) {
     if (cmd -> args[1] != NULL) {
       print_error();
     }
+    if (script_depth > 0) {
+      script_exit = 1; // only leave the nested script
+      return 1;
+    }
     exit(0);
   } else if (!strcmp(token, "cd")){
       char* path = cmd -> args[1];
@@ -249,72 +231,627 @@ int try_exec_builtin(struct Command *cmd) {
     
       add_shell_path(&(cmd-> args[1]));    
       return 1;
+  } else if (!strcmp(token, "trace")) {
+      // trace on [FILE] | trace off
+      char *mode = cmd -> args[1];
+      if (mode != NULL && !strcmp(mode, "on") && (cmd -> args[2] == NULL || cmd -> args[3] == NULL)) {
+        if (!trace_enable(cmd -> args[2])) {
+          print_error();
+        }
+      } else if (mode != NULL && !strcmp(mode, "off") && cmd -> args[2] == NULL) {
+        trace_disable();
+      } else {
+        print_error();
+      }
+      return 1;
+  } else if (!strcmp(token, "jobs") || !strcmp(token, "wait") ||
+             !strcmp(token, "fg") || !strcmp(token, "bg")) {
+      int status = jobs_builtin(cmd->args);
+      if (status < 0) {
+        print_error();
+      } else {
+        last_status = status;
+      }
+      return 1;
+  } else if (!strcmp(token, "history")) {
+      if (history_builtin(cmd->args, stdout) < 0) {
+        print_error();
+      }
+      return 1;
+  } else if (!strcmp(token, "builtin")) {
+      return exec_builtin_builtin(cmd);
+  } else if (!strcmp(token, "memo")) {
+      exec_memo_builtin(cmd);
+      return 1;
+  } else if (!strcmp(token, "bench")) {
+      exec_bench_builtin(cmd);
+      return 1;
+  } else if (!strcmp(token, "source") || !strcmp(token, ".")) {
+      // source FILE: run FILE in this shell; cd and path do not leak out
+      if (cmd -> args[1] == NULL || cmd -> args[2] != NULL) {
+        print_error();
+      } else {
+        run_redirected_script(cmd, cmd -> args[1], 0);
+      }
+      return 1;
+  } else if (!strcmp(token, "audit")) {
+      if (audit_builtin(cmd->args, stdout) < 0) {
+        print_error();
+      }
+      return 1;
+  } else if (!strcmp(token, "place")) {
+      if (placement_builtin(cmd->args, stdout) < 0) {
+        print_error();
+      }
+      return 1;
+  } else if (!strcmp(token, "stats")) {
+      // stats [-r]: print counters and latency histograms, or reset them
+      if (cmd -> args[1] == NULL) {
+        stats_print(stdout);
+      } else if (!strcmp(cmd -> args[1], "-r") && cmd -> args[2] == NULL) {
+        stats_reset();
+      } else {
+        print_error();
+      }
+      return 1;
   } else {
+    struct InprocTool *tool = find_inproc_tool(token);
+    if (tool != NULL && tool->enabled) {
+      run_inproc_tool(tool, cmd);
+      return 1;
+    }
     return 0;
   }
 }
 
+/** Find the in-process tool called name
+ *
+ * Returns NULL if there is no such tool, whether or not it is enabled.
+ */
+struct InprocTool *find_inproc_tool(const char * name) {
+  for (size_t i = 0; i < NUM_INPROC_TOOLS; i++) {
+    if (!strcmp(inproc_tools[i].name, name)) {
+      return &inproc_tools[i];
+    }
+  }
+  return NULL;
+}
 
+/** Run a tool such as wc inside the shell
+ *
+ * The tool sees the same argv, standard input and redirections it would get
+ * as an external command: the shell's descriptors point at the redirect
+ * targets while it runs and are put back afterwards. Standard input is read
+ * through a fresh FILE on a dup of fd 0, so the tool never consumes input
+ * that the shell itself has buffered.
+ */
+void run_inproc_tool(struct InprocTool * tool, struct Command * cmd) {
+  struct SavedFds saved;
+  fflush(stdout);
+  fflush(stderr);
+  if (redirect_apply(cmd, &saved) < 0) {
+    print_error();
+    return;
+  }
+
+  int in_fd = dup(STDIN_FILENO);
+  FILE *in = in_fd >= 0 ? fdopen(in_fd, "r") : NULL;
+  if (in == NULL && in_fd >= 0) {
+    close(in_fd);
+  }
+  int argc = 0;
+  while (cmd->args[argc] != NULL) {
+    argc++;
+  }
+  tool->main(argc, cmd->args, in);
+  if (in != NULL) {
+    fclose(in);
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  redirect_restore(&saved);
+}
+
+/** The `builtin` builtin
+ *
+ * builtin            list the in-process tools and whether they are enabled
+ * builtin -d NAME... run NAME as an external command from now on
+ * builtin -e NAME... run NAME in-process again
+ */
+int exec_builtin_builtin(struct Command * cmd) {
+  if (cmd->args[1] == NULL) {
+    for (size_t i = 0; i < NUM_INPROC_TOOLS; i++) {
+      printf("%s\t%s\n", inproc_tools[i].name,
+             inproc_tools[i].enabled ? "in-process" : "external");
+    }
+    fflush(stdout);
+    return 1;
+  }
+
+  int enable;
+  if (!strcmp(cmd->args[1], "-e")) {
+    enable = 1;
+  } else if (!strcmp(cmd->args[1], "-d")) {
+    enable = 0;
+  } else {
+    print_error();
+    return 1;
+  }
+  if (cmd->args[2] == NULL) {
+    print_error();
+    return 1;
+  }
+  for (int i = 2; cmd->args[i] != NULL; i++) {
+    struct InprocTool *tool = find_inproc_tool(cmd->args[i]);
+    if (tool == NULL) {
+      print_error();
+    } else {
+      tool->enabled = enable;
+    }
+  }
+  return 1;
+}
+
+
+
+/** Find an executable in the shell paths
+ *
+ * Returns a malloc'd "dir/name" for the first shell path entry where `name`
+ * exists, or NULL if there is none. The result must be freed by the caller.
+ * The empty entry just past the last path turns an absolute name into
+ * "//name", which is how absolute commands are found.
+ */
+static char *lookup_shell_path(const char *name) {
+  size_t name_len = strlen(name);
+  for (int i = 0; i <= shell_path_count(); i++) {
+    const char *dir = shell_path_entry(i);
+    size_t dir_len = strlen(dir);
+    char *pathAndName = malloc(dir_len + name_len + 2);
+    if (pathAndName == NULL) {
+      return NULL;
+    }
+    memcpy(pathAndName, dir, dir_len);
+    pathAndName[dir_len] = '/';
+    memcpy(pathAndName + dir_len + 1, name, name_len + 1);
+
+    if(access(pathAndName, F_OK) == 0) {
+      return pathAndName;
+    }
+    free(pathAndName);
+  }
+  return NULL;
+}
+
+/** Run a memo command whose result is not cached yet, and cache it
+ *
+ * Its stdout and stderr are captured into the new cache entry and then
+ * copied to out_fd and err_fd. Results of commands that did not exit
+ * normally are shown but not kept.
+ */
+static void run_memo_miss(char **args, const char *key, int out_fd,
+                          int err_fd) {
+  struct MemoRecording rec;
+  if (memo_begin(&rec) < 0) {
+    print_error();
+    return;
+  }
+  int saved_out = dup(STDOUT_FILENO);
+  int saved_err = dup(STDERR_FILENO);
+  int status = -1;
+  if (saved_out >= 0 && saved_err >= 0) {
+    dup2(rec.entry_fd, STDOUT_FILENO);
+    dup2(rec.err_fd, STDERR_FILENO);
+    struct Command sub = {.args = args};
+    status = exec_external_cmd(&sub, NULL);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+  }
+  if (saved_out >= 0) close(saved_out);
+  if (saved_err >= 0) close(saved_err);
+
+  int exited = status != -1 && WIFEXITED(status);
+  if (memo_finish(&rec, exited ? key : NULL, exited ? WEXITSTATUS(status) : 0,
+                  out_fd, err_fd) < 0 || status == -1) {
+    print_error();
+  }
+}
+
+/** The `memo` builtin
+ *
+ * memo [-i FILE | -c FILE]... CMD ARGS... runs the external command CMD, or
+ * replays its stdout, stderr and exit status from the result cache if it
+ * already ran with the same argv, executable, working directory and inputs.
+ * -i declares an input file by inode, size and mtime, -c by its contents.
+ * A < redirect from a regular file counts as a -c input; commands reading a
+ * process substitution are not cached. A redirect applies to the replayed
+ * output just as it would to the command.
+ */
+void exec_memo_builtin(struct Command * cmd) {
+  char **args = cmd->args + 1;
+  int ninputs = 0;
+  while (args[0] && args[1] &&
+         (!strcmp(args[0], "-i") || !strcmp(args[0], "-c"))) {
+    args += 2;
+    ninputs++;
+  }
+  struct MemoInput *inputs = arena_alloc(&line_arena, (ninputs + 1) * sizeof(*inputs));
+  if (args[0] == NULL || inputs == NULL) {
+    print_error();
+    return;
+  }
+  for (int i = 0; i < ninputs; i++) {
+    inputs[i].by_content = !strcmp(cmd->args[1 + 2 * i], "-c");
+    inputs[i].path = cmd->args[2 + 2 * i];
+  }
+  /* What the command reads through < is an input too. A pipe from <(cmd),
+     or one named in argv, cannot be hashed without consuming it, so such
+     commands just run uncached. */
+  int cacheable = cmd->nprocsubs == 0;
+  struct stat in_st;
+  if (cacheable && cmd->inputFile && stat(cmd->inputFile, &in_st) == 0) {
+    cacheable = S_ISREG(in_st.st_mode);
+    inputs[ninputs].by_content = true;
+    inputs[ninputs].path = cmd->inputFile;
+    ninputs++;
+  }
+
+  char key[MEMO_KEY_LEN + 1];
+  char *exe = lookup_shell_path(args[0]);
+  int rc = exe ? 0 : -1;
+  if (exe && cacheable) {
+    rc = memo_key(args, exe, inputs, ninputs, key);
+  }
+  free(exe);
+  struct SavedFds saved;
+  fflush(stdout);
+  fflush(stderr);
+  if (rc < 0 || redirect_apply(cmd, &saved) < 0) {
+    print_error();
+    return;
+  }
+  if (!cacheable) {
+    struct Command sub = {.args = args};
+    exec_external_cmd(&sub, NULL);
+    redirect_restore(&saved);
+    return;
+  }
+
+  int status;
+  int hit = memo_replay(key, STDOUT_FILENO, STDERR_FILENO, &status);
+  trace_event("memo", "\"cmd\":%lu,\"key\":\"%s\",\"hit\":%s", command_id, key,
+              hit == 1 ? "true" : "false");
+  if (hit == 1) {
+    stats_count(STAT_MEMO_HITS);
+    last_status = status;
+  } else if (hit == 0) {
+    stats_count(STAT_MEMO_MISSES);
+    run_memo_miss(args, key, STDOUT_FILENO, STDERR_FILENO);
+  } else {
+    print_error();
+  }
+  redirect_restore(&saved);
+}
+
+/** Parse a count given to a builtin option
+ *
+ * Returns the value of `arg` if it is a whole decimal number from `min` to
+ * `max`, and -1 otherwise.
+ */
+static long parse_count(const char *arg, long min, long max) {
+  char *end;
+  errno = 0;
+  long value = strtol(arg, &end, 10);
+  if (*arg == '\0' || *end != '\0' || errno || value < min || value > max) {
+    return -1;
+  }
+  return value;
+}
+
+/** The `bench` builtin
+ *
+ * bench [-w WARMUPS] [-n RUNS] [-c CSV] [-j JSON] CMD ARGS... runs the
+ * external command CMD WARMUPS times (default 1) untimed and then RUNS
+ * times (default 10), each through exec_external_cmd() exactly as the shell
+ * would run it, and reports the wall time the shell saw from fork to reap
+ * together with the user and system time and max RSS from wait4. Redirects
+ * apply to CMD; the report goes to the shell's standard output, and -c and
+ * -j also write every run to a CSV or JSON file.
+ */
+void exec_bench_builtin(struct Command * cmd) {
+  long warmups = 1;
+  long runs = 10;
+  const char *csv = NULL;
+  const char *json = NULL;
+  char **args = cmd->args + 1;
+  int usage_ok = 1;
+  for (; usage_ok && args[0] && args[0][0] == '-'; args += 2) {
+    if (args[1] == NULL) {
+      usage_ok = 0;
+    } else if (!strcmp(args[0], "-w")) {
+      warmups = parse_count(args[1], 0, 1000000);
+    } else if (!strcmp(args[0], "-n")) {
+      runs = parse_count(args[1], 1, 1000000);
+    } else if (!strcmp(args[0], "-c")) {
+      csv = args[1];
+    } else if (!strcmp(args[0], "-j")) {
+      json = args[1];
+    } else {
+      usage_ok = 0;
+    }
+  }
+  // a missing command would fail every run, so catch it once up front
+  char *exe = usage_ok && args[0] ? lookup_shell_path(args[0]) : NULL;
+  struct BenchSample *samples = NULL;
+  if (exe == NULL || warmups < 0 || runs < 0 ||
+      (samples = malloc(runs * sizeof(*samples))) == NULL) {
+    free(exe);
+    print_error();
+    return;
+  }
+  free(exe);
+
+  struct Command sub = *cmd;
+  sub.args = args;
+  fflush(stdout);
+  for (long i = 0; i < warmups + runs; i++) {
+    struct rusage ru;
+    uint64_t start = trace_now_ns();
+    int status = exec_external_cmd(&sub, &ru);
+    uint64_t wall = trace_now_ns() - start;
+    if (status == -1) {
+      print_error();
+      free(samples);
+      return;
+    }
+    if (i >= warmups) {
+      struct BenchSample *sample = &samples[i - warmups];
+      sample->wall_ns = wall;
+      sample->user_ns = ru.ru_utime.tv_sec * 1000000000ull + ru.ru_utime.tv_usec * 1000ull;
+      sample->sys_ns = ru.ru_stime.tv_sec * 1000000000ull + ru.ru_stime.tv_usec * 1000ull;
+      sample->maxrss_kb = ru.ru_maxrss;
+      sample->status = status;
+    }
+  }
+
+  int saved_status = last_status;
+  bench_report(stdout, args, (int)warmups, samples, (int)runs);
+  fflush(stdout);
+  if ((csv && bench_write_csv(csv, samples, (int)runs) < 0) ||
+      (json && bench_write_json(json, args, (int)warmups, samples, (int)runs) < 0)) {
+    print_error();
+  } else {
+    last_status = saved_status;
+  }
+  free(samples);
+}
+
+/** Run every line of a script
+ *
+ * Stops early if `exit` ends a nested script. Returns 0 if the script had
+ * no lines at all, which utcsh treats as an error, and 1 otherwise.
+ */
+int run_script_lines(FILE * script) {
+  int ran = 0;
+  char *line = NULL;
+  size_t size = 0;
+  while (!script_exit && getline(&line, &size, script) != -1) {
+    ran = 1;
+    jobs_notify();
+    run_command_line(line);
+    arena_reset(&line_arena);
+  }
+  free(line);
+  return ran;
+}
+
+/** Run a script inside this shell
+ *
+ * The script runs with its own line arena, since the line that started it
+ * is still in use, and with the working directory and shell path saved
+ * around it: what it changes is put back afterwards, as if it had run in a
+ * shell of its own. With `fresh_path` it also starts from the default path,
+ * as a new utcsh would. Returns 0 on success and -1 after reporting an
+ * error.
+ */
+int run_nested_script(const char * path, int fresh_path) {
+  if (script_depth >= MAX_SCRIPT_DEPTH) {
+    print_error();
+    return -1;
+  }
+  FILE *script = fopen(path, "re");
+  int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  char **saved_path = save_shell_path();
+  if (script == NULL || cwd < 0 || saved_path == NULL ||
+      (fresh_path && !set_shell_path(default_shell_path))) {
+    if (script != NULL) fclose(script);
+    if (cwd >= 0) close(cwd);
+    free(saved_path);
+    print_error();
+    return -1;
+  }
+
+  uint64_t start = trace_now_ns();
+  struct Arena outer_arena = line_arena;
+  line_arena = (struct Arena){0};
+  script_depth++;
+  int ran = run_script_lines(script);
+  script_depth--;
+  script_exit = 0;
+  arena_destroy(&line_arena);
+  line_arena = outer_arena;
+  fclose(script);
+
+  set_shell_path(saved_path);
+  free(saved_path);
+  int restored = fchdir(cwd) == 0;
+  close(cwd);
+  if (trace_enabled()) {
+    char name[1024];
+    trace_event("script", "\"cmd\":%lu,\"depth\":%d,\"path\":%s,\"dur_ns\":%llu",
+                command_id, script_depth + 1,
+                trace_json_string(name, sizeof(name), path),
+                (unsigned long long)(trace_now_ns() - start));
+  }
+  if (!ran || !restored) {
+    print_error();
+    return -1;
+  }
+  return 0;
+}
+
+/** Run a nested script with the redirects of the command that started it */
+void run_redirected_script(struct Command * cmd, const char * path, int fresh_path) {
+  struct SavedFds saved;
+  fflush(stdout);
+  fflush(stderr);
+  if (redirect_apply(cmd, &saved) < 0) {
+    print_error();
+    return;
+  }
+  run_nested_script(path, fresh_path);
+  fflush(stdout);
+  fflush(stderr);
+  redirect_restore(&saved);
+}
+
+/** Is `path` the executable this shell is running from? */
+static int is_this_shell(const char *path) {
+  static struct stat self;
+  static int have_self = -1;
+  if (have_self < 0) {
+    have_self = stat("/proc/self/exe", &self) == 0;
+  }
+  struct stat st;
+  return have_self && stat(path, &st) == 0 && st.st_dev == self.st_dev &&
+         st.st_ino == self.st_ino;
+}
+
+/** Run a utcsh script named as a command without starting a new utcsh
+ *
+ * `utcsh FILE`, where utcsh is this very shell, and FILE.utcsh on its own
+ * (a script with no #! line, which exec could not run anyway) are run with
+ * run_nested_script() instead: no fork, exec or shell start-up. Redirects
+ * apply to the whole script. Returns 1 if the command was such a script and
+ * has been run, 0 if it should be run as an external command.
+ */
+int try_run_script(struct Command * cmd) {
+  const char *name = strrchr(cmd->args[0], '/');
+  name = name ? name + 1 : cmd->args[0];
+  size_t len = strlen(name);
+  int as_shell = !strcmp(name, "utcsh");
+  int as_script = len > 6 && !strcmp(name + len - 6, ".utcsh");
+  // cheap checks first: anything else goes straight to exec
+  if (!(as_shell && cmd->args[1] && !cmd->args[2] && cmd->args[1][0] != '-') &&
+      !(as_script && !cmd->args[1])) {
+    return 0;
+  }
+
+  char *exe = lookup_shell_path(cmd->args[0]);
+  const char *script = NULL;
+  if (exe != NULL && as_shell && is_this_shell(exe)) {
+    script = cmd->args[1];
+  } else if (exe != NULL && as_script) {
+    char magic[2] = {0, 0};
+    int fd = open(exe, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && read(fd, magic, 2) >= 0 && !(magic[0] == '#' && magic[1] == '!')) {
+      script = exe;
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  if (script != NULL) {
+    run_redirected_script(cmd, script, 1);
+  }
+  free(exe);
+  return script != NULL;
+}
 
 /** Execute an external command
  *
  * Execute an external command by fork-and-exec. Should also take care of
- * output redirection, if any is requested
+ * redirection, if any is requested. Returns the child's wait status,
+ * or -1 if no child ran. If `usage` is not NULL, the child's rusage is
+ * stored there.
  */
-void exec_external_cmd(struct Command *cmd) {
-  // printf("0: %s, 1: %s\n", cmd->args[0], cmd->args[1]);
-  // printf("%s", exe_exists_in_dir(cmd->args[0], cmd->args[1], 1));
-// printf("not in paths\n");
+int exec_external_cmd(struct Command *cmd, struct rusage *usage) {
+    stats_count(STAT_EXTERNALS);
+    uint64_t fork_start = trace_now_ns();
     pid_t pid = fork();
-    int valid_input = 0;
+    if (pid < 0) {
+      stats_count(STAT_FORK_ERRORS);
+      print_error();
+      return -1;
+    }
+    last_child = pid;
     if (!pid) {
+      jobs_reset_child_signals();
 
       if (0 != strcmp("/", cmd->args[0])) { // is_absolute_path(char*path)
-        if (cmd->outputFile) {
-          int fd = open(cmd->outputFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-          dup2(fd, 1); // redirect stdout to file
-          dup2(fd, 2); // redirect stderr to file
-          close(fd);
+        if (redirect_apply(cmd, NULL) < 0) {
+          print_error();
+          _exit(1);
         }
-        // set a pathAndName buffer
-        char *pathAndName = calloc(MAX_CHARS_PER_CMDLINE,sizeof(char));
-        // memset(pathAndName[i], 0, MAX_CHARS_PER_CMDLINE * sizeof(char));
-        for (int i = 0; i < 256 && shell_paths[i] != NULL; i++) {
-          // printf("111 :%s\n", shell_paths[i]);
-          strcpy(pathAndName,shell_paths[i]);
-          strcat(pathAndName, "/");
-          strcat(pathAndName, cmd->args[0]);
-        
-          if(access(pathAndName, F_OK) == 0) {
-            valid_input = 1;
-            break;
-          }
+        uint64_t lookup_start = trace_now_ns();
+        char *pathAndName = lookup_shell_path(cmd->args[0]);
+        if (trace_enabled()) {
+          char path[1024];
+          trace_event("lookup", "\"cmd\":%lu,\"found\":%s,\"path\":%s,"
+                      "\"path_entries\":%d,\"dur_ns\":%llu",
+                      command_id, pathAndName ? "true" : "false",
+                      trace_json_string(path, sizeof(path), pathAndName),
+                      shell_path_count(),
+                      (unsigned long long)(trace_now_ns() - lookup_start));
         }
 
-        if (valid_input == 0) {
+        if (pathAndName == NULL) {
             print_error();
           
         }
         else {
-          // int state = 
+          trace_event("exec", "\"cmd\":%lu", command_id);
+          char stamp[24];
+          snprintf(stamp, sizeof(stamp), "%llu", (unsigned long long)fork_start);
+          setenv(SPAWN_NS_ENV_NAME, stamp, 1);
+          snprintf(stamp, sizeof(stamp), "%llu", (unsigned long long)trace_now_ns());
+          setenv(EXEC_NS_ENV_NAME, stamp, 1);
           execv(pathAndName, cmd->args);
-          // if (state == -1) {
-          //   // print_error();
-          // }
+          print_error();
         }
+        // _exit, not exit: exit() would sync the script FILE we share with
+        // the parent and move its read position back
+        _exit(1);
       }
-      exit(0);
+      _exit(0);
     } else {
-      int status;
-      waitpid(pid, &status, 0);
-
-      //free buffer
-      // free(pathAndName);
+      uint64_t forked = trace_now_ns();
+      stats_count(STAT_FORKS);
+      stats_record(STAT_FORK, forked - fork_start);
+      if (trace_enabled()) {
+        char argv0[256];
+        trace_event("fork", "\"cmd\":%lu,\"child\":%d,\"argv0\":%s,\"dur_ns\":%llu",
+                    command_id, (int)pid,
+                    trace_json_string(argv0, sizeof(argv0), cmd->args[0]),
+                    (unsigned long long)(forked - fork_start));
+      }
 
+      int status;
+      struct rusage ru;
+      if (wait4(pid, &status, 0, &ru) == pid) {
+        stats_record(STAT_EXTERNAL, trace_now_ns() - fork_start);
+        trace_child_reaped(command_id, pid, status, &ru, fork_start);
+        last_status = WIFEXITED(status) ? WEXITSTATUS(status)
+                                        : 128 + WTERMSIG(status);
+        if (usage != NULL) {
+          *usage = ru;
+        }
+        return status;
+      }
   }
     
  
-  return;
+  return -1;
 }
 
 
@@ -323,6 +860,7 @@ void exec_external_cmd(struct Command *cmd) {
  * print the same error and exit
  */
 void print_error(){
+  last_status = 1;
   char emsg[30] = {"An error has occurred\n"};
   // fprintf(stderr, emsg);
   size_t nbytes_written = write(STDERR_FILENO, emsg, strlen(emsg));
@@ -330,140 +868,338 @@ void print_error(){
     exit(2);  // Shouldn't really happen -- if it does, error is unrecoverable
   }
 }
-/** merge many blanks into one
+/** tokenize a command line and run it
  *
- * char * dest is the string to be merged and input from the user
+ * char * command_line is the command line from the user, possibly holding
+ * several commands separated by the & sign
  */
-void merge_lines(char *dest) {
-  int index_src = 0;
-  int index_dest = 0;
-  char src[MAX_CHARS_PER_CMDLINE] = {'\0'};
-  int blank_flag[MAX_CHARS_PER_CMDLINE] = {0};
-  strcpy(src, dest);
-
-  while (src[index_src] != '\0' 
-  && (src[index_src] == ' ' || src[index_src] == '\t' || src[index_src] == '\n')) {
-    index_src++;
+void run_command_line(char * command_line) {
+  last_status = 0;
+  stats_count(STAT_LINES);
+  uint64_t start = trace_now_ns();
+  size_t length = strlen(command_line);
+  struct Token *tokens = tokenize_command_line(command_line);
+  uint64_t elapsed = trace_now_ns() - start;
+  stats_record(STAT_PARSE, elapsed);
+  if (trace_enabled()) {
+    size_t ntokens = 0;
+    while (tokens != NULL && tokens[ntokens].type != TOK_END) {
+      ntokens++;
+    }
+    trace_event("parse", "\"bytes\":%zu,\"tokens\":%zu,\"ok\":%s,\"dur_ns\":%llu",
+                length, ntokens, tokens ? "true" : "false",
+                (unsigned long long)elapsed);
   }
-
-  if (src[index_src] == '\0') {// a blank line
-  // dest ="  ";
+  if (tokens == NULL) {
+    print_error();
     return;
   }
-
-  for (unsigned int i = 0; i < strlen(src); i++) {
-    if (src[i] == ' ' || src[i] == '\t' || src[i] == '\n') {
-      blank_flag[i] = 1;
-    }
+  // expand globs here, before any fork, so the directory cache is shared by
+  // every later line
+  uint64_t glob_start = trace_now_ns();
+  struct Token *expanded = expand_globs(tokens, &line_arena);
+  if (expanded != tokens) {
+    stats_record(STAT_GLOB, trace_now_ns() - glob_start);
   }
-
-  for (unsigned int i = index_src; i < strlen(src) - 1; i++) {
-    if (!blank_flag[i]) {
-      dest[index_dest] = src[i];
-      index_dest++;
-    }
-    else if (blank_flag[i] && (int)i - 1 >= 0 && !blank_flag[i - 1]) {
-      dest[index_dest] = ' ';
-      index_dest++;
-    }
-    
+  if (expanded == NULL) {
+    print_error();
+    return;
+  }
+  tokens = expanded;
+  if (is_concurrent_command(tokens) == 1) {
+    execute_is_concurrent_command(tokens);
+  } else {
+    exec_command(tokens);
   }
-
-  dest[index_dest + 1] = '\0';
 }
 /** check if the command is need to be executed concurrently
  *
- * char * command_line is the command line from the user, 
+ * struct Token * tokens is the tokenized command line from the user,
  * if the command consists of the & sign, return 1
  */
-int is_concurrent_command(char * command_line) {
-  int i = 0;
-  while (command_line[i] != '\0') {
-    if (command_line[i] == '&') {
+int is_concurrent_command(struct Token * tokens) {
+  for (int i = 0; tokens[i].type != TOK_END; i++) {
+    if (tokens[i].type == TOK_AMP) {
       return 1;
     }
-    i++;
   }
   return 0;
 }
+/** Rebuild a readable command line from its tokens, for the job table
+ *
+ * The trailing & that made the line a job is left out. The text lives in
+ * line_arena. Returns NULL if it could not be allocated.
+ */
+char *join_tokens(struct Token * tokens) {
+  int ntokens = 0;
+  size_t len = 1;
+  for (; tokens[ntokens].type != TOK_END; ntokens++) {
+    len += strlen(tokens[ntokens].text) + 4; // room for <( and ) too
+  }
+  if (ntokens > 0 && tokens[ntokens - 1].type == TOK_AMP) {
+    ntokens--;
+  }
+  char *text = arena_alloc(&line_arena, len);
+  if (text == NULL) {
+    return NULL;
+  }
+  char *p = text;
+  for (int i = 0; i < ntokens; i++) {
+    size_t n = strlen(tokens[i].text);
+    int procsub = tokens[i].type == TOK_PROCSUB_IN || tokens[i].type == TOK_PROCSUB_OUT;
+    if (i > 0) {
+      *p++ = ' ';
+    }
+    if (procsub) {
+      *p++ = tokens[i].type == TOK_PROCSUB_IN ? '<' : '>';
+      *p++ = '(';
+    }
+    memcpy(p, tokens[i].text, n);
+    p += n;
+    if (procsub) {
+      *p++ = ')';
+    }
+  }
+  *p = '\0';
+  return text;
+}
 /** use fork and waitpid to execute the command concurrently
  *
- * first, seprate the command line into several(int command_index = 0;) commands by the & sign
+ * first, seprate the tokens into several(int command_index = 0;) commands by the & sign
  * second, fork command_index child processes and execute the command in each child process
+ *
+ * If the line ends with &, its commands form one background job in a process
+ * group of their own: the job goes into the job table and we return to the
+ * prompt without waiting.
+ */
+/* Is token i of a command one of its arguments? */
+static int is_argument(struct Token * tokens, int i) {
+  if (tokens[i].type != TOK_WORD) {
+    return 0;
+  }
+  // the word after >, >>, < or 2> is where a stream goes, not an argument
+  enum TokenType before = i > 0 ? tokens[i - 1].type : TOK_END;
+  return before != TOK_REDIRECT && before != TOK_APPEND &&
+         before != TOK_INPUT && before != TOK_ERR_REDIRECT;
+}
+
+/** The words of one command, NULL-terminated, as its argv for the audit log
+ *
+ * Each command of a concurrent line is parsed in its own child, so the shell
+ * logs the words it was given instead. The array lives in line_arena;
+ * returns NULL if it could not be allocated.
  */
-void execute_is_concurrent_command(char * command_line) {
-  int flag = 1;
-  for (unsigned int i = 0; i < strlen(command_line); i++) {
-    if (command_line[i] != '&' && command_line[i] != ' '
-     && command_line[i] != '\t' && command_line[i] != '\n') {
-      flag = 0;
+char **token_words(struct Token * tokens) {
+  int nwords = 0;
+  for (int i = 0; tokens[i].type != TOK_END; i++) {
+    nwords += is_argument(tokens, i);
+  }
+  char **words = arena_alloc(&line_arena, (nwords + 1) * sizeof(char *));
+  if (words == NULL) {
+    return NULL;
+  }
+  nwords = 0;
+  for (int i = 0; tokens[i].type != TOK_END; i++) {
+    if (is_argument(tokens, i)) {
+      words[nwords++] = tokens[i].text;
     }
   }
-  if (flag) {
+  words[nwords] = NULL;
+  return words;
+}
+
+void execute_is_concurrent_command(struct Token * tokens) {
+  // count the commands so the pid array can be sized up front
+  int max_commands = 1;
+  int ntokens = 0;
+  for (; tokens[ntokens].type != TOK_END; ntokens++) {
+    if (tokens[ntokens].type == TOK_AMP) {
+      max_commands++;
+    }
+  }
+  int background = tokens[ntokens - 1].type == TOK_AMP;
+  char *job_text = background ? join_tokens(tokens) : NULL;
+  struct Token **commands = arena_alloc(&line_arena, max_commands * sizeof(struct Token *));
+  pid_t *pids = arena_alloc(&line_arena, max_commands * sizeof(pid_t));
+  char ***words = audit_enabled() && !background
+                      ? arena_alloc(&line_arena, max_commands * sizeof(char **))
+                      : NULL;
+  if (commands == NULL || pids == NULL || (background && job_text == NULL) ||
+      (audit_enabled() && !background && words == NULL)) {
+    print_error();
     return;
   }
-  // get command lines array
+
+  // get command lines array: each & becomes the end of the command before it,
+  // and empty commands (as in "a & & b" or a trailing &) are skipped
   int command_index = 0;
-  char * commands[20] = {NULL};
-  unsigned int length = strlen(command_line);
-
-  for (unsigned int i = 0; i < length; i++) {
-    if (command_line[i] != '&') {
-      commands[command_index++] = &command_line[i];//commands[3]
-
-      unsigned int j;
-      for ( j = i + 1; j < length; j++) {
-        if (command_line[j] == '&') {
-          command_line[j] = '\0';
-          i = j;
-          break;
-        }
+  struct Token *start = tokens;
+  for (int i = 0; ; i++) {
+    if (tokens[i].type == TOK_AMP || tokens[i].type == TOK_END) {
+      int at_end = tokens[i].type == TOK_END;
+      if (&tokens[i] != start) {
+        commands[command_index++] = start;
       }
-      if (j == length)
+      tokens[i].type = TOK_END;
+      start = &tokens[i + 1];
+      if (at_end) {
         break;
+      }
     }
-    
   }
-  //command_line[length - 1] = '\0';
-  pid_t *pids = malloc(command_index * sizeof(pid_t));
+
+  // the batch takes one command id and its commands take the next one (each
+  // child evaluates its command in its own copy of the shell)
+  unsigned long batch_id = ++command_id;
+  uint64_t batch_start = trace_now_ns();
+  trace_event("batch", "\"cmd\":%lu,\"commands\":%d", batch_id, command_index);
+  pid_t pgid = 0;
+  int nforked = 0;
+  if (background) {
+    jobs_begin_launch();
+  }
   for (int i = 0; i < command_index; i++) {
-    // printf("%s\n", commands[i]);
-    // execute_command(commands[command_index]);
-    // execute command paralell child process
-    //int pid = fork();
-    // if (pid == 0) {}
+    if (words != NULL) {
+      words[i] = token_words(commands[i]);
+    }
+    uint64_t fork_start = trace_now_ns();
+    unsigned slot = placement_claim();
     pid_t pid = fork();
     if (pid < 0) {
+        stats_count(STAT_FORK_ERRORS);
         print_error();
+        pids[i] = -1;
     } else if (pid > 0) {
         pids[i] = pid;
+        placement_forked(pid, slot);
+        if (background) {
+          // set it here too, so the group exists before the next child joins
+          setpgid(pid, pgid ? pgid : pid);
+          pgid = pgid ? pgid : pid;
+          pids[nforked++] = pid;
+        }
+        stats_count(STAT_FORKS);
+        stats_record(STAT_FORK, trace_now_ns() - fork_start);
+        trace_event("fork", "\"cmd\":%lu,\"batch_index\":%d,\"child\":%d,\"dur_ns\":%llu",
+                    batch_id, i, (int)pid, (unsigned long long)(trace_now_ns() - fork_start));
     } else {
+        if (background) {
+          jobs_child_setup(pgid);
+        } else {
+          jobs_reset_child_signals();
+        }
+        if (placement_apply(slot) < 0) {
+          print_error(); // run the command unplaced rather than not at all
+        }
         exec_command(commands[i]);
-        exit(0);
+        fflush(stdout);
+        _exit(last_status);
     }
   }
 
+  if (background) {
+    jobs_add(pgid, pids, nforked, job_text, batch_id, batch_start);
+    command_id++;
+    return;
+  }
+
   for (int i  = 0 ; i < command_index ; i++) {
     int status;
-    waitpid(pids[i], &status, 0);
-    // printf("Command %s has completed successfully by PID=%d\n", argv[i+1], pids[i]);
-}
-
-  // execute commands paralell
+    struct rusage ru;
+    if (pids[i] > 0 && wait4(pids[i], &status, 0, &ru) == pids[i]) {
+      trace_child_reaped(batch_id, pids[i], status, &ru, batch_start);
+      placement_reaped(pids[i], &ru);
+      if (words != NULL && words[i] != NULL) {
+        audit_log(words[i], pids[i],
+                  WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status),
+                  batch_start);
+      }
+      if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        last_status = WEXITSTATUS(status); // any failure fails the batch
+      }
+    }
+  }
+  command_id++;
+  stats_record(STAT_BATCH, trace_now_ns() - batch_start);
 }
 /*
-* execute the command line from the user
+* execute the command from the user
 *
-* char * good_line is the command line from the user, this function can execute one command
-* several commands need invoke this command may times
+* struct Token * tokens is one command from the user, terminated by TOK_END.
+* this function can execute one command, several commands need invoke this
+* command may times
 */
-void exec_command(char * good_line) {
-           char **tokenized_cmd = tokenize_command_line(good_line); 
-         struct Command parsed_cmd = parse_command(tokenized_cmd);
-
-        // printf("wegethere\n");parsed_cmd.args[1]
-      
-        if (parsed_cmd.args != NULL) {
-          eval(&parsed_cmd);
-        }
-}
\ No newline at end of file
+void exec_command(struct Token * tokens) {
+  if (tokens[0].type == TOK_END) {
+    return; // a blank line
+  }
+  struct Command parsed_cmd;
+  enum ParseError err = parse_command(tokens, &line_arena, &parsed_cmd);
+  if (err != PARSE_OK) {
+    trace_event("parse_error", "\"cmd\":%lu,\"reason\":\"%s\"",
+                command_id, parse_error_string(err));
+    print_error();
+    return;
+  }
+
+  if (parsed_cmd.args[0] == NULL) {
+    return;
+  }
+  if (procsub_start(&parsed_cmd, &line_arena, run_procsub_line) < 0) {
+    print_error();
+    return;
+  }
+  eval(&parsed_cmd);
+  procsub_finish(&parsed_cmd);
+}
+
+/** Start the shell in server mode
+ *
+ * utcsh --server SOCKET [-j N] serves command lines on a UNIX-domain socket
+ * with N pre-forked workers, one per online CPU by default. The shell path
+ * and everything else main() sets up is done once here and inherited by
+ * every worker. See server.h for the protocol.
+ */
+int run_server(int argc, char **argv) {
+  long nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (argc == 5 && !strcmp(argv[3], "-j")) {
+    char *end;
+    nworkers = strtol(argv[4], &end, 10);
+    if (*argv[4] == '\0' || *end != '\0' || nworkers < 1 || nworkers > 1024) {
+      print_error();
+      return 1;
+    }
+  } else if (argc != 3) {
+    print_error();
+    return 1;
+  }
+  if (nworkers < 1) {
+    nworkers = 1;
+  }
+  int rc = server_main(argv[2], (int)nworkers, run_server_request);
+  if (rc != 0) {
+    print_error();
+  }
+  return rc;
+}
+
+/** Run one command line on behalf of a server client
+ *
+ * Called in a runner process forked for this line alone, with stdout and
+ * stderr connected to the client. Returns the line's exit status.
+ */
+int run_server_request(char * command_line) {
+  run_command_line(command_line);
+  arena_reset(&line_arena);
+  return last_status;
+}
+
+/** Run the cmd of a process substitution
+ *
+ * Called in the child forked for <(cmd) or >(cmd), with its standard output
+ * or input connected to the pipe. Returns the exit status of cmd.
+ */
+int run_procsub_line(char * command_line) {
+  run_command_line(command_line);
+  return last_status;
+}
@@ -17,14 +17,27 @@
   if (verbose)                                                                 \
   printf((x), ##__VA_ARGS__)
 
-extern char shell_paths[MAX_ENTRIES_IN_SHELLPATH][MAX_CHARS_PER_CMDLINE];
-
 /* Should the UTCSH internal functions dump verbose output? */
 static int utcsh_internal_verbose = 0;
 
 /* record path info */
 int pathLen = 0;
 
+/* The shell path. Directory names live back to back, NUL-terminated, in one
+   growable pool; path_entries[i] is the offset of the i-th directory. A
+   directory that is already in the path is not added again (the first copy
+   always wins the lookup anyway), and an open-addressing hash of the offsets
+   finds such repeats in O(1). Everything grows by doubling, so appending is
+   O(1) amortized and there is no limit on the number or length of entries.
+   Unlike a fixed table, only the bytes in use are ever touched, so there is
+   nothing extra for fork() to copy-on-write. */
+static char *path_pool;
+static size_t pool_len, pool_cap;
+static size_t *path_entries;
+static size_t entries_cap;
+static size_t *path_hash; /* offset + 1, or 0 for an empty slot */
+static size_t hash_cap;   /* A power of two, at least twice pathLen */
+
 void maybe_print_error() {
   if (utcsh_internal_verbose) {
     char *err = strerror(errno);
@@ -32,43 +45,131 @@ void maybe_print_error() {
   }
 }
 
-int set_shell_path(char **newPaths) {
-  if (!newPaths) {
+static size_t hash_string(const char *s) {
+  size_t h = 14695981039346656037ull; /* FNV-1a */
+  for (; *s; s++) {
+    h = (h ^ (unsigned char)*s) * 1099511628211ull;
+  }
+  return h;
+}
+
+/* Slot of `dir` in path_hash, or of the empty slot where it would go */
+static size_t *hash_slot(const char *dir) {
+  size_t mask = hash_cap - 1;
+  for (size_t i = hash_string(dir) & mask;; i = (i + 1) & mask) {
+    if (!path_hash[i] || STR_EQ(path_pool + path_hash[i] - 1, dir)) {
+      return &path_hash[i];
+    }
+  }
+}
+
+static int grow_path_hash(void) {
+  size_t newcap = hash_cap ? hash_cap * 2 : 16;
+  size_t *grown = calloc(newcap, sizeof(*grown));
+  if (!grown) {
+    return 0;
+  }
+  free(path_hash);
+  path_hash = grown;
+  hash_cap = newcap;
+  for (int i = 0; i < pathLen; i++) {
+    *hash_slot(path_pool + path_entries[i]) = path_entries[i] + 1;
+  }
+  return 1;
+}
+
+/* Append dir to the path unless it is already there. Returns 0 if out of
+   memory. */
+static int append_shell_path(const char *dir) {
+  if ((size_t)pathLen * 2 >= hash_cap && !grow_path_hash()) {
     return 0;
   }
-  int i;
-  for (i = 0; i < MAX_ENTRIES_IN_SHELLPATH; ++i) {
-    memset(shell_paths[i], 0, MAX_CHARS_PER_CMDLINE * sizeof(char));
+  size_t *slot = hash_slot(dir);
+  if (*slot) {
+    return 1;
+  }
+
+  size_t len = strlen(dir) + 1;
+  if (pool_len + len > pool_cap) {
+    size_t newcap = pool_cap ? pool_cap : 256;
+    while (newcap < pool_len + len) {
+      newcap *= 2;
+    }
+    char *grown = realloc(path_pool, newcap);
+    if (!grown) {
+      return 0;
+    }
+    path_pool = grown;
+    pool_cap = newcap;
   }
-  for (i = 0; i < MAX_ENTRIES_IN_SHELLPATH && newPaths[i]; ++i) {
-    if (strlen(newPaths[i]) + 1 > MAX_CHARS_PER_CMDLINE) {
-      return 0; /* This path is too long. */
+  if ((size_t)pathLen == entries_cap) {
+    size_t newcap = entries_cap ? entries_cap * 2 : 16;
+    size_t *grown = realloc(path_entries, newcap * sizeof(*grown));
+    if (!grown) {
+      return 0;
     }
-    strcpy(shell_paths[i], newPaths[i]);
+    path_entries = grown;
+    entries_cap = newcap;
   }
-  //set current pathLen
-  pathLen = i;
 
+  memcpy(path_pool + pool_len, dir, len);
+  path_entries[pathLen++] = pool_len;
+  *slot = pool_len + 1;
+  pool_len += len;
   return 1;
 }
 
+int set_shell_path(char **newPaths) {
+  if (!newPaths) {
+    return 0;
+  }
+  /* Keep the storage for the new path; the hash is small, so clear it all */
+  if (path_hash) {
+    memset(path_hash, 0, hash_cap * sizeof(*path_hash));
+  }
+  pathLen = 0;
+  pool_len = 0;
+  return add_shell_path(newPaths);
+}
+
 int add_shell_path(char **newPaths){
   if (!newPaths) {
     return 0;
   }
-  int i = pathLen;
-  for (; i < MAX_ENTRIES_IN_SHELLPATH && newPaths[i - pathLen]; ++i) {
-    if (strlen(newPaths[i - pathLen]) + 1 > MAX_CHARS_PER_CMDLINE) {
-      return 0; /* This path is too long. */
+  for (int i = 0; newPaths[i]; ++i) {
+    if (!append_shell_path(newPaths[i])) {
+      return 0;
     }
-    strcpy(shell_paths[i], newPaths[i - pathLen]);
   }
-  // refine pathLen
-  pathLen = i;
-
   return 1;  
 }
 
+char **save_shell_path(void) {
+  size_t ptrs = (pathLen + 1) * sizeof(char *);
+  char **saved = malloc(ptrs + pool_len);
+  if (!saved) {
+    return NULL;
+  }
+  char *pool = (char *)saved + ptrs;
+  if (pool_len) {
+    memcpy(pool, path_pool, pool_len);
+  }
+  for (int i = 0; i < pathLen; i++) {
+    saved[i] = pool + path_entries[i];
+  }
+  saved[pathLen] = NULL;
+  return saved;
+}
+
+int shell_path_count(void) { return pathLen; }
+
+const char *shell_path_entry(int i) {
+  if (i < 0 || i > pathLen) {
+    return NULL;
+  }
+  return i == pathLen ? "" : path_pool + path_entries[i];
+}
+
 int is_absolute_path(char *path) {
   if (!path) {
     return 0;
@@ -4,12 +4,12 @@
 #define MAX_WORDS_PER_CMDLINE 256
 #define MAX_CHARS_PER_CMD 512
 #define MAX_WORDS_PER_CMD 64
-#define MAX_ENTRIES_IN_SHELLPATH 256
 
 /**
- * Modify the shell_paths global. Will run until all MAX_ENTRIES_IN_SHELLPATH
- * elements have been set or a NULL char* is found in newPaths. Returns 1 on
- * success and zero on error *
+ * Replace the shell path with the directories in newPaths, which ends with a
+ * NULL char*. There is no limit on the number or length of directories, and
+ * a directory already in the path is not added twice. Returns 1 on success
+ * and zero on error (newPaths is NULL or memory ran out).
  */
 
 // can be setted static and delete here latter
@@ -17,8 +17,22 @@ extern int pathLen;
 
 int set_shell_path(char **newPaths);
 
+/** Like set_shell_path, but append to the current path */
 int add_shell_path(char **newPaths);
 
+/** A copy of the shell path as a NULL-terminated array, for handing back to
+ * set_shell_path() later. It is a single allocation: free() it when done.
+ * Returns NULL if memory ran out. */
+char **save_shell_path(void);
+
+/** Number of directories in the shell path (the same as pathLen) */
+int shell_path_count(void);
+
+/** The i-th directory in the shell path. Index shell_path_count() gives "",
+ * which joined with "/" and an absolute command name still names that
+ * command. Returns NULL for any other index. */
+const char *shell_path_entry(int i);
+
 /** Returns 1 if this is an absolute path, 0 otherwise */
 int is_absolute_path(char *path);
 
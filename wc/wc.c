@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <ctype.h>
 
+#include "wc.h"
+
 
 void do_wc(FILE* f, const char* name) {
     
@@ -38,7 +40,7 @@ void do_wc(FILE* f, const char* name) {
     }
 }
 
-int main(int argc, char** argv) {
+int wc_main(int argc, char** argv, FILE* in) {
     if (argc > 1) {
         for(int i = 1; i < argc; i++) {
             FILE* f = fopen(argv[i], "r");
@@ -48,8 +50,15 @@ int main(int argc, char** argv) {
             if(f) { fclose(f); }
         }
     } else {
-        if(stdin != NULL) {
-            do_wc(stdin, "stdin");
+        if(in != NULL) {
+            do_wc(in, "stdin");
         }
     }
+    return 0;
+}
+
+#ifndef WC_NO_MAIN
+int main(int argc, char** argv) {
+    return wc_main(argc, argv, stdin);
 }
+#endif
@@ -0,0 +1,16 @@
+#ifndef WC_H
+#define WC_H
+
+#include <stdio.h>
+
+/* Count lines, words and bytes in f and print them, tab separated, followed
+   by name */
+void do_wc(FILE* f, const char* name);
+
+/* Run wc on the files named in argv[1..], or on `in` if there are none.
+   Output goes to stdout. Returns the exit status. Build wc.c with
+   -DWC_NO_MAIN to link this into another program (utcsh runs it as a
+   builtin). */
+int wc_main(int argc, char** argv, FILE* in);
+
+#endif